@@ -0,0 +1,53 @@
+// Example: measuring Dispatcher::parallelFor throughput for different worker counts
+// - Every run executes the same amount of work split into many small tasks
+// - Each line shows how many items per millisecond the dispatcher managed to process
+
+#include <mustache/utils/dispatch.hpp>
+#include <mustache/utils/logger.hpp>
+#include <mustache/utils/timer.hpp>
+
+#include <atomic>
+#include <cmath>
+
+using namespace mustache;
+
+namespace {
+    constexpr size_t kItemCount = 1u << 20u;
+    constexpr uint32_t kTaskCount = 4096u;
+    constexpr uint32_t kIterationCount = 16u;
+
+    double runBenchmark(uint32_t thread_count) {
+        Dispatcher dispatcher{thread_count};
+        std::atomic<uint64_t> checksum{0u};
+        const auto work = [&checksum](size_t index) {
+            double value = static_cast<double>(index);
+            for (uint32_t i = 0; i < 16u; ++i) {
+                value = std::sqrt(value + 1.0);
+            }
+            if (value < 0.0) {
+                checksum.fetch_add(1u, std::memory_order_relaxed);
+            }
+        };
+        dispatcher.parallelFor(work, 0, kItemCount, kTaskCount); // warm up workers
+        Timer timer;
+        for (uint32_t i = 0; i < kIterationCount; ++i) {
+            dispatcher.parallelFor(work, 0, kItemCount, kTaskCount);
+        }
+        return timer.elapsed() * 1000.0;
+    }
+}
+
+int main() {
+    const auto max_threads = Dispatcher::maxThreadCount();
+    for (uint32_t thread_count = 1u; ; thread_count *= 2u) {
+        const auto workers = thread_count < max_threads ? thread_count : max_threads;
+        const auto time = runBenchmark(workers);
+        const auto items = static_cast<double>(kItemCount) * kIterationCount;
+        Logger{}.hideContext().info("Workers: %d, time: %fms, throughput: %f items/ms",
+                                    workers, time, items / time);
+        if (workers == max_threads) {
+            break;
+        }
+    }
+    return 0;
+}
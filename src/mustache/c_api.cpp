@@ -76,17 +76,19 @@ namespace converter {
             callback(job, convert(&world), tasks_count.toInt(), job_size.toInt(), convert(mode));
         };
     }
-    mustache::ComponentInfo::Constructor convert(void(*create)(void*, Entity, World*)) {
+    using CreateFunction = void(*)(void*, Entity, World*);
+
+    void callCreateFunction(const void* context, void* ptr, const mustache::Entity& e, mustache::World& w) {
+        // context is the C function, conditionally-supported cast that is valid on all supported platforms
+        const auto create = reinterpret_cast<CreateFunction>(const_cast<void*>(context));
+        create(ptr, convert(e), convert(&w));
+    }
+
+    mustache::ComponentInfo::Constructor convert(CreateFunction create) {
         if (create == nullptr) {
             return mustache::ComponentInfo::Constructor{};
         }
-        return [create](void* ptr, const mustache::Entity& e, mustache::World& w) {
-            if (create != nullptr) {
-                create(ptr, convert(e), convert(&w));
-            } else {
-                mustache::Logger{}.error("Create function is null!");
-            }
-        };
+        return mustache::ComponentInfo::Constructor{&callCreateFunction, reinterpret_cast<const void*>(create)};
     }
 
     mustache::ComponentInfo convert(const TypeInfo& info) noexcept {
@@ -97,6 +99,7 @@ namespace converter {
         type_info.type_id_hash_code = std::hash<std::string>{}(info.name);
 
         type_info.functions.create = convert(info.functions.create);
+        type_info.world_constructor = info.functions.create != nullptr; // C constructor always gets the world
 
         type_info.functions.copy = info.functions.copy;
         type_info.functions.move = info.functions.move;
@@ -309,6 +312,12 @@ Job* makeJob(JobDescriptor info) {
     for (uint32_t i = 0; i < info.check_update_size; ++i) {
         job->version_check_mask.set(convert(info.check_update[i]), true);
     }
+    for (uint32_t i = 0; i < info.exclude_size; ++i) {
+        job->exclude_mask.set(convert(info.exclude[i]), true);
+    }
+    for (uint32_t i = 0; i < info.any_of_size; ++i) {
+        job->any_mask.set(convert(info.any_of[i]), true);
+    }
     job->require_entity = info.entity_required;
     return convert(job.release());
 }
@@ -325,16 +334,12 @@ Entity createEntity(World* world, Archetype* archetype) {
     return convert(convert(world)->entities().create(*convert(archetype)));
 }
 void createEntityGroup(World* world, Archetype* archetype_ptr, Entity* ptr, uint32_t count) {
-    auto& entities = convert(world)->entities();
     auto& archetype = *convert(archetype_ptr);
+    const auto group = convert(world)->entities().createGroup(archetype, count);
     auto* out = reinterpret_cast<mustache::Entity*>(ptr);
     if (out) {
         for (uint32_t i = 0; i < count; ++i) {
-            out[i] = entities.create(archetype);
-        }
-    } else {
-        for (uint32_t i = 0; i < count; ++i) {
-            (void) entities.create(archetype);
+            out[i] = group[i];
         }
     }
 }
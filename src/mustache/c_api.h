@@ -87,6 +87,10 @@ typedef struct {
     uint32_t check_update_size;
     bool entity_required;
     const char* name;
+    ComponentId* exclude; // entities with any of these components are skipped
+    uint32_t exclude_size;
+    ComponentId* any_of; // if not empty, entities must have at least one of these components
+    uint32_t any_of_size;
 } JobDescriptor;
 
 typedef struct {
@@ -8,19 +8,41 @@
 #include <mustache/ecs/new_component_data_storage.hpp>
 #include <mustache/ecs/default_component_data_storage.hpp>
 
+#include <algorithm>
 #include <cstring>
 
 using namespace mustache;
 
+namespace {
+    // copies value to the first item and then doubles the filled part, so every memcpy is a large block copy
+    void fillWithValue(void* dest, const std::byte* value, size_t size, uint32_t count) noexcept {
+        const size_t total = size * count;
+        if (total == 0u) {
+            return;
+        }
+        auto ptr = static_cast<std::byte*>(dest);
+        memcpy(ptr, value, size);
+        for (size_t filled = size; filled < total;) {
+            const size_t part = std::min(filled, total - filled);
+            memcpy(ptr + filled, ptr, part);
+            filled += part;
+        }
+    }
+}
+
 Archetype::Archetype(World& world, ArchetypeIndex id, const ComponentIdMask& mask,
-                     const SharedComponentsInfo& shared_components_info, uint32_t chunk_size):
-        data_storage_{mask, world.memoryManager()},
+                     const SharedComponentsInfo& shared_components_info, uint32_t chunk_size,
+                     const ComponentIdMask& cold_mask):
+        data_storage_{ComponentFactory::instance().withoutTags(mask), world.memoryManager(), world.storagePagePolicy(),
+                      cold_mask},
         entities_{world.memoryManager()},
-        operation_helper_{world.memoryManager(), mask},
+        operation_helper_{world.memoryManager(), ComponentFactory::instance().withoutTags(mask)},
         world_{world},
         mask_{mask},
         shared_components_info_ {shared_components_info},
-        version_storage_{world.memoryManager(), mask.componentsCount(), chunk_size, makeComponentMask(mask)},
+        // tag components have no column and no version
+        version_storage_{world.memoryManager(), ComponentFactory::instance().withoutTags(mask).componentsCount(),
+                         chunk_size, makeComponentMask(mask)},
 //        data_storage_{std::make_unique<NewComponentDataStorage>(mask, world_.memoryManager())},
 //        data_storage_{std::make_unique<StableLatencyComponentDataStorage>(mask, world_.memoryManager())},
         id_{id} {
@@ -40,6 +62,7 @@ ComponentStorageIndex Archetype::pushBack(Entity entity) {
     MUSTACHE_PROFILER_BLOCK_LVL_2(__FUNCTION__);
     const auto index = ComponentStorageIndex::make(entities_.size());
     versionStorage().emplace(worldVersion(), index.toArchetypeIndex());
+    disabled_.reserve(index.next().toInt());
     entities_.push_back(entity);
     data_storage_.emplace(index);
     return index;
@@ -52,8 +75,12 @@ const ArrayWrapper<Entity, ArchetypeEntityIndex, true>& Archetype::entities() co
 
 WorldVersion Archetype::getComponentVersion(ArchetypeEntityIndex index, ComponentId id) const noexcept {
     MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
-    return versionStorage().getVersion(versionStorage().chunkAt(index),
-                                       getComponentIndex(id));
+    const auto component_index = getComponentIndex(id);
+    if (component_index.isNull()) {
+        // tag components are not versioned
+        return WorldVersion::null();
+    }
+    return versionStorage().getVersion(versionStorage().chunkAt(index), component_index);
 }
 
 uint32_t Archetype::capacity() const noexcept {
@@ -61,6 +88,14 @@ uint32_t Archetype::capacity() const noexcept {
     return data_storage_.capacity();
 }
 
+uint32_t Archetype::compact(uint32_t budget) {
+    MUSTACHE_PROFILER_BLOCK_LVL_1(__FUNCTION__);
+    if (isEmpty()) {
+        entities_.shrink_to_fit();
+    }
+    return data_storage_.compact(budget);
+}
+
 ArchetypeIndex Archetype::id() const noexcept {
     MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
     return id_;
@@ -81,6 +116,13 @@ bool Archetype::isMatch(const ComponentIdMask& mask) const noexcept {
     return mask_.isMatch(mask);
 }
 
+bool Archetype::isMatch(const ComponentIdMask& mask, const ComponentIdMask& exclude,
+                        const ComponentIdMask& any) const noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
+    return mask_.isMatch(mask) && mask_.intersection(exclude).isEmpty() &&
+           (any.isEmpty() || !mask_.intersection(any).isEmpty());
+}
+
 bool Archetype::isMatch(const SharedComponentIdMask& mask) const noexcept {
     MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
     return shared_components_info_.isMatch(mask);
@@ -98,6 +140,7 @@ bool Archetype::hasComponent(SharedComponentId component_id) const noexcept {
 
 void Archetype::popBack() {
     MUSTACHE_PROFILER_BLOCK_LVL_2(__FUNCTION__);
+    disabled_.set(ArchetypeEntityIndex::make(size() - 1u), false);
     entities_.pop_back();
     data_storage_.decrSize();
 }
@@ -147,6 +190,9 @@ void Archetype::externalMove(Entity entity, Archetype& prev_archetype, Archetype
     MUSTACHE_PROFILER_BLOCK_LVL_2(__FUNCTION__);
 
     const auto index = pushBack(entity);
+    if (!prev_archetype.isEnabled(prev_index)) {
+        setEnabled(index.toArchetypeIndex(), false);
+    }
     ComponentIndex component_index = ComponentIndex::make(0);
 //    const auto source_view = prev_archetype.getElementView(prev_index);
 //    const auto dest_view = getElementView(index.toArchetypeIndex());
@@ -170,10 +216,100 @@ void Archetype::externalMove(Entity entity, Archetype& prev_archetype, Archetype
     world_.entities().updateLocation(entity, this, index.toArchetypeIndex());
 }
 
-ArchetypeEntityIndex Archetype::insert(Entity entity, const ComponentIdMask& skip_constructor) {
+void Archetype::externalMoveAll(Archetype& prev_archetype, const ComponentIdMask& skip_constructor) {
+    if (this == &prev_archetype) {
+        std::string msg = "Moving from archetype [" + mask_.toString() + "] to itself";
+        throw std::runtime_error(msg);
+    }
+    MUSTACHE_PROFILER_BLOCK_LVL_1(__FUNCTION__);
+
+    const uint32_t count = prev_archetype.size();
+    if (count == 0u) {
+        return;
+    }
+    const uint32_t first = emplaceBack(count).toInt();
+    const uint32_t end = first + count;
+    std::copy(prev_archetype.entities_.begin(), prev_archetype.entities_.end(), entities_.begin() + first);
+    if (prev_archetype.disabledCount() > 0u) {
+        for (uint32_t i = 0u; i < count; ++i) {
+            if (!prev_archetype.isEnabled(ArchetypeEntityIndex::make(i))) {
+                setEnabled(ArchetypeEntityIndex::make(first + i), false);
+            }
+        }
+    }
+
+    constexpr auto safety = FunctionSafety::kUnsafe;
+    ComponentIndex component_index = ComponentIndex::make(0);
+    for (const auto& info : operation_helper_.external_move) {
+        const auto prev_component_index = prev_archetype.getComponentIndex<FunctionSafety::kSafe>(info.id);
+        if (prev_component_index.isValid()) {
+            // both storages are contiguous up to distToChunkEnd, move by runs
+            for (uint32_t source = 0u; source < count;) {
+                const auto source_index = ArchetypeEntityIndex::make(source);
+                const auto dest_index = ArchetypeEntityIndex::make(first + source);
+                const uint32_t run = std::min(count - source, std::min(prev_archetype.distToChunkEnd(source_index),
+                                                                       distToChunkEnd(dest_index)));
+                auto source_ptr = static_cast<std::byte*>(prev_archetype.getData<safety>(prev_component_index,
+                                                                                         source_index));
+                auto dest_ptr = static_cast<std::byte*>(getData<safety>(component_index, dest_index));
+                if (info.move_ptr) {
+                    for (uint32_t i = 0u; i < run; ++i) {
+                        info.move_ptr(dest_ptr + i * info.size, source_ptr + i * info.size);
+                    }
+                } else {
+                    memcpy(dest_ptr, source_ptr, run * info.size);
+                }
+                source += run;
+            }
+        } else if (info.hasConstructorOrAfterAssign() && !skip_constructor.has(info.id)) {
+            for (uint32_t i = first; i < end; ++i) {
+                const auto index = ArchetypeEntityIndex::make(i);
+                info.constructorAndAfterAssign(getData<safety>(component_index, index), world_,
+                                               *entityAt<safety>(index));
+            }
+        }
+        ++component_index;
+    }
+
+    if (!prev_archetype.operation_helper_.before_remove_functions.empty()) {
+        const auto components_to_be_removed = prev_archetype.mask_.subtract(mask_);
+        for (uint32_t i = 0u; i < count; ++i) {
+            prev_archetype.callOnRemove(ArchetypeEntityIndex::make(i), components_to_be_removed);
+        }
+    }
+    prev_archetype.removeAll();
+
+    auto& entity_manager = world_.entities();
+    for (uint32_t i = first; i < end; ++i) {
+        const auto index = ArchetypeEntityIndex::make(i);
+        entity_manager.updateLocation(*entityAt<safety>(index), this, index);
+    }
+}
+
+ArchetypeEntityIndex Archetype::emplaceBack(uint32_t count) {
     MUSTACHE_PROFILER_BLOCK_LVL_2(__FUNCTION__);
-    const auto index = pushBack(entity);
+    const uint32_t first = size();
+    const uint32_t end = first + count;
+    disabled_.reserve(end);
+    entities_.resize(end);
+    data_storage_.emplaceBack(count);
+    // versions are updated once per chunk instead of once per entity
+    const auto world_version = worldVersion();
+    const auto chunk_size = versionStorage().chunkSize();
+    for (uint32_t i = first; i < end; i = (i / chunk_size + 1u) * chunk_size) {
+        versionStorage().emplace(world_version, ArchetypeEntityIndex::make(i));
+    }
+    return ArchetypeEntityIndex::make(first);
+}
+
+void Archetype::initEntity(Entity entity, ArchetypeEntityIndex index, const ComponentIdMask& skip_constructor) {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
+    *entityAt<FunctionSafety::kUnsafe>(index) = entity;
+    constructComponents(entity, index, skip_constructor);
+    world_.entities().updateLocation(entity, this, index);
+}
 
+void Archetype::constructComponents(Entity entity, ArchetypeEntityIndex index, const ComponentIdMask& skip_constructor) {
     const bool is_skip_mask_empty = skip_constructor.isEmpty();
     const bool skip_all_constructors = (skip_constructor == mask_);
     if (!skip_all_constructors) {
@@ -192,6 +328,55 @@ ArchetypeEntityIndex Archetype::insert(Entity entity, const ComponentIdMask& ski
             }
         }
     }
+}
+
+bool Archetype::hasWorldInit() const noexcept {
+    return operation_helper_.has_world_init;
+}
+
+EntityGroup Archetype::createGroup(size_t count) {
+    return world_.entities().createGroup(*this, static_cast<uint32_t>(count));
+}
+
+void Archetype::insert(const EntityGroup& group) {
+    MUSTACHE_PROFILER_BLOCK_LVL_1(__FUNCTION__);
+    const uint32_t count = group.size();
+    if (count == 0u) {
+        return;
+    }
+    const uint32_t first = emplaceBack(count).toInt();
+    const uint32_t end = first + count;
+    for (uint32_t i = 0u; i < count; ++i) {
+        entities_[ArchetypeEntityIndex::make(first + i)] = group[i];
+    }
+
+    constexpr auto safety = FunctionSafety::kUnsafe;
+    for (const auto& info : operation_helper_.insert) {
+        for (uint32_t i = first; i < end; ++i) {
+            const auto index = ArchetypeEntityIndex::make(i);
+            info.constructor(getData<safety>(info.component_index, index), *entityAt<safety>(index), world_);
+        }
+    }
+    for (const auto& info : operation_helper_.create_with_value) {
+        for (uint32_t i = first; i < end;) {
+            const auto index = ArchetypeEntityIndex::make(i);
+            const uint32_t run = std::min(end - i, distToChunkEnd(index));
+            fillWithValue(getData<safety>(info.component_index, index), info.value, info.size, run);
+            i += run;
+        }
+    }
+
+    auto& entity_manager = world_.entities();
+    for (uint32_t i = first; i < end; ++i) {
+        const auto index = ArchetypeEntityIndex::make(i);
+        entity_manager.updateLocation(*entityAt<safety>(index), this, index);
+    }
+}
+
+ArchetypeEntityIndex Archetype::insert(Entity entity, const ComponentIdMask& skip_constructor) {
+    MUSTACHE_PROFILER_BLOCK_LVL_2(__FUNCTION__);
+    const auto index = pushBack(entity);
+    constructComponents(entity, index.toArchetypeIndex(), skip_constructor);
     versionStorage().emplace(worldVersion(), index.toArchetypeIndex());
     world_.entities().updateLocation(entity, this, index.toArchetypeIndex());
     return index.toArchetypeIndex();
@@ -200,6 +385,9 @@ ArchetypeEntityIndex Archetype::insert(Entity entity, const ComponentIdMask& ski
 void Archetype::cloneEntity(Entity source, Entity dest, ArchetypeEntityIndex src_index, CloneEntityMap& map) {
     const auto dest_index = pushBack(dest).toArchetypeIndex();
     world_.entities().updateLocation(dest, this, dest_index);
+    if (!isEnabled(src_index)) {
+        setEnabled(dest_index, false);
+    }
     {
         ComponentIndex component_index = ComponentIndex::make(0);
         for (const auto& clone_fn: operation_helper_.clone) {
@@ -239,6 +427,7 @@ void Archetype::internalMove(ArchetypeEntityIndex source_index, ArchetypeEntityI
     world_.entities().updateLocation(source_entity, this, destination_index);
 
     dest_entity = source_entity;
+    setEnabled(destination_index, isEnabled(source_index));
 
     callDestructor(source_index);
 }
@@ -279,12 +468,64 @@ void Archetype::remove(Entity entity_to_destroy, ArchetypeEntityIndex entity_ind
         internalMove(last_index, entity_index);
     }
 
-    /// TODO: fix for NewComponentDataStorage
-    /*if (isEmpty()) {
-        entities_.clear();
-        entities_.shrink_to_fit();
-        data_storage_->clear(true);
-    }*/
+    // memory is not released here: removing the last entity and adding a new one must not reallocate, see compact
+}
+
+void Archetype::removeGroup(const mustache::vector<ArchetypeEntityIndex>& indices) {
+    MUSTACHE_PROFILER_BLOCK_LVL_1(__FUNCTION__);
+    if (indices.empty()) {
+        return;
+    }
+    if (indices.size() == size()) {
+        removeAll();
+        return;
+    }
+
+    constexpr auto safety = FunctionSafety::kUnsafe;
+    const auto last_chunk = lastChunkIndex();
+    auto& entity_manager = world_.entities();
+    for (const auto& index : indices) {
+        const auto last_index = data_storage_.lastItemIndex().toArchetypeIndex();
+        if (index != last_index) {
+            ComponentIndex component_index = ComponentIndex::make(0);
+            for (const auto& info : operation_helper_.internal_move) {
+                info.move(getData<safety>(component_index, index), getData<safety>(component_index, last_index));
+                ++component_index;
+            }
+            const auto moved_entity = *entityAt<safety>(last_index);
+            *entityAt<safety>(index) = moved_entity;
+            setEnabled(index, isEnabled(last_index));
+            entity_manager.updateLocation(moved_entity, this, index);
+        }
+        callDestructor(last_index);
+    }
+
+    // every chunk from the first hole to the old end has changed
+    const auto world_version = worldVersion();
+    for (auto chunk = versionStorage().chunkAt(indices.back()); chunk <= last_chunk; ++chunk) {
+        setVersion(world_version, chunk);
+    }
+}
+
+void Archetype::removeAll() {
+    MUSTACHE_PROFILER_BLOCK_LVL_1(__FUNCTION__);
+    const uint32_t count = size();
+    if (count == 0u) {
+        return;
+    }
+    for (const auto& info : operation_helper_.destroy) {
+        for (uint32_t i = 0u; i < count; ++i) {
+            info.destructor(getData<FunctionSafety::kUnsafe>(info.component_index, ArchetypeEntityIndex::make(i)));
+        }
+    }
+    const auto world_version = worldVersion();
+    const auto last_chunk = lastChunkIndex();
+    for (auto chunk = ChunkIndex::make(0); chunk <= last_chunk; ++chunk) {
+        setVersion(world_version, chunk);
+    }
+    entities_.clear();
+    disabled_.clear();
+    data_storage_.decrSize(count);
 }
 
 WorldVersion Archetype::worldVersion() const noexcept {
@@ -306,5 +547,6 @@ void Archetype::clear() {
     }
 
     entities_.clear();
+    disabled_.clear();
     data_storage_.clear(false);
 }
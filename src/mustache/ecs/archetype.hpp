@@ -7,6 +7,7 @@
 #include <mustache/ecs/id_deff.hpp>
 #include <mustache/ecs/entity_group.hpp>
 #include <mustache/ecs/job_arg_parcer.hpp>
+#include <mustache/ecs/disabled_entity_mask.hpp>
 #include <mustache/ecs/component_factory.hpp>
 #include <mustache/ecs/component_version_storage.hpp>
 #include <mustache/ecs/archetype_operation_helper.hpp>
@@ -14,6 +15,7 @@
 #include <mustache/ecs/default_component_data_storage.hpp>
 #include <mustache/ecs/stable_latency_component_data_storage.hpp>
 
+#include <algorithm>
 #include <cstdint>
 
 namespace mustache {
@@ -36,9 +38,11 @@ namespace mustache {
     class MUSTACHE_EXPORT Archetype : public Uncopiable {
     public:
         Archetype(World& world, ArchetypeIndex id, const ComponentIdMask& mask,
-                  const SharedComponentsInfo& shared_components_info, uint32_t chunk_size);
+                  const SharedComponentsInfo& shared_components_info, uint32_t chunk_size,
+                  const ComponentIdMask& cold_mask = ComponentIdMask::null());
         ~Archetype();
 
+        /// Creates count entities of this archetype at once, see EntityManager::createGroup
         [[nodiscard]] EntityGroup createGroup(size_t count);
 
         [[nodiscard]] uint32_t size() const noexcept {
@@ -47,6 +51,24 @@ namespace mustache {
 
         [[nodiscard]] uint32_t capacity() const noexcept;
 
+        // bytes of component buffers
+        [[nodiscard]] size_t allocatedSize() const noexcept {
+            return data_storage_.allocatedSize();
+        }
+
+        /// Releases memory of an empty archetype, shrinks a mostly empty one moving at most budget entities.
+        /// Returns the number of moved entities, see StableLatencyComponentDataStorage::compact
+        uint32_t compact(uint32_t budget);
+
+        [[nodiscard]] bool isCompacted() const noexcept {
+            return data_storage_.isCompacted();
+        }
+
+        // pages backing component data, may differ from World::storagePagePolicy (small storage, no huge pages)
+        [[nodiscard]] PageType storagePageType() const noexcept {
+            return data_storage_.pageType();
+        }
+
         [[nodiscard]] ArchetypeIndex id() const noexcept;
 
         [[nodiscard]] uint32_t chunkCount() const noexcept;
@@ -54,6 +76,9 @@ namespace mustache {
         [[nodiscard]] ChunkCapacity chunkCapacity() const noexcept;
 
         [[nodiscard]] bool isMatch(const ComponentIdMask& mask) const noexcept;
+        // has all components of mask, none of exclude and at least one of any (if any is not empty)
+        [[nodiscard]] bool isMatch(const ComponentIdMask& mask, const ComponentIdMask& exclude,
+                                   const ComponentIdMask& any) const noexcept;
 
         [[nodiscard]] bool isMatch(const SharedComponentIdMask& mask) const noexcept;
 
@@ -61,11 +86,54 @@ namespace mustache {
 
         [[nodiscard]] bool hasComponent(SharedComponentId component_id) const noexcept;
 
+        // column is kept apart from hot columns, see IsColdComponent
+        [[nodiscard]] bool isComponentCold(ComponentId id) const noexcept {
+            const auto index = getComponentIndex(id);
+            return index.isValid() && data_storage_.isCold(index);
+        }
+
+        // disabled entities keep their place and components but are skipped by jobs, see EntityManager::setEnabled
+        [[nodiscard]] bool isEnabled(ArchetypeEntityIndex index) const noexcept {
+            return !disabled_.test(index);
+        }
+
+        // single atomic bit write, may be called while the archetype is iterated
+        bool setEnabled(ArchetypeEntityIndex index, bool enabled) noexcept {
+            return disabled_.set(index, !enabled);
+        }
+
+        [[nodiscard]] uint32_t disabledCount() const noexcept {
+            return disabled_.count();
+        }
+
+        [[nodiscard]] uint32_t enabledCount() const noexcept {
+            return size() - disabled_.count();
+        }
+
+        // at least one entity of the version chunk is enabled
+        [[nodiscard]] bool hasEnabledEntities(ChunkIndex chunk, uint32_t chunk_size) const noexcept {
+            const uint32_t first = chunk.toInt() * chunk_size;
+            const uint32_t end = first + std::min(chunk_size, size() - first);
+            return disabled_.find(first, end, false) < end;
+        }
+
+        // calls func(first, count) for every run of enabled entities in [first, first + count)
+        template<typename _F>
+        MUSTACHE_INLINE void forEachEnabledRun(ArchetypeEntityIndex first, uint32_t count, _F&& func) const {
+            disabled_.forEachEnabledRun(first.toInt(), count, [&func](uint32_t begin, uint32_t run) {
+                func(ArchetypeEntityIndex::make(begin), run);
+            });
+        }
+
         [[nodiscard]] bool versionControlEnabled(ComponentIndex component_index) const noexcept {
             return version_storage_.enabledMask().has(component_index);
         }
         WorldVersion worldVersion() const noexcept;
 
+        [[nodiscard]] World& world() const noexcept {
+            return world_;
+        }
+
         template<FunctionSafety _Safety = FunctionSafety::kSafe>
         [[nodiscard]] ComponentIndex getComponentIndex(ComponentId id) const noexcept {
             return operation_helper_.componentIndex<_Safety>(id);
@@ -142,6 +210,10 @@ namespace mustache {
             return version_storage_.checkAndSet(check, set);
         }
 
+        [[nodiscard]] bool checkGroup(const MaskAndVersion& check, ChunkIndex first_chunk) const noexcept {
+            return version_storage_.checkGroup(check, first_chunk);
+        }
+
         void setVersion(WorldVersion world_version, ChunkIndex chunk_index, ComponentIndex component_index) noexcept {
             version_storage_.setVersion(world_version, chunk_index, component_index);
         }
@@ -199,9 +271,22 @@ namespace mustache {
         /// Entity must belong to default(empty) archetype
         ArchetypeEntityIndex insert(Entity entity, const ComponentIdMask& skip_constructor = ComponentIdMask::null());
 
+        /// Entities must belong to default(empty) archetype, storage grows once for the whole group
+        void insert(const EntityGroup& group);
+
+        /// appends count entities without initialization, returns index of the first one
+        ArchetypeEntityIndex emplaceBack(uint32_t count);
+        /// initializes entity at index returned by emplaceBack, different indices may be initialized in parallel
+        void initEntity(Entity entity, ArchetypeEntityIndex index, const ComponentIdMask& skip_constructor);
+        void constructComponents(Entity entity, ArchetypeEntityIndex index, const ComponentIdMask& skip_constructor);
+        /// afterAssign hooks or constructors taking World& may touch the world, such entities are never initialized in parallel
+        [[nodiscard]] bool hasWorldInit() const noexcept;
+
         // Move from prev to this archetype
         void externalMove(Entity entity, Archetype& prev, ArchetypeEntityIndex prev_index,
                           const ComponentIdMask& skip_constructor);
+        // Move all entities from prev to this archetype, prev becomes empty
+        void externalMoveAll(Archetype& prev, const ComponentIdMask& skip_constructor);
         void internalMove(ArchetypeEntityIndex from, ArchetypeEntityIndex to);
         /**
          * removes entity from archetype, calls destructor for each trivially destructible component
@@ -209,19 +294,51 @@ namespace mustache {
          * returns new entity at index.
          */
         void remove(Entity entity, ArchetypeEntityIndex index, const ComponentIdMask& skip_on_remove_call);
+        /**
+         * removes entities at indices (unique, sorted in descending order) in one pass, beforeRemove is not called.
+         * every hole is filled by the current last entity, which is never removed because of the order.
+         */
+        void removeGroup(const mustache::vector<ArchetypeEntityIndex>& indices);
+        /// destroys all entities, beforeRemove is not called, storage keeps its capacity
+        void removeAll();
+        [[nodiscard]] bool hasBeforeRemoveHooks() const noexcept {
+            return !operation_helper_.before_remove_functions.empty();
+        }
         void callDestructor(ArchetypeEntityIndex index);
         void callOnRemove(ArchetypeEntityIndex index, const ComponentIdMask& components_to_be_removed);
 
         void cloneEntity(Entity source, Entity dest, ArchetypeEntityIndex index, CloneEntityMap& map);
 
+        // archetype with one component added / removed, filled by EntityManager on first transition
+        using TransitionEdges = ArrayWrapper<Archetype*, ComponentId, false>;
+
+        [[nodiscard]] static Archetype* findEdge(const TransitionEdges& edges, ComponentId id) noexcept {
+            return id.toInt() < edges.size() ? edges[id] : nullptr;
+        }
+
+        static void setEdge(TransitionEdges& edges, ComponentId id, Archetype* archetype) {
+            if (id.toInt() >= edges.size()) {
+                edges.resize(id.next().toInt(), nullptr);
+            }
+            edges[id] = archetype;
+        }
+
+        void clearEdges() noexcept {
+            add_edges_.clear();
+            remove_edges_.clear();
+        }
+
         StableLatencyComponentDataStorage data_storage_;
 //        std::unique_ptr<StableLatencyComponentDataStorage> data_storage_;
         ArrayWrapper<Entity, ArchetypeEntityIndex, true> entities_;
+        DisabledEntityMask disabled_;
         ArchetypeOperationHelper operation_helper_;
         World& world_;
         const ComponentIdMask mask_;
         const SharedComponentsInfo shared_components_info_;
         VersionStorage version_storage_;
+        TransitionEdges add_edges_;
+        TransitionEdges remove_edges_;
         const ArchetypeIndex id_;
     };
 
@@ -34,6 +34,7 @@ ArchetypeOperationHelper::ArchetypeOperationHelper(MemoryManager& memory_manager
         component_id_to_component_index[component_id] = component_index;
         const auto& info = ComponentFactory::instance().componentInfo(component_id);
 
+        has_world_init = has_world_init || info.world_constructor || static_cast<bool>(info.functions.after_assign);
         if (info.functions.create || info.functions.after_assign) {
             insert.push_back(InsertInfo {
                     info.functions.create,
@@ -54,8 +55,9 @@ ArchetypeOperationHelper::ArchetypeOperationHelper(MemoryManager& memory_manager
             });
         }
         if (info.functions.move) {
+            // null move function means memcpy
             internal_move.push_back(InternalMoveInfo {
-                    info.functions.move,
+                    info.trivially_relocatable ? ComponentInfo::MoveFunction{} : info.functions.move,
                     info.size
             });
         }
@@ -64,7 +66,9 @@ ArchetypeOperationHelper::ArchetypeOperationHelper(MemoryManager& memory_manager
         }
         ExternalMoveInfo& external_move_info = external_move.emplace_back();
         external_move_info.constructor_ptr = info.functions.create;
-        external_move_info.move_ptr = info.functions.move_constructor;
+        if (!info.trivially_relocatable) {
+            external_move_info.move_ptr = info.functions.move_constructor;
+        }
         external_move_info.id = component_id;
         external_move_info.size = info.size;
         external_move_info.default_data = info.default_value.empty() ? nullptr : info.default_value.data();
@@ -123,5 +123,7 @@ namespace mustache {
         ArrayWrapper<InternalMoveInfo, ComponentIndex, true> internal_move; // move or copy function
         ArrayWrapper<CloneInfo, ComponentIndex, true> clone; // clone or copy functions
         mustache::vector<AfterCloneInfo, Allocator<AfterCloneInfo> > after_clone;
+        // some component has afterAssign hook or constructor taking World&
+        bool has_world_init = false;
     };
 }
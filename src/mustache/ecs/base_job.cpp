@@ -5,6 +5,9 @@
 #include <mustache/ecs/world.hpp>
 #include <mustache/ecs/world_filter.hpp>
 
+#include <algorithm>
+#include <atomic>
+
 using namespace mustache;
 
 namespace {
@@ -19,10 +22,22 @@ namespace {
         bool is_prev_match = false;
         WorldFilterResult::EntityBlock block{ArchetypeEntityIndex::make(0), ArchetypeEntityIndex::make(0)};
         const auto chunk_size = archetype.chunkCapacity().toInt();
+        const bool has_disabled = archetype.disabledCount() > 0u;
 
-        // TODO: make 2-3 levels of component version (for group of 1024, 32, 1) and let VersionStorage return filtered range
+        constexpr uint32_t chunks_per_group = VersionStorage::kChunksPerGroup;
         for (auto chunk_index = ChunkIndex::make(0); chunk_index <= last_index; ++chunk_index) {
+            // the whole group of chunks can be skipped if none of its versions passes the check
+            if (chunk_index.toInt() % chunks_per_group == 0u && !archetype.checkGroup(check, chunk_index)) {
+                if (is_prev_match) {
+                    item.addBlock(block);
+                }
+                is_prev_match = false;
+                chunk_index = ChunkIndex::make(chunk_index.toInt() + chunks_per_group - 1u);
+                continue;
+            }
+            // chunks of disabled entities only are skipped and keep their versions
             const bool is_match =
+                    (!has_disabled || archetype.hasEnabledEntities(chunk_index, chunk_size)) &&
                     job.extraChunkFilterCheck(archetype, chunk_index) &&
                     archetype.checkAndSet(check, set, chunk_index);
 
@@ -49,30 +64,50 @@ namespace {
         }
     }
 
+    void updateQueryCache(EntityManager& entities, const WorldFilterResult& result, ArchetypeQueryCache& cache) {
+        MUSTACHE_PROFILER_BLOCK_LVL_1(__FUNCTION__ );
+        if (cache.archetypes_epoch != entities.archetypesEpoch() || cache.mask != result.mask ||
+            cache.exclude_mask != result.exclude_mask || cache.any_mask != result.any_mask ||
+            cache.shared_component_mask != result.shared_component_mask) {
+            cache.reset();
+            cache.archetypes_epoch = entities.archetypesEpoch();
+            cache.mask = result.mask;
+            cache.exclude_mask = result.exclude_mask;
+            cache.any_mask = result.any_mask;
+            cache.shared_component_mask = result.shared_component_mask;
+        }
+        const auto num_archetypes = static_cast<uint32_t>(entities.getArchetypesCount());
+        for (auto index = ArchetypeIndex::make(cache.archetypes_checked); index < ArchetypeIndex::make(num_archetypes); ++index) {
+            const auto& arch = entities.getArchetype(index);
+            if (arch.isMatch(result.mask, result.exclude_mask, result.any_mask) &&
+                arch.isMatch(result.shared_component_mask)) {
+                cache.matching.push_back(index);
+            }
+        }
+        cache.archetypes_checked = num_archetypes;
+    }
+
     bool apply(World& world, const FilterCheckParam& check, const FilterSetParam& set,
-               WorldFilterResult& result, BaseJob& job) {
+               WorldFilterResult& result, ArchetypeQueryCache& cache, BaseJob& job) {
         MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
 
         auto& entities = world.entities();
-        const auto num_archetypes = entities.getArchetypesCount();
-        result.filtered_archetypes.reserve(num_archetypes);
+        updateQueryCache(entities, result, cache);
+        result.filtered_archetypes.reserve(cache.matching.size());
 
         ArchetypeFilterParam archetype_check;
         archetype_check.version = check.version;
-        for (ArchetypeIndex index = ArchetypeIndex::make(0); index < ArchetypeIndex::make(num_archetypes); ++index) {
+        for (const auto& index : cache.matching) {
             auto& arch = entities.getArchetype(index);
 
-            const bool is_archetype_match =
-                    arch.size() > 0u &&
-                    arch.isMatch(result.mask) &&
-                    arch.isMatch(result.shared_component_mask) &&
-                    job.extraArchetypeFilterCheck(arch);
+            const bool is_archetype_match = arch.enabledCount() > 0u && job.extraArchetypeFilterCheck(arch);
 
             if (is_archetype_match) {
                 archetype_check.mask = arch.makeComponentVersionControlEnabledMask(check.mask).items();
                 ArchetypeFilterParam archetype_set;
                 archetype_set.version = set.version;
-                archetype_set.mask = arch.makeComponentVersionControlEnabledMask(set.mask).items();
+                archetype_set.mask = arch.makeComponentVersionControlEnabledMask(
+                        job.archetypeUpdateMask(arch, set.mask)).items();
                 if (arch.checkAndSet(archetype_check, archetype_set)) {
                     filterArchetype(arch, archetype_check, archetype_set, result, job);
                 }
@@ -88,6 +123,38 @@ TasksCount BaseJob::taskCount(World& world, uint32_t entity_count) const noexcep
     return TasksCount::make(std::min(entity_count, world.dispatcher().threadCount() + 1));
 }
 
+TasksCount BaseJob::taskCountForMode(World& world, uint32_t entity_count, JobRunMode mode) const noexcept {
+    TasksCount task_count = TasksCount::make(1);
+    if (mode == JobRunMode::kParallel) {
+        task_count = std::max(TasksCount::make(1u), taskCount(world, entity_count));
+    }
+    return task_count;
+}
+
+void BaseJob::runFiltered(World& world, TasksCount task_count, JobRunMode mode) {
+    beginReductions(task_count);
+    if (mode == JobRunMode::kCurrentThread) {
+        runCurrentThread(world);
+    } else {
+        runParallel(world, task_count);
+    }
+    endReductions();
+}
+
+void BaseJob::beginReductions(TasksCount task_count) {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+    for (auto reduction : reductions_) {
+        reduction->begin(task_count);
+    }
+}
+
+void BaseJob::endReductions() {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+    for (auto reduction : reductions_) {
+        reduction->end();
+    }
+}
+
 void BaseJob::run(World& world, JobRunMode mode) {
     MUSTACHE_PROFILER_BLOCK_LVL_0(nameCStr());
     const auto entities_count = applyFilter(world);
@@ -95,33 +162,41 @@ void BaseJob::run(World& world, JobRunMode mode) {
         return;
     }
 
-    TasksCount task_count = TasksCount::make(1);
-    if (mode == JobRunMode::kParallel) {
-        task_count = std::max(TasksCount::make(1u), taskCount(world, entities_count));
-    }
+    const auto task_count = taskCountForMode(world, entities_count, mode);
 
     if (task_count.toInt() > 0u) {
         world.incrementVersion();
 
         onJobBegin(world, task_count, JobSize::make(entities_count), mode);
         world.entities().lock();
-        if (mode == JobRunMode::kCurrentThread) {
-            runCurrentThread(world);
-        } else {
-            runParallel(world, task_count);
-        }
+        runFiltered(world, task_count, mode);
         world.entities().unlock();
         onJobEnd(world, task_count, JobSize::make(entities_count), mode);
     }
 }
 
+void BaseJob::runScheduled(World& world, WorldVersion version, JobRunMode mode) {
+    MUSTACHE_PROFILER_BLOCK_LVL_0(nameCStr());
+    scheduled_version_ = version;
+    const auto entities_count = applyFilter(world);
+    scheduled_version_ = WorldVersion::null();
+    if (entities_count < 1u) {
+        return;
+    }
+
+    const auto task_count = taskCountForMode(world, entities_count, mode);
+    onJobBegin(world, task_count, JobSize::make(entities_count), mode);
+    runFiltered(world, task_count, mode);
+    onJobEnd(world, task_count, JobSize::make(entities_count), mode);
+}
+
 uint32_t BaseJob::applyFilter(World& world) noexcept {
     // TODO: make this fast for small jobs
     MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
 
     filter_result_.clear();
 
-    const auto cur_world_version = world.version();
+    const auto cur_world_version = scheduled_version_.isNull() ? world.version() : scheduled_version_;
     const FilterCheckParam check {
             checkMask(),
             last_update_version_
@@ -131,13 +206,18 @@ uint32_t BaseJob::applyFilter(World& world) noexcept {
             cur_world_version
     };
 
-    if (apply(world, check, set, filter_result_, *this)) {
+    if (apply(world, check, set, filter_result_, query_cache_, *this)) {
         last_update_version_ = cur_world_version;
     }
 
     return filter_result_.total_entity_count;
 }
 
+bool BaseJob::isArchetypeMatch(const Archetype& archetype) const noexcept {
+    return archetype.isMatch(filter_result_.mask, filter_result_.exclude_mask, filter_result_.any_mask) &&
+           archetype.isMatch(filter_result_.shared_component_mask) && extraArchetypeFilterCheck(archetype);
+}
+
 void BaseJob::onJobBegin(World&, TasksCount, JobSize, JobRunMode) noexcept {
 
 }
@@ -156,15 +236,20 @@ void BaseJob::onTaskEnd(World&, TaskSize, ParallelTaskId) noexcept {
 
 void BaseJob::runParallel(World& world, TasksCount task_count) {
     MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
+    if (schedule_ != JobSchedule::kStatic) {
+        runParallelDynamic(world, task_count);
+        return;
+    }
 
     auto& dispatcher = world.dispatcher();
+    auto batch = dispatcher.createBatch();
     JobInvocationIndex invocation_index;
     invocation_index.entity_index = ParallelTaskGlobalItemIndex::make(0);
     invocation_index.entity_index_in_task = ParallelTaskItemIndexInTask::make(0);
     invocation_index.task_index = ParallelTaskId::make(0);
 
     for (ArchetypeGroup task : TaskGroup::make(filter_result_, task_count)) {
-        dispatcher.addParallelTask([task, this, invocation_index, &world](ThreadId thread_id) mutable {
+        dispatcher.addParallelTask(batch, [task, this, invocation_index, &world](ThreadId thread_id) mutable {
             invocation_index.thread_id = thread_id;
             const auto task_size = TaskSize::make(task.taskSize());
             {
@@ -181,7 +266,7 @@ void BaseJob::runParallel(World& world, TasksCount task_count) {
         ++invocation_index.task_index;
         invocation_index.entity_index = ParallelTaskGlobalItemIndex::make(invocation_index.entity_index.toInt() + task.taskSize());
     }
-    dispatcher.waitForParallelFinish();
+    batch.wait();
 }
 
 void BaseJob::runCurrentThread(World& world) {
@@ -209,3 +294,79 @@ void BaseJob::runCurrentThread(World& world) {
         ++invocation_index.task_index;
     }
 }
+
+void BaseJob::runParallelDynamic(World& world, TasksCount task_count) {
+    MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
+
+    // entities of filtered archetypes are addressed by one offset in [0, total_entity_count)
+    const auto& archetypes = filter_result_.filtered_archetypes;
+    mustache::vector<uint32_t> archetype_end;
+    archetype_end.reserve(archetypes.size());
+    uint32_t offset = 0u;
+    for (const auto& info : archetypes) {
+        offset += info.entities_count;
+        archetype_end.push_back(offset);
+    }
+    const uint32_t total = filter_result_.total_entity_count;
+    const uint32_t min_range_size = 32u;
+    const uint32_t max_chunk_range_size = 1024u; // archetypes without version control report unlimited chunk
+    const auto schedule = schedule_;
+    std::atomic<uint32_t> cursor{0u};
+
+    // returns false when there is nothing left, ranges never cross archetype bounds
+    const auto take_range = [&](TaskInfo& info, uint32_t& first_entity_offset) noexcept {
+        uint32_t begin = cursor.load(std::memory_order_relaxed);
+        uint32_t end = 0u;
+        size_t archetype = 0u;
+        do {
+            if (begin >= total) {
+                return false;
+            }
+            archetype = static_cast<size_t>(std::upper_bound(archetype_end.begin(), archetype_end.end(), begin) -
+                                             archetype_end.begin());
+            uint32_t range_size = std::min(archetypes[archetype].archetype->chunkCapacity().toInt(),
+                                           max_chunk_range_size);
+            if (schedule == JobSchedule::kGuided) {
+                range_size = std::max(range_size, (total - begin) / (2u * task_count.toInt()));
+            }
+            range_size = std::min(std::max(range_size, min_range_size), archetype_end[archetype] - begin);
+            end = begin + range_size;
+        } while (!cursor.compare_exchange_weak(begin, end, std::memory_order_relaxed));
+
+        const uint32_t archetype_begin = archetype_end[archetype] - archetypes[archetype].entities_count;
+        info.size = end - begin;
+        info.first_archetype = TaskArchetypeIndex::make(archetype);
+        info.first_entity = ArchetypeEntityIndex::make(begin - archetype_begin);
+        first_entity_offset = begin;
+        return true;
+    };
+
+    auto& dispatcher = world.dispatcher();
+    auto batch = dispatcher.createBatch();
+    for (uint32_t task = 0; task < task_count.toInt(); ++task) {
+        const auto task_id = ParallelTaskId::make(task);
+        dispatcher.addParallelTask(batch, [this, task_id, &take_range, &world](ThreadId thread_id) {
+            TaskInfo info{0u, task_id};
+            uint32_t first_entity_offset = 0u;
+            uint32_t processed = 0u;
+            JobInvocationIndex invocation_index;
+            invocation_index.thread_id = thread_id;
+            invocation_index.task_index = task_id;
+            {
+                // the task size is unknown until the cursor is exhausted
+                MUSTACHE_PROFILER_BLOCK_LVL_0("onTaskBegin");
+                onTaskBegin(world, TaskSize::make(0u), task_id);
+            }
+            while (take_range(info, first_entity_offset)) {
+                invocation_index.entity_index_in_task = ParallelTaskItemIndexInTask::make(processed);
+                invocation_index.entity_index = ParallelTaskGlobalItemIndex::make(first_entity_offset);
+                MUSTACHE_PROFILER_BLOCK_LVL_0("singleTask");
+                singleTask(world, ArchetypeGroup{info, filter_result_}, invocation_index);
+                processed += info.size;
+            }
+            MUSTACHE_PROFILER_BLOCK_LVL_0("onTaskEnd");
+            onTaskEnd(world, TaskSize::make(processed), task_id);
+        });
+    }
+    batch.wait();
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <mustache/utils/dispatch.hpp>
+#include <mustache/utils/container_vector.hpp>
 
 #include <mustache/ecs/task_view.hpp>
 #include <mustache/ecs/world_filter.hpp>
@@ -23,18 +24,59 @@ namespace mustache {
         kDefault = kCurrentThread,
     };
 
+    // how BaseJob::runParallel distributes entities between tasks
+    // onTaskBegin and onTaskEnd are called once per task for every schedule, but kDynamic and kGuided tasks
+    // do not know their size in advance: onTaskBegin gets zero and onTaskEnd gets the count of processed entities
+    enum class JobSchedule : uint32_t {
+        kStatic = 0u, // every task gets an equal part of entities before the job starts
+        kDynamic = 1u, // tasks take chunk sized ranges from a shared cursor until all entities are processed
+        kGuided = 2u, // like kDynamic, but range size decreases with the remaining entity count
+        kDefault = kStatic,
+    };
+
+    // accumulator registered in a job, see JobReduction
+    class MUSTACHE_EXPORT JobReductionBase {
+    public:
+        JobReductionBase() = default;
+        JobReductionBase(const JobReductionBase&) = delete;
+        JobReductionBase(JobReductionBase&&) = delete;
+        JobReductionBase& operator=(const JobReductionBase&) = delete;
+        JobReductionBase& operator=(JobReductionBase&&) = delete;
+        virtual ~JobReductionBase() = default;
+
+        // called before the first task with the number of tasks the job is split into
+        virtual void begin(TasksCount task_count) = 0;
+        // called after the last task is finished
+        virtual void end() = 0;
+    };
+
     class MUSTACHE_EXPORT BaseJob {
     public:
         virtual ~BaseJob() = default;
 
         void run(World& world, JobRunMode mode = JobRunMode::kDefault);
 
+        // same as run, but the EntityManager lock is managed by the caller (see JobScheduler),
+        // components are filtered and stamped with the given version instead of the world one
+        void runScheduled(World& world, WorldVersion version, JobRunMode mode = JobRunMode::kDefault);
+
         virtual void runParallel(World&, TasksCount num_tasks);
+        void runParallelDynamic(World&, TasksCount num_tasks);
         virtual void runCurrentThread(World&);
         virtual void singleTask(World& world, ArchetypeGroup archetype_group,
                                         JobInvocationIndex invocation_index) = 0;
         virtual ComponentIdMask checkMask() const noexcept = 0;
         virtual ComponentIdMask updateMask() const noexcept = 0;
+        // components the job reads / writes, jobs without declared access conflict with any other job
+        [[nodiscard]] virtual bool isComponentAccessDeclared() const noexcept {
+            return false;
+        }
+        [[nodiscard]] virtual ComponentIdMask readMask() const noexcept {
+            return ComponentIdMask::null();
+        }
+        [[nodiscard]] virtual ComponentIdMask writeMask() const noexcept {
+            return updateMask();
+        }
         [[nodiscard]] virtual std::string name() const noexcept {
             return nameCStr();
         }
@@ -46,6 +88,13 @@ namespace mustache {
         [[nodiscard]] virtual bool extraChunkFilterCheck(const Archetype&, ChunkIndex) const noexcept {
             return true;
         }
+        // components whose version is updated for entities of the archetype, update_mask is the result of updateMask()
+        [[nodiscard]] virtual ComponentIdMask archetypeUpdateMask(const Archetype&,
+                                                                  const ComponentIdMask& update_mask) const noexcept {
+            return update_mask;
+        }
+        // archetype passes the job masks and extraArchetypeFilterCheck
+        [[nodiscard]] bool isArchetypeMatch(const Archetype& archetype) const noexcept;
 
         virtual uint32_t applyFilter(World&) noexcept;
         [[nodiscard]] virtual TasksCount taskCount(World&, uint32_t entity_count) const noexcept;
@@ -55,8 +104,30 @@ namespace mustache {
         virtual void onJobBegin(World&, TasksCount, JobSize total_entity_count, JobRunMode mode) noexcept;
         virtual void onJobEnd(World&, TasksCount, JobSize total_entity_count, JobRunMode mode) noexcept;
 
+        [[nodiscard]] JobSchedule schedule() const noexcept {
+            return schedule_;
+        }
+        void setSchedule(JobSchedule schedule) noexcept {
+            schedule_ = schedule;
+        }
+
+        // reduction must live as long as the job, usually it is a member of the job
+        void registerReduction(JobReductionBase& reduction) {
+            reductions_.push_back(&reduction);
+        }
+
     protected:
+        [[nodiscard]] TasksCount taskCountForMode(World& world, uint32_t entity_count, JobRunMode mode) const noexcept;
+        void runFiltered(World& world, TasksCount task_count, JobRunMode mode);
+        void beginReductions(TasksCount task_count);
+        void endReductions();
+
         WorldVersion last_update_version_;
+        // set by runScheduled, the world version is used if null
+        WorldVersion scheduled_version_ = WorldVersion::null();
         WorldFilterResult filter_result_;
+        ArchetypeQueryCache query_cache_;
+        JobSchedule schedule_ = JobSchedule::kDefault;
+        mustache::vector<JobReductionBase*> reductions_;
     };
 }
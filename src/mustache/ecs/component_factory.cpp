@@ -36,15 +36,6 @@ namespace {
                 if (!missed.empty()) {missed += "\n";}
                 missed += info.name + "(" + info.name+ "&&) // move constructor";
             }
-            if (!functions.move_constructor_and_destroy) {
-                functions.move_constructor_and_destroy = [move = functions.move,
-                                                          destroy = functions.destroy] (void* dest, void* src) {
-                    move(dest, src);
-                    if (destroy) {
-                        destroy(src);
-                    }
-                };
-            }
 
             if (!missed.empty()) {
                 str += missed;
@@ -135,6 +126,17 @@ void ComponentFactory::destroyComponents(World& world, Entity entity,
     applyFunction(data, info.functions.destroy, count, info.size, world, entity);
 }
 
+ComponentIdMask ComponentFactory::withoutTags(const ComponentIdMask& mask) const {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
+    ComponentIdMask result = mask;
+    mask.forEachItem([&result, this](ComponentId id) {
+        if (componentInfo(id).tag) {
+            result.set(id, false);
+        }
+    });
+    return result;
+}
+
 ComponentId ComponentFactory::nextComponentId() const noexcept {
     MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
     return component_id_storage.next_component_id;
@@ -40,11 +40,23 @@ namespace mustache {
             return result;
         }
 
+        // sparse components are not stored in archetypes, so they are not added to archetype masks
         template<typename _C>
         void applyToMask(ComponentIdMask& mask) const noexcept {
             if constexpr (!isComponentShared<_C>()) {
                 using Component = typename ComponentType<_C>::type;
-                if constexpr (IsComponentRequired<_C>::value) {
+                if constexpr (IsComponentRequired<_C>::value && !IsSparseComponent<Component>::value) {
+                    static const auto id = registerComponent<Component>();
+                    mask.set(id, true);
+                }
+            }
+        }
+
+        template<typename _C>
+        void applyToSparseMask(ComponentIdMask& mask) const noexcept {
+            if constexpr (!isComponentShared<_C>()) {
+                using Component = typename ComponentType<_C>::type;
+                if constexpr (IsSparseComponent<Component>::value) {
                     static const auto id = registerComponent<Component>();
                     mask.set(id, true);
                 }
@@ -93,6 +105,14 @@ namespace mustache {
             return mask;
         }
 
+        // required and optional sparse components
+        template <typename... _C>
+        [[nodiscard]] ComponentIdMask makeSparseMask() const noexcept {
+            ComponentIdMask mask;
+            (applyToSparseMask<_C>(mask), ...);
+            return mask;
+        }
+
         void initComponents(World&, Entity entity, const ComponentInfo& info, void* data, size_t count) const;
         void destroyComponents(World&, Entity entity, const ComponentInfo& info, void* data, size_t count) const;
         void moveComponent(World&, Entity entity, const ComponentInfo& info, void* source, void* dest) const;
@@ -129,6 +149,9 @@ namespace mustache {
             copyComponent(world, entity, componentInfo(id), source, dest);
         }
 
+        // components of mask that have data, see isTagComponent
+        [[nodiscard]] ComponentIdMask withoutTags(const ComponentIdMask& mask) const;
+
         [[nodiscard]] ComponentId nextComponentId() const noexcept;
 
         [[nodiscard]] const ComponentInfo& componentInfo(ComponentId id) const;
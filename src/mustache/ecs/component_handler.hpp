@@ -129,6 +129,34 @@ namespace mustache {
     template<typename T>
     using SharedComponent = ComponentHandler<T, true>;
 
+    // job argument of a tag component, tags have no column so every entity gets the same instance
+    template<typename T, bool _IsRequired>
+    class TagComponentHandler {
+    public:
+        explicit TagComponentHandler(T* instance) noexcept:
+                instance_{instance} {
+        }
+
+        decltype(auto) operator[](size_t) const noexcept {
+            if constexpr(_IsRequired) {
+                return *instance_;
+            } else {
+                return ComponentHandler<T, false>{instance_};
+            }
+        }
+
+        TagComponentHandler operator+=(size_t) noexcept {
+            return *this;
+        }
+
+        TagComponentHandler operator++(int) noexcept {
+            return *this;
+        }
+
+    private:
+        T* instance_;
+    };
+
     template<typename T>
     struct IsComponentMutable {
         constexpr static bool value = false;
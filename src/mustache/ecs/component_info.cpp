@@ -1,8 +1,14 @@
 #include <mustache/ecs/component_info.hpp>
 #include <stdexcept>
+#include <cstddef>
 
 using namespace mustache;
 
+void* ComponentInfo::tagData() noexcept {
+    alignas(std::max_align_t) static std::byte data[alignof(std::max_align_t)] {};
+    return data;
+}
+
 void ComponentInfo::error(const char* msg) {
     throw std::runtime_error(msg);
 }
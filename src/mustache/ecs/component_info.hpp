@@ -1,15 +1,16 @@
 #pragma once
 
 #include <mustache/utils/dll_export.h>
+#include <mustache/utils/default_settings.hpp>
 #include <mustache/utils/type_info.hpp>
 #include <mustache/utils/index_like.hpp>
 #include <mustache/utils/container_map.hpp>
 #include <mustache/utils/container_vector.hpp>
 
-#include <functional>
 #include <string>
 #include <cstddef>
 #include <memory>
+#include <utility>
 
 namespace mustache {
     namespace detail {
@@ -63,12 +64,96 @@ namespace mustache {
     }
 
 
+    /**
+     * Components which can be moved by memcpy, archetypes and storages move them without calling move functions.
+     * Specialize for types with user-defined copy or move functions if a bitwise copy is a valid move,
+     * such types must be trivially destructible.
+     */
+    template<typename T>
+    struct IsTriviallyRelocatable : std::bool_constant<std::is_trivially_copyable_v<T> > {};
+
+    /**
+     * Components stored in a paged sparse set indexed by EntityId instead of archetypes.
+     * Assign and remove do not move the other components of the entity, use it for rarely present
+     * or frequently toggled components (markers like Selected or Stunned).
+     * Specialize as std::true_type to enable.
+     */
+    template<typename T>
+    struct IsSparseComponent : std::false_type {};
+
+    /**
+     * Rarely accessed components (debug info, editor data, ...). Archetypes keep their columns in a separate
+     * heap allocation, so hot columns are packed together and cold data does not take huge pages.
+     * Specialize as std::true_type to enable, see also EntityManager::addColdComponentsFunction.
+     */
+    template<typename T>
+    struct IsColdComponent : std::false_type {};
+
+    /**
+     * Empty components without hooks. Archetypes keep them in the mask only: no column, no version slots
+     * and no construct / move / destroy calls, jobs get a reference to a shared instance (see ComponentInfo::tagData).
+     */
+    template<typename T>
+    constexpr bool isTagComponent() noexcept {
+        return std::is_empty_v<T> && std::is_trivially_default_constructible_v<T> &&
+               std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T> &&
+               !detail::hasBeforeRemove<T>(nullptr) && !detail::hasAfterAssign<T>(nullptr) &&
+               !detail::hasClone<T>(nullptr) && !detail::hasAfterClone<T>(nullptr);
+    }
+
     class World;
     struct CloneEntityMap;
     struct Entity;
 
     template<typename _Sign>
-    using Functor = std::function<_Sign>;
+    class ComponentFunction;
+
+    /**
+     * Nullable function pointer with an optional context, cheaper to copy and call than std::function.
+     * Functions with context get it as the first argument.
+     */
+    template<typename _Result, typename... _Args>
+    class ComponentFunction<_Result(_Args...)> {
+    public:
+        using Function = _Result (*)(_Args...);
+        using FunctionWithContext = _Result (*)(const void*, _Args...);
+
+        ComponentFunction() noexcept = default;
+        ComponentFunction(std::nullptr_t) noexcept {
+        }
+        ComponentFunction(Function function) noexcept:
+                function_{function} {
+        }
+        ComponentFunction(FunctionWithContext function, const void* context) noexcept:
+                function_with_context_{function},
+                context_{context} {
+        }
+
+        MUSTACHE_INLINE _Result operator()(_Args... args) const {
+            if (function_ != nullptr) {
+                return function_(std::forward<_Args>(args)...);
+            }
+            return function_with_context_(context_, std::forward<_Args>(args)...);
+        }
+
+        [[nodiscard]] MUSTACHE_INLINE explicit operator bool() const noexcept {
+            return function_ != nullptr || function_with_context_ != nullptr;
+        }
+        [[nodiscard]] MUSTACHE_INLINE bool operator==(std::nullptr_t) const noexcept {
+            return !static_cast<bool>(*this);
+        }
+        [[nodiscard]] MUSTACHE_INLINE bool operator!=(std::nullptr_t) const noexcept {
+            return static_cast<bool>(*this);
+        }
+
+    private:
+        Function function_ = nullptr;
+        FunctionWithContext function_with_context_ = nullptr;
+        const void* context_ = nullptr;
+    };
+
+    template<typename _Sign>
+    using Functor = ComponentFunction<_Sign>;
 
     template<typename T>
     struct CloneDest {
@@ -111,6 +196,20 @@ namespace mustache {
         } functions;
 
         mustache::vector<std::byte> default_value; // this array will be used to init component in case of empty constructor
+        bool trivially_relocatable{false}; // move functions may be replaced with memcpy
+        bool sparse{false}; // stored in SparseComponentStorage, not in archetypes
+        bool tag{false}; // has no data, archetypes do not store it
+        bool cold{false}; // stored apart from hot columns of archetypes
+        bool world_constructor{false}; // constructor takes World&, so it may change the world
+
+        template<typename T>
+        static constexpr bool isWorldConstructible() noexcept {
+            return std::is_constructible<T, World&, Entity>::value || std::is_constructible<T, Entity, World&>::value ||
+                   std::is_constructible<T, World&>::value;
+        }
+
+        // address of every tag component, tags have no data so one instance is shared
+        static void* tagData() noexcept;
 
         template<typename T>
         static void componentConstructor(void *ptr, [[maybe_unused]] const Entity& entity, [[maybe_unused]] World& world) {
@@ -265,6 +364,8 @@ namespace mustache {
 
         template <typename T>
         static ComponentInfo make() {
+            static_assert(!IsTriviallyRelocatable<T>::value || std::is_trivially_destructible_v<T>,
+                          "Trivially relocatable component must be trivially destructible");
             static ComponentInfo result {
                 sizeof(T),
                 alignof(T),
@@ -284,7 +385,12 @@ namespace mustache {
                         &clone<T>,
                         detail::hasAfterClone<T>(nullptr) ? &afterClone<T> : ComponentInfo::CloneFunction{},
 
-                }, {}
+                }, {},
+                IsTriviallyRelocatable<T>::value,
+                IsSparseComponent<T>::value,
+                isTagComponent<T>(),
+                IsColdComponent<T>::value,
+                isWorldConstructible<T>()
             };
             return result;
         }
@@ -18,6 +18,8 @@ namespace mustache {
 
     class VersionStorage : public Uncopiable {
     public:
+        // chunks are combined into groups, group version is the max version of its chunks
+        static constexpr uint32_t kChunksPerGroup = 32u;
 
         VersionStorage(MemoryManager& memory_manager,
                        uint32_t num_components,
@@ -25,6 +27,7 @@ namespace mustache {
                        const ComponentIndexMask& enabled_for):
                 chunk_size_{chunk_size},
                 chunk_versions_{memory_manager},
+                group_versions_{memory_manager},
                 global_versions_{memory_manager},
                 enabled_mask_{enabled_for} {
             MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__);
@@ -44,6 +47,10 @@ namespace mustache {
             if (chunk.template toInt<size_t>() * numComponents() <= chunk_versions_.size()) {
                 chunk_versions_.resize(chunk.next().template toInt<size_t>() * numComponents());
             }
+            const auto group = groupAt(chunk);
+            if (group * numComponents() <= group_versions_.size()) {
+                group_versions_.resize((group + 1u) * numComponents());
+            }
 
             setVersion(version, chunk);
         }
@@ -54,9 +61,11 @@ namespace mustache {
                 return;
             }
             const auto begin = numComponents() * chunk.toInt();
+            const auto group_begin = numComponents() * groupAt(chunk);
             for (uint32_t i = 0; i < numComponents(); ++i) {
                 global_versions_[ComponentIndex::make(i)] = version;
                 chunk_versions_[begin + i] = version;
+                updateGroupVersion(version, group_begin + i);
             }
         }
 
@@ -72,18 +81,13 @@ namespace mustache {
             }
             const auto update_index = numComponents() * chunk.toInt() + component.toInt();
             chunk_versions_[update_index] = version;
+            updateGroupVersion(version, numComponents() * groupAt(chunk) + component.toInt());
             setVersion(version, component);
         }
 
         void setVersion(WorldVersion version, ArchetypeEntityIndex index, ComponentIndex component) noexcept {
             MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
-            if (!enabled_mask_.has(component)) {
-                return;
-            }
-            const auto chunk = chunkAt(index);
-            const auto update_index = numComponents() * chunk.toInt() + component.toInt();
-            chunk_versions_[update_index] = version;
-            setVersion(version, component);
+            setVersion(version, chunkAt(index), component);
         }
 
         [[nodiscard]] WorldVersion getVersion(ComponentIndex component) const noexcept {
@@ -142,13 +146,38 @@ namespace mustache {
             }
 
             if (result) {
+                const auto group_begin = numComponents() * groupAt(chunk);
                 for (auto component_index : set.mask) {
                     versions[component_index.toInt()] = set.version;
+                    updateGroupVersion(set.version, group_begin + component_index.toInt());
                 }
             }
             return result;
         }
 
+        // returns false if no chunk of the group containing first_chunk can pass the check
+        [[nodiscard]] bool checkGroup(const MaskAndVersion& check, ChunkIndex first_chunk) const noexcept {
+            MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
+            if (!enabled() || check.version.isNull() || check.mask.empty()) {
+                return true;
+            }
+            const auto first_index = numComponents() * groupAt(first_chunk);
+            if (first_index >= group_versions_.size()) {
+                return true;
+            }
+            const auto versions = group_versions_.data() + first_index;
+            for (auto component_index : check.mask) {
+                if (versions[component_index.toInt()] > check.version) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        [[nodiscard]] static constexpr uint32_t groupAt(ChunkIndex chunk) noexcept {
+            return chunk.toInt() / kChunksPerGroup;
+        }
+
         [[nodiscard]] uint32_t numComponents() const noexcept {
             MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
             return static_cast<uint32_t >(global_versions_.size());
@@ -177,8 +206,17 @@ namespace mustache {
         }
     protected:
         friend class Archetype;
+
+        void updateGroupVersion(WorldVersion version, uint32_t index) noexcept {
+            auto& group_version = group_versions_[index];
+            if (group_version.isNull() || group_version < version) {
+                group_version = version;
+            }
+        }
+
         uint32_t chunk_size_;
         mustache::vector<WorldVersion, Allocator<WorldVersion> > chunk_versions_; // per chunk component version
+        mustache::vector<WorldVersion, Allocator<WorldVersion> > group_versions_; // max chunk version per group of chunks
         mustache::ArrayWrapper<WorldVersion, ComponentIndex, true> global_versions_; // global component version
         ComponentIndexMask enabled_mask_;
     };
@@ -217,6 +255,14 @@ namespace mustache {
             return true;
         }
 
+        [[nodiscard]] constexpr bool checkGroup(const MaskAndVersion&, ChunkIndex) const noexcept {
+            return true;
+        }
+
+        [[nodiscard]] static constexpr uint32_t groupAt(ChunkIndex) noexcept {
+            return 0u;
+        }
+
         [[nodiscard]] constexpr ChunkIndex chunkAt(ArchetypeEntityIndex) const noexcept {
             return ChunkIndex::make(0);
         }
@@ -0,0 +1,68 @@
+#include "disabled_entity_mask.hpp"
+
+#include <mustache/utils/profiler.hpp>
+
+#include <algorithm>
+
+using namespace mustache;
+
+void DisabledEntityMask::grow(uint32_t size) {
+    MUSTACHE_PROFILER_BLOCK_LVL_2(__FUNCTION__);
+    const uint32_t old_words = capacity_ / kWordBits;
+    const uint32_t new_words = std::max((size + kWordBits - 1u) / kWordBits, old_words * 2u);
+    std::unique_ptr<std::atomic<uint64_t>[]> words{new std::atomic<uint64_t>[new_words]};
+    for (uint32_t i = 0u; i < new_words; ++i) {
+        const uint64_t value = i < old_words ? words_[i].load(std::memory_order_relaxed) : 0u;
+        words[i].store(value, std::memory_order_relaxed);
+    }
+    words_ = std::move(words);
+    capacity_ = new_words * kWordBits;
+}
+
+bool DisabledEntityMask::set(ArchetypeEntityIndex index, bool disabled) noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
+    const auto i = index.toInt();
+    auto& word = words_[i / kWordBits];
+    if (disabled) {
+        if ((word.fetch_or(bit(i), std::memory_order_relaxed) & bit(i)) != 0u) {
+            return false;
+        }
+        count_.fetch_add(1u, std::memory_order_relaxed);
+    } else {
+        if ((word.fetch_and(~bit(i), std::memory_order_relaxed) & bit(i)) == 0u) {
+            return false;
+        }
+        count_.fetch_sub(1u, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+uint32_t DisabledEntityMask::find(uint32_t first, uint32_t end, bool disabled) const noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
+    if (count() == 0u) {
+        return disabled ? end : first;
+    }
+    // whole words of the other state are skipped, the first matching bit is found by bit scan
+    for (uint32_t i = first; i < end; i = (i / kWordBits + 1u) * kWordBits) {
+        uint64_t word = words_[i / kWordBits].load(std::memory_order_relaxed);
+        if (!disabled) {
+            word = ~word;
+        }
+        word &= ~(bit(i) - 1u);
+        if (word != 0u) {
+            return std::min(end, (i / kWordBits) * kWordBits + firstSetBit(word));
+        }
+    }
+    return end;
+}
+
+void DisabledEntityMask::clear() noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
+    if (count() == 0u) {
+        return;
+    }
+    for (uint32_t i = 0u; i < capacity_ / kWordBits; ++i) {
+        words_[i].store(0u, std::memory_order_relaxed);
+    }
+    count_.store(0u, std::memory_order_relaxed);
+}
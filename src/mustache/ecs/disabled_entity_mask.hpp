@@ -0,0 +1,85 @@
+#pragma once
+
+#include <mustache/utils/dll_export.h>
+#include <mustache/utils/uncopiable.hpp>
+#include <mustache/utils/default_settings.hpp>
+
+#include <mustache/ecs/id_deff.hpp>
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace mustache {
+
+    /**
+     * One bit per archetype entity, set bit means the entity is disabled and is skipped by jobs.
+     * Words are atomic, so entities may be enabled / disabled while the archetype is iterated.
+     * Storage grows with the archetype only, which never happens while jobs are running.
+     */
+    class MUSTACHE_EXPORT DisabledEntityMask : public Uncopiable {
+    public:
+        // makes room for size entities, new entities are enabled
+        MUSTACHE_INLINE void reserve(uint32_t size) {
+            if (size > capacity_) {
+                grow(size);
+            }
+        }
+
+        [[nodiscard]] MUSTACHE_INLINE bool test(ArchetypeEntityIndex index) const noexcept {
+            const auto i = index.toInt();
+            return (words_[i / kWordBits].load(std::memory_order_relaxed) & bit(i)) != 0u;
+        }
+
+        // returns true if the state of the entity has changed
+        bool set(ArchetypeEntityIndex index, bool disabled) noexcept;
+
+        [[nodiscard]] uint32_t count() const noexcept {
+            return count_.load(std::memory_order_relaxed);
+        }
+
+        // first index in [first, end) with the given state, end if there is no one
+        [[nodiscard]] uint32_t find(uint32_t first, uint32_t end, bool disabled) const noexcept;
+
+        // all entities are enabled
+        void clear() noexcept;
+
+        // calls func(first, count) for every run of enabled entities in [first, first + count)
+        template<typename _F>
+        MUSTACHE_INLINE void forEachEnabledRun(uint32_t first, uint32_t count, _F&& func) const {
+            const uint32_t end = first + count;
+            for (uint32_t begin = find(first, end, false); begin < end;) {
+                const uint32_t run_end = find(begin, end, true);
+                func(begin, run_end - begin);
+                begin = find(run_end, end, false);
+            }
+        }
+
+    private:
+        static constexpr uint32_t kWordBits = 64u;
+
+        [[nodiscard]] static constexpr uint64_t bit(uint32_t index) noexcept {
+            return uint64_t{1u} << (index % kWordBits);
+        }
+
+        [[nodiscard]] static MUSTACHE_INLINE uint32_t firstSetBit(uint64_t word) noexcept {
+#ifdef _MSC_VER
+            unsigned long result = 0;
+            _BitScanForward64(&result, word);
+            return static_cast<uint32_t>(result);
+#else
+            return static_cast<uint32_t>(__builtin_ctzll(word));
+#endif
+        }
+
+        void grow(uint32_t size);
+
+        std::unique_ptr<std::atomic<uint64_t>[]> words_;
+        uint32_t capacity_ = 0u;
+        std::atomic<uint32_t> count_{0u};
+    };
+}
@@ -1,4 +1,6 @@
 #pragma once
 
 #include <mustache/ecs/job.hpp>
+#include <mustache/ecs/fused_job.hpp>
+#include <mustache/ecs/job_scheduler.hpp>
 #include <mustache/ecs/system.hpp>
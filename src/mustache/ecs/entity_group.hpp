@@ -5,15 +5,20 @@
 
 namespace mustache {
 
+    /**
+     * Entities created at once: ids reused from the free list (fragmented)
+     * followed by count entities with contiguous ids starting at first.
+     */
     class MUSTACHE_EXPORT EntityGroup {
     public:
-        EntityGroup(mustache::vector<Entity>&& fragmented, uint32_t first, uint32_t count):
+        EntityGroup() = default;
+        EntityGroup(mustache::vector<Entity>&& fragmented, Entity first, uint32_t count):
                 fragmented_(std::move(fragmented)),
                 first_{first},
                 count_{count} {
 
         };
-        EntityGroup(const mustache::vector<Entity>& fragmented, uint32_t first, uint32_t count):
+        EntityGroup(const mustache::vector<Entity>& fragmented, Entity first, uint32_t count):
                 fragmented_(fragmented),
                 first_{first},
                 count_{count} {
@@ -46,7 +51,7 @@ namespace mustache {
                 return fragmented_[index];
             }
             if(index - fragmented_.size() < count_) {
-                return Entity::makeFromValue(first_ + index);
+                return contiguousAt(index - numFragmented());
             }
             throw std::out_of_range("Invalid index");
         }
@@ -54,11 +59,15 @@ namespace mustache {
             if(index < fragmented_.size()) {
                 return fragmented_[index];
             }
-            return Entity::makeFromValue(first_ + index);
+            return contiguousAt(index - numFragmented());
         }
 
-        [[nodiscard]] Iterator begin() const;
-        [[nodiscard]] Iterator end() const;
+        [[nodiscard]] Iterator begin() const noexcept {
+            return Iterator{this, 0u};
+        }
+        [[nodiscard]] Iterator end() const noexcept {
+            return Iterator{this, size()};
+        }
 
         [[nodiscard]] uint32_t numFragmented() const noexcept {
             return static_cast<uint32_t>(fragmented_.size());
@@ -67,8 +76,13 @@ namespace mustache {
             return count_ + numFragmented();
         }
     private:
+        // contiguous entities differ only by id, which is stored in the lowest bits
+        [[nodiscard]] Entity contiguousAt(uint32_t index) const noexcept {
+            return Entity::makeFromValue(first_.value + index);
+        }
+
         mustache::vector<Entity> fragmented_;
-        uint32_t first_{0u};
+        Entity first_;
         uint32_t count_{0u};
     };
 }
@@ -4,8 +4,19 @@
 
 #include <mustache/ecs/world.hpp>
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
 using namespace mustache;
 
+namespace {
+    uint64_t nextArchetypesEpoch() noexcept {
+        static std::atomic<uint64_t> epoch{0u};
+        return ++epoch;
+    }
+}
+
 namespace mustache {
     bool operator<(const ArchetypeComponents& lhs, const ArchetypeComponents& rhs) noexcept {
         return memcmp(&lhs.unique, &rhs.unique, sizeof(rhs.unique)) < 0;// lhs.unique < rhs.unique;
@@ -18,11 +29,12 @@ EntityManager::EntityManager(World& world):
         marked_for_delete_{world.memoryManager()},
         this_world_id_{world.id()},
         world_version_{world.version()},
+        archetypes_epoch_{nextArchetypesEpoch()},
         archetypes_{world.memoryManager()} {
     MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
 
-    const auto thread_count = Dispatcher::maxThreadCount();
-    temporal_storages_.resize(thread_count);
+    // one storage per dispatcher worker and one for threads not owned by the dispatcher, see Dispatcher::currentThreadId
+    temporal_storages_.resize(world.dispatcher().threadCount() + 1u);
 }
 
 Archetype& EntityManager::getArchetype(const ComponentIdMask& mask, const SharedComponentsInfo& shared) {
@@ -71,22 +83,93 @@ Archetype& EntityManager::getArchetype(const ComponentIdMask& mask, const Shared
             chunk_size = max;
         }
 
+        ComponentIdMask cold_mask;
+        for (const auto& func: cold_components_functions_) {
+            cold_mask = cold_mask.merge(func(arch_mask));
+        }
+
         result = new Archetype(world_, archetypes_.back_index().next(),
-                               arch_mask, shared, chunk_size);
+                               arch_mask, shared, chunk_size, cold_mask.intersection(arch_mask));
         archetypes_.emplace_back(result, deleter);
     }
     return *result;
 }
 
+Archetype& EntityManager::archetypeWithComponent(Archetype& archetype, ComponentId component) {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+
+    auto result = Archetype::findEdge(archetype.add_edges_, component);
+    if (result == nullptr) {
+        auto mask = archetype.mask_;
+        mask.add(component);
+        result = &getArchetype(mask, archetype.sharedComponentInfo());
+        Archetype::setEdge(archetype.add_edges_, component, result);
+    }
+    return *result;
+}
+
+Archetype& EntityManager::archetypeWithoutComponent(Archetype& archetype, ComponentId component) {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+
+    auto result = Archetype::findEdge(archetype.remove_edges_, component);
+    if (result == nullptr) {
+        auto mask = archetype.mask_;
+        mask.set(component, false);
+        result = &getArchetype(mask, archetype.sharedComponentInfo());
+        Archetype::setEdge(archetype.remove_edges_, component, result);
+    }
+    return *result;
+}
+
+EntityGroup EntityManager::createGroup(Archetype& archetype, uint32_t count) {
+    MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
+
+    mustache::vector<Entity> fragmented;
+    if (isLocked()) {
+        fragmented.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            fragmented.push_back(createLocked(archetype.componentMask(), archetype.sharedComponentInfo()));
+        }
+        return EntityGroup{std::move(fragmented), Entity{}, 0u};
+    }
+
+    const uint32_t fragmented_count = std::min(count, empty_slots_);
+    fragmented.reserve(fragmented_count);
+    for (uint32_t i = 0; i < fragmented_count; ++i) {
+        fragmented.push_back(createWithOutInit());
+    }
+
+    const uint32_t contiguous_count = count - fragmented_count;
+    Entity first;
+    if (contiguous_count > 0u) {
+        const auto first_id = static_cast<uint32_t>(locations_.size());
+        first.reset(EntityId::make(first_id), EntityVersion::make(0), this_world_id_);
+        locations_.resize(first_id + contiguous_count);
+        for (uint32_t i = 0; i < contiguous_count; ++i) {
+            locations_[EntityId::make(first_id + i)].entity = Entity::makeFromValue(first.value + i);
+        }
+    }
+
+    EntityGroup group{std::move(fragmented), first, contiguous_count};
+    archetype.insert(group);
+    return group;
+}
+
 void EntityManager::clear() {
     MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
 
     locations_.clear();
+    marked_for_delete_.clear();
     next_slot_ = EntityId::make(0);
     empty_slots_ = 0u;
     for(auto& arh : archetypes_) {
         arh->clear();
     }
+    for (auto& slot : sparse_storages_) {
+        if (slot.storage) {
+            slot.storage->clear();
+        }
+    }
 }
 
 void EntityManager::update() {
@@ -96,10 +179,141 @@ void EntityManager::update() {
         throw std::runtime_error("Can not update locked EntityManager");
     }
     world_version_ = world_.version();
-    for (auto entity : marked_for_delete_) {
-        destroyNow(entity);
+    destroyMarked();
+}
+
+bool EntityManager::compactMemory(uint32_t budget) {
+    MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
+
+    if (isLocked()) {
+        throw std::runtime_error("Can not compact locked EntityManager");
+    }
+    const auto count = archetypes_.size();
+    for (size_t i = 0; i < count; ++i) {
+        if (compact_cursor_.toInt() >= count) {
+            compact_cursor_ = ArchetypeIndex::make(0);
+        }
+        auto& archetype = *archetypes_[compact_cursor_];
+        budget -= archetype.compact(budget);
+        if (!archetype.isCompacted()) {
+            // budget is used up, the archetype is continued by the next call
+            return false;
+        }
+        compact_cursor_ = compact_cursor_.next();
+    }
+    return true;
+}
+
+void EntityManager::shrinkToFit() {
+    MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
+    compactMemory(std::numeric_limits<uint32_t>::max());
+}
+
+void EntityManager::destroyMarked() {
+    MUSTACHE_PROFILER_BLOCK_LVL_1(__FUNCTION__ );
+
+    struct Item {
+        ArchetypeIndex archetype;
+        ArchetypeEntityIndex index;
+    };
+    mustache::vector<Entity> batch;
+    mustache::vector<Item> items;
+    mustache::vector<ArchetypeEntityIndex> indices;
+    // beforeRemove hooks may mark more entities, they are destroyed in the same update
+    while (!marked_for_delete_.empty()) {
+        batch.clear();
+        for (const auto entity : marked_for_delete_) {
+            if (!isEntityValid(entity)) {
+                continue;
+            }
+            auto& location = locations_[entity.id()];
+            location.marked_for_delete = false;
+            if (location.archetype != nullptr) {
+                batch.push_back(entity);
+            }
+        }
+        marked_for_delete_.clear();
+
+        // hooks can change the world, so entities with them are destroyed one by one before indices are taken
+        items.clear();
+        for (const auto entity : batch) {
+            const auto& location = locations_[entity.id()];
+            if (location.archetype != nullptr && (location.archetype->hasBeforeRemoveHooks() ||
+                    (sparse_storages_.size() > 0u && hasSparseBeforeRemoveHooks(entity.id())))) {
+                destroyNow<FunctionSafety::kUnsafe>(entity);
+            }
+        }
+        for (const auto entity : batch) {
+            if (isEntityValid(entity) && locations_[entity.id()].archetype != nullptr) {
+                const auto& location = locations_[entity.id()];
+                items.push_back(Item{location.archetype->id(), location.index});
+            }
+        }
+
+        // one compaction pass per archetype, entities are removed from the end
+        std::sort(items.begin(), items.end(), [](const Item& lhs, const Item& rhs) {
+            if (lhs.archetype != rhs.archetype) {
+                return lhs.archetype.toInt() < rhs.archetype.toInt();
+            }
+            return lhs.index.toInt() > rhs.index.toInt();
+        });
+        for (size_t begin = 0; begin < items.size();) {
+            auto& archetype = *archetypes_[items[begin].archetype];
+            indices.clear();
+            batch.clear();
+            size_t end = begin;
+            for (; end < items.size() && items[end].archetype == items[begin].archetype; ++end) {
+                const auto index = items[end].index;
+                const auto entity = *archetype.entityAt<FunctionSafety::kUnsafe>(index);
+                updateLocation(entity, nullptr, ArchetypeEntityIndex::null());
+                batch.push_back(entity);
+                indices.push_back(index);
+            }
+            archetype.removeGroup(indices);
+            // entities with sparse beforeRemove hooks were destroyed above, the rest need no hooks
+            for (const auto entity : batch) {
+                if (sparse_storages_.size() > 0u) {
+                    eraseSparseComponents(entity.id());
+                }
+                freeEntityIdUnsafe(entity);
+            }
+            begin = end;
+        }
+    }
+}
+
+void EntityManager::destroyAll(const ComponentIdMask& required, const ComponentIdMask& exclude) {
+    MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
+
+    if (isLocked()) {
+        throw std::runtime_error("Can not destroy entities of locked EntityManager");
+    }
+    const auto archetypes_count = archetypes_.size();
+    for (auto index = ArchetypeIndex::make(0); index < ArchetypeIndex::make(archetypes_count); ++index) {
+        auto& archetype = *archetypes_[index];
+        if (archetype.isEmpty() || !archetype.isMatch(required, exclude, ComponentIdMask::null())) {
+            continue;
+        }
+        const auto& entities = archetype.entities();
+        const bool has_sparse_hooks = sparse_storages_.size() > 0u &&
+                std::any_of(entities.begin(), entities.end(), [this](Entity entity) {
+                    return hasSparseBeforeRemoveHooks(entity.id());
+                });
+        if (archetype.hasBeforeRemoveHooks() || has_sparse_hooks) {
+            while (!archetype.isEmpty()) {
+                destroyNow<FunctionSafety::kUnsafe>(archetype.entities().back());
+            }
+            continue;
+        }
+        for (const auto entity : entities) {
+            updateLocation(entity, nullptr, ArchetypeEntityIndex::null());
+            if (sparse_storages_.size() > 0u) {
+                eraseSparseComponents(entity.id());
+            }
+            freeEntityIdUnsafe(entity);
+        }
+        archetype.removeAll();
     }
-    marked_for_delete_.clear();
 }
 
 void EntityManager::clearArchetype(Archetype& archetype) {
@@ -107,6 +321,11 @@ void EntityManager::clearArchetype(Archetype& archetype) {
 
     for (const auto entity : archetype.entities()) {
         const auto id = entity.id();
+        for (auto& slot : sparse_storages_) {
+            if (slot.storage) {
+                slot.storage->erase(id);
+            }
+        }
         auto& location = locations_[id];
         location.archetype = nullptr;
         location.entity.reset(empty_slots_ ? next_slot_ : id.next(), entity.version().next());
@@ -121,6 +340,10 @@ void EntityManager::addDependency(ComponentId component, const ComponentIdMask&
 
     auto& dependency = dependencies_[component];
     dependency = dependency.merge(extra.merge(getExtraComponents(extra)));
+    // cached transitions may lead to archetypes without the new dependent components
+    for (auto& archetype : archetypes_) {
+        archetype->clearEdges();
+    }
 }
 
 void EntityManager::addChunkSizeFunction(const ArchetypeChunkSizeFunction& function) {
@@ -132,6 +355,14 @@ void EntityManager::addChunkSizeFunction(const ArchetypeChunkSizeFunction& funct
     }
 }
 
+void EntityManager::addColdComponentsFunction(const ArchetypeColdComponentsFunction& function) {
+    MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
+
+    if (function) {
+        cold_components_functions_.push_back(function);
+    }
+}
+
 void EntityManager::setDefaultArchetypeVersionChunkSize(uint32_t value) noexcept {
     MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
 
@@ -183,6 +414,10 @@ void EntityManager::removeComponent(Entity entity, ComponentId component) {
         getTemporalStorage().removeComponent(entity, component);
         return;
     }
+    if (const auto sparse = sparseStorage(component); sparse != nullptr) {
+        sparse->remove(world_, entity);
+        return;
+    }
     const auto& location = locations_[entity.id()];
     if (location.archetype == nullptr) {
         return;
@@ -193,10 +428,7 @@ void EntityManager::removeComponent(Entity entity, ComponentId component) {
         return;
     }
 
-    auto mask = prev_archetype.mask_;
-    mask.set(component, false);
-
-    auto& archetype = getArchetype(mask, prev_archetype.sharedComponentInfo());
+    auto& archetype = archetypeWithoutComponent(prev_archetype, component);
     if (&archetype == &prev_archetype) {
         return;
     }
@@ -205,6 +437,53 @@ void EntityManager::removeComponent(Entity entity, ComponentId component) {
     archetype.externalMove(entity, prev_archetype, prev_index, ComponentIdMask::null());
 }
 
+void EntityManager::addComponentToAll(ComponentId component, const ComponentIdMask& required,
+                                      const ComponentIdMask& exclude) {
+    MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
+
+    if (isLocked()) {
+        throw std::runtime_error("Can not add component to all entities of locked EntityManager");
+    }
+    if (sparseStorageOf(component) != nullptr) {
+        throw std::runtime_error("Can not add sparse component to all entities");
+    }
+    // archetypes created by the moves already have the component
+    const auto archetypes_count = archetypes_.size();
+    for (auto index = ArchetypeIndex::make(0); index < ArchetypeIndex::make(archetypes_count); ++index) {
+        auto& prev_archetype = *archetypes_[index];
+        if (prev_archetype.isEmpty() || prev_archetype.hasComponent(component) ||
+            !prev_archetype.isMatch(required, exclude, ComponentIdMask::null())) {
+            continue;
+        }
+        auto& archetype = archetypeWithComponent(prev_archetype, component);
+        archetype.externalMoveAll(prev_archetype, ComponentIdMask::null());
+    }
+}
+
+void EntityManager::removeComponentFromAll(ComponentId component, const ComponentIdMask& required,
+                                           const ComponentIdMask& exclude) {
+    MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
+
+    if (isLocked()) {
+        throw std::runtime_error("Can not remove component from all entities of locked EntityManager");
+    }
+    if (sparseStorageOf(component) != nullptr) {
+        throw std::runtime_error("Can not remove sparse component from all entities");
+    }
+    const auto archetypes_count = archetypes_.size();
+    for (auto index = ArchetypeIndex::make(0); index < ArchetypeIndex::make(archetypes_count); ++index) {
+        auto& prev_archetype = *archetypes_[index];
+        if (prev_archetype.isEmpty() || !prev_archetype.hasComponent(component) ||
+            !prev_archetype.isMatch(required, exclude, ComponentIdMask::null())) {
+            continue;
+        }
+        auto& archetype = archetypeWithoutComponent(prev_archetype, component);
+        if (&archetype != &prev_archetype) {
+            archetype.externalMoveAll(prev_archetype, ComponentIdMask::null());
+        }
+    }
+}
+
 bool EntityManager::removeSharedComponent(Entity entity, SharedComponentId component) {
     MUSTACHE_PROFILER_BLOCK_LVL_2(__FUNCTION__ );
 
@@ -255,24 +534,118 @@ void EntityManager::markDirty(Entity entity, ComponentId component_id) noexcept
     }
 }
 
-void EntityManager::applyCommandPack(TemporalStorage& storage, size_t begin, size_t end) {
+SparseComponentStorage* EntityManager::sparseStorageOf(ComponentId id) {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+
+    if (!sparse_storages_.has(id)) {
+        sparse_storages_.resize(id.next().toInt());
+    }
+    auto& slot = sparse_storages_[id];
+    if (!slot.checked) {
+        slot.checked = true;
+        if (ComponentFactory::instance().componentInfo(id).sparse) {
+            slot.storage = std::make_unique<SparseComponentStorage>(world_.memoryManager(), id);
+        }
+    }
+    return slot.storage.get();
+}
+
+void EntityManager::destroySparseComponents(Entity entity) noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+
+    for (auto& slot : sparse_storages_) {
+        if (slot.storage) {
+            slot.storage->remove(world_, entity);
+        }
+    }
+}
+
+void EntityManager::eraseSparseComponents(EntityId id) noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+
+    for (auto& slot : sparse_storages_) {
+        if (slot.storage) {
+            slot.storage->erase(id);
+        }
+    }
+}
+
+bool EntityManager::hasSparseBeforeRemoveHooks(EntityId id) const noexcept {
+    for (const auto& slot : sparse_storages_) {
+        if (slot.storage && slot.storage->componentInfo().functions.before_remove && slot.storage->has(id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void EntityManager::cloneSparseComponents(Entity source, Entity dest, CloneEntityMap& entity_map) {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+
+    for (auto& slot : sparse_storages_) {
+        if (!slot.storage || !slot.storage->has(source.id())) {
+            continue;
+        }
+        auto& storage = *slot.storage;
+        const auto& functions = storage.componentInfo().functions;
+        bool constructed = false;
+        auto dest_ptr = storage.emplace(dest, constructed);
+        // emplace may allocate a dense page, so the source is taken after it
+        const auto source_ptr = storage.get(source.id());
+        functions.clone(dest_ptr, dest, source_ptr, source, world_, entity_map);
+        if (functions.after_clone) {
+            functions.after_clone(dest_ptr, dest, source_ptr, source, world_, entity_map);
+        }
+    }
+}
+
+void EntityManager::applySparseCommands(Entity entity, const TemporalCommand* begin, const TemporalCommand* end) {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+
+    for (auto command = begin; command != end; ++command) {
+        if (!isSparseCommand(*command)) {
+            continue;
+        }
+        const auto& action = *command->action;
+        auto& storage = *sparseStorage(action.component_id);
+        if (action.action == TemporalStorage::Action::kRemoveComponent) {
+            storage.remove(world_, entity);
+            continue;
+        }
+        const auto& info = *action.type_info;
+        bool alive = false;
+        auto dest = storage.emplace(entity, alive);
+        if (info.trivially_relocatable) {
+            memcpy(dest, action.ptr, info.size);
+        } else if (alive) {
+            info.functions.move(dest, action.ptr);
+        } else {
+            info.functions.move_constructor(dest, action.ptr);
+        }
+        if (info.functions.after_assign) {
+            info.functions.after_assign(dest, entity, world_);
+        }
+    }
+}
+
+void EntityManager::applyCommandPack(const TemporalCommand* begin, const TemporalCommand* end) {
     MUSTACHE_PROFILER_BLOCK_LVL_2(__FUNCTION__);
 
     ComponentIdMask final_mask;
-    ComponentIdMask initial_mask;
     SharedComponentsInfo shared;
-    const auto entity = storage.actions_[begin].entity;
-    const bool create = storage.actions_[begin].action == TemporalStorage::Action::kCreateEntity;
+    const auto entity = begin->action->entity;
+    const bool create = begin->isCreate();
     if (create) {
-        const auto index = storage.actions_[begin].create_action_index;
-        if (storage.create_actions_.has(index)) {
-            final_mask = storage.create_actions_[index].mask;
-            shared = storage.create_actions_[index].shared;
+        const auto index = begin->action->create_action_index;
+        if (begin->storage->create_actions_.has(index)) {
+            final_mask = begin->storage->create_actions_[index].mask;
+            shared = begin->storage->create_actions_[index].shared;
         }
         if (!locations_.has(entity.id())) {
             locations_.resize(entity.id().next().toInt());
-            locations_[entity.id()] = {entity};
         }
+        // ids of entities created by other threads may be applied in any order
+        locations_[entity.id()] = {entity};
     }
     else {
         auto archetype = getArchetypeOf(entity);
@@ -283,12 +656,17 @@ void EntityManager::applyCommandPack(TemporalStorage& storage, size_t begin, siz
         final_mask = archetype->componentMask();
         shared = archetype->sharedComponentInfo();
     }
-    initial_mask = final_mask;
-
-    for (size_t i = create ? begin + 1 : begin; i < end; ++i) {
-        const auto& command = storage.actions_[i];
-        switch (command.action) {
+    // components which are constructed before payloads are moved
+    const ComponentIdMask initial_mask = final_mask;
+    // existing components which are removed, the same component may be assigned again later
+    ComponentIdMask removed_mask;
+
+    bool has_sparse_commands = false;
+    for (auto command = create ? begin + 1 : begin; command != end; ++command) {
+        has_sparse_commands = has_sparse_commands || isSparseCommand(*command);
+        switch (command->action->action) {
             case TemporalStorage::Action::kDestroyEntityNow:
+                // earlier commands of the entity are dropped
                 if (create) {
                     releaseEntityIdUnsafe(entity);
                 }
@@ -300,13 +678,18 @@ void EntityManager::applyCommandPack(TemporalStorage& storage, size_t begin, siz
                 throw std::runtime_error("Create command should be first command for entity: " + std::to_string(entity.id().toInt()));
                 break;
             case TemporalStorage::Action::kDestroyEntity:
-                destroy(command.entity);
+                destroy(entity);
                 break;
             case TemporalStorage::Action::kRemoveComponent:
-                final_mask.set(command.component_id, false);
+                if (!isSparseCommand(*command)) {
+                    final_mask.set(command->action->component_id, false);
+                    removed_mask.set(command->action->component_id, initial_mask.has(command->action->component_id));
+                }
                 break;
             case TemporalStorage::Action::kAssignComponent:
-                final_mask.set(command.component_id, true);
+                if (!isSparseCommand(*command)) {
+                    final_mask.set(command->action->component_id, true);
+                }
                 break;
             default:
                 break;
@@ -321,16 +704,59 @@ void EntityManager::applyCommandPack(TemporalStorage& storage, size_t begin, siz
         const auto location = locations_[entity.id()];
         archetype.externalMove(entity, *location.archetype, location.index, final_mask);
     }
-    for (size_t i = begin; i < end; ++i) {
-        const auto& command = storage.actions_[i];
-        if (command.action != TemporalStorage::Action::kAssignComponent) {
+    const auto index = locations_[entity.id()].index;
+    // removed and assigned again: only the archetype moves are skipped, the old value is removed as usual
+    ComponentIdMask alive_mask = initial_mask;
+    for (const auto& id : removed_mask.intersection(final_mask).items()) {
+        const auto component_index = archetype.getComponentIndex(id);
+        if (component_index.isNull()) {
+            continue; // tags have no hooks
+        }
+        const auto& functions = ComponentFactory::instance().componentInfo(id).functions;
+        auto ptr = archetype.getData<FunctionSafety::kUnsafe>(component_index, index);
+        if (functions.before_remove) {
+            functions.before_remove(ptr, entity, world_);
+        }
+        if (functions.destroy) {
+            functions.destroy(ptr);
+        }
+        alive_mask.set(id, false);
+    }
+    moveAssignedComponents(archetype, index, alive_mask, begin, end, true);
+    if (has_sparse_commands) {
+        applySparseCommands(entity, begin, end);
+    }
+}
+
+void EntityManager::moveAssignedComponents(Archetype& archetype, ArchetypeEntityIndex index,
+                                           const ComponentIdMask& alive, const TemporalCommand* begin,
+                                           const TemporalCommand* end, bool call_after_assign) {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
+
+    // earlier payloads of the same component are only destroyed with the storage
+    ComponentIdMask applied;
+    for (auto command = end; command != begin;) {
+        --command;
+        const auto& action = *command->action;
+        if (action.action != TemporalStorage::Action::kAssignComponent || applied.has(action.component_id)) {
             continue;
         }
-        auto dest = archetype.getData<FunctionSafety::kUnsafe>(archetype.getComponentIndex(command.component_id), locations_[entity.id()].index);
-        const auto& component_functions = ComponentFactory::instance().componentInfo(command.component_id).functions;
-        component_functions.move_constructor(dest, command.ptr);
-        if (component_functions.after_assign) {
-            component_functions.after_assign(dest, command.entity, world_);
+        applied.add(action.component_id);
+        const auto component_index = archetype.getComponentIndex(action.component_id);
+        if (component_index.isNull()) {
+            continue; // removed after assign
+        }
+        auto dest = archetype.getData<FunctionSafety::kUnsafe>(component_index, index);
+        const auto& functions = action.type_info->functions;
+        if (action.type_info->trivially_relocatable) {
+            memcpy(dest, action.ptr, action.type_info->size);
+        } else if (alive.has(action.component_id)) {
+            functions.move(dest, action.ptr);
+        } else {
+            functions.move_constructor(dest, action.ptr);
+        }
+        if (call_after_assign && functions.after_assign) {
+            functions.after_assign(dest, action.entity, world_);
         }
     }
 }
@@ -378,33 +804,143 @@ void EntityManager::applyCommandPackUnoptimized(TemporalStorage& storage, size_t
     }
 }
 
-void EntityManager::applyStorage(TemporalStorage& storage) { // optimized version
-    // TODO: this version iterates over commands 3 times, it is possible to merge 1-st and 2-nd iterations.
+void EntityManager::applyStorages() {
     MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__);
 
-    if (storage.actions_.empty()) {
+    mustache::vector<TemporalCommand> commands;
+    for (const auto& storage : temporal_storages_) {
+        for (const auto& action : storage.actions_) {
+            commands.push_back(TemporalCommand{&storage, &action});
+            if (action.action == TemporalStorage::Action::kAssignComponent && action.type_info->sparse) {
+                // storages are created before packs are checked, see isSparseCommand
+                (void) sparseStorageOf(action.component_id);
+            }
+        }
+    }
+    if (commands.empty()) {
         return;
     }
+    // commands of an entity are coalesced: creation goes first, the rest keeps thread and record order
+    std::stable_sort(commands.begin(), commands.end(), [](const TemporalCommand& lhs, const TemporalCommand& rhs) {
+        if (lhs.action->entity != rhs.action->entity) {
+            return lhs.action->entity < rhs.action->entity;
+        }
+        return lhs.isCreate() && !rhs.isCreate();
+    });
+
+    struct CommandPack {
+        const TemporalCommand* begin = nullptr;
+        const TemporalCommand* end = nullptr;
+        Archetype* archetype = nullptr; // set if the pack is applied in parallel
+        ArchetypeEntityIndex index;
+    };
+    mustache::vector<CommandPack> packs;
+    mustache::vector<size_t> parallel;
+    for (size_t begin = 0u; begin < commands.size();) {
+        size_t end = begin + 1u;
+        while (end < commands.size() && commands[end].action->entity == commands[begin].action->entity) {
+            ++end;
+        }
+        auto& pack = packs.emplace_back();
+        pack.begin = commands.data() + begin;
+        pack.end = commands.data() + end;
+        begin = end;
 
-    size_t begin = 0;
-    size_t end = begin + 1;
-    Entity prev_entity = storage.actions_[begin].entity;
-    for (; end < storage.actions_.size(); ++end) {
-        const auto& action = storage.actions_[end];
-        if (action.entity == prev_entity) {
+        // new entity which is not destroyed
+        if (!pack.begin->isCreate()) {
             continue;
         }
-        applyCommandPack(storage, begin, end);
-        begin = end;
-        prev_entity = storage.actions_[end].entity;
+        const auto& create = *pack.begin;
+        const auto create_index = create.action->create_action_index;
+        ComponentIdMask final_mask;
+        SharedComponentsInfo shared;
+        if (create.storage->create_actions_.has(create_index)) {
+            final_mask = create.storage->create_actions_[create_index].mask;
+            shared = create.storage->create_actions_[create_index].shared;
+        }
+        const ComponentIdMask create_mask = final_mask;
+        bool only_components = true;
+        for (auto command = pack.begin + 1; command != pack.end && only_components; ++command) {
+            const auto action = command->action->action;
+            // removing a constructed component calls its hooks, see applyCommandPack
+            only_components = (action == TemporalStorage::Action::kAssignComponent ||
+                               (action == TemporalStorage::Action::kRemoveComponent &&
+                                !create_mask.has(command->action->component_id))) && !isSparseCommand(*command);
+            final_mask.set(command->action->component_id, action == TemporalStorage::Action::kAssignComponent);
+        }
+        if (!only_components) {
+            continue;
+        }
+        auto& archetype = getArchetype(final_mask, shared);
+        if (archetype.hasWorldInit()) {
+            continue;
+        }
+        pack.archetype = &archetype;
+        parallel.push_back(packs.size() - 1u);
+    }
+
+    if (!parallel.empty()) {
+        // slots are reserved in entity order, grouped by destination archetype
+        std::stable_sort(parallel.begin(), parallel.end(), [&packs](size_t lhs, size_t rhs) {
+            return packs[lhs].archetype->id().toInt() < packs[rhs].archetype->id().toInt();
+        });
+        uint32_t max_id = 0u;
+        for (size_t begin = 0u; begin < parallel.size();) {
+            auto archetype = packs[parallel[begin]].archetype;
+            size_t end = begin;
+            while (end < parallel.size() && packs[parallel[end]].archetype == archetype) {
+                max_id = std::max(max_id, packs[parallel[end]].begin->action->entity.id().toInt());
+                ++end;
+            }
+            const auto first = archetype->emplaceBack(static_cast<uint32_t>(end - begin));
+            for (size_t i = begin; i < end; ++i) {
+                packs[parallel[i]].index = ArchetypeEntityIndex::make(first.toInt() + static_cast<uint32_t>(i - begin));
+            }
+            begin = end;
+        }
+        if (locations_.size() <= max_id) {
+            locations_.resize(max_id + 1u);
+        }
+        for (const auto pack_index : parallel) {
+            const auto entity = packs[pack_index].begin->action->entity;
+            locations_[entity.id()] = EntityLocationInWorld{entity};
+        }
+
+        const auto apply = [this, &packs, &parallel](size_t i) {
+            const auto& pack = packs[parallel[i]];
+            const auto& create = *pack.begin;
+            const auto create_index = create.action->create_action_index;
+            ComponentIdMask initial_mask;
+            if (create.storage->create_actions_.has(create_index)) {
+                initial_mask = create.storage->create_actions_[create_index].mask;
+            }
+            pack.archetype->initEntity(create.action->entity, pack.index, initial_mask.inverse());
+            moveAssignedComponents(*pack.archetype, pack.index, initial_mask, pack.begin + 1, pack.end, false);
+        };
+        constexpr size_t min_parallel_insert_count = 1024u;
+        auto& dispatcher = world_.dispatcher();
+        if (parallel.size() >= min_parallel_insert_count && dispatcher.threadCount() > 1u) {
+            dispatcher.parallelFor(apply, 0u, parallel.size());
+        } else {
+            for (size_t i = 0u; i < parallel.size(); ++i) {
+                apply(i);
+            }
+        }
+    }
+
+    for (const auto& pack : packs) {
+        if (pack.archetype == nullptr) {
+            applyCommandPack(pack.begin, pack.end);
+        }
     }
-    applyCommandPack(storage, begin, end);
 
-    for (auto& command : storage.actions_) {
-        if (command.action == TemporalStorage::Action::kAssignComponent) {
-            const auto& info = ComponentFactory::instance().componentInfo(command.component_id);
-            if (info.functions.destroy) {
-                info.functions.destroy(command.ptr);
+    for (auto& storage : temporal_storages_) {
+        for (auto& command : storage.actions_) {
+            if (command.action == TemporalStorage::Action::kAssignComponent) {
+                const auto& info = ComponentFactory::instance().componentInfo(command.component_id);
+                if (info.functions.destroy) {
+                    info.functions.destroy(command.ptr);
+                }
             }
         }
     }
@@ -12,6 +12,7 @@
 #include <mustache/ecs/component_mask.hpp>
 #include <mustache/ecs/entity_builder.hpp>
 #include <mustache/ecs/temporal_storage.hpp>
+#include <mustache/ecs/sparse_component_storage.hpp>
 #include <mustache/ecs/component_factory.hpp>
 
 #include <memory>
@@ -32,6 +33,9 @@ namespace mustache {
 
     using ArchetypeChunkSizeFunction = std::function<ArchetypeChunkSize (const ComponentIdMask&)>;
 
+    // returns components of the archetype that are stored as cold, see IsColdComponent
+    using ArchetypeColdComponentsFunction = std::function<ComponentIdMask (const ComponentIdMask&)>;
+
 
     struct alignas(32) EntityLocationInWorld {
         constexpr static Archetype* kDefaultArchetype = nullptr;
@@ -44,6 +48,7 @@ namespace mustache {
         Entity entity;
         ArchetypeEntityIndex index;
         Archetype* archetype;
+        bool marked_for_delete{false}; // entity is in EntityManager::marked_for_delete_
     };
 
     class MUSTACHE_EXPORT EntityManager : public Uncopiable {
@@ -57,6 +62,16 @@ namespace mustache {
 
         void update();
 
+        /**
+         * Releases buffers of empty archetypes and shrinks mostly empty ones, moving at most budget entities.
+         * Archetypes are visited round-robin, so calling it once per frame with a small budget spreads the work.
+         * Returns true if nothing is left to compact.
+         */
+        bool compactMemory(uint32_t budget);
+
+        /// Compacts every archetype at once.
+        void shrinkToFit();
+
         // Checks if entity is valid for this World
         /// iteration safe
         [[nodiscard]] MUSTACHE_INLINE bool isEntityValid(Entity entity) const noexcept;
@@ -74,6 +89,13 @@ namespace mustache {
         template<typename... Components>
         [[nodiscard]] MUSTACHE_INLINE Entity create();
 
+        /**
+         * Creates count entities of archetype at once: free ids are reused first,
+         * the rest is a contiguous id block, archetype storage grows once and versions are updated once per chunk.
+         * If EntityManager is locked entities are created one by one and all of them are fragmented.
+         */
+        [[nodiscard]] EntityGroup createGroup(Archetype& archetype, uint32_t count);
+
         void clear();
 
         void clearArchetype(Archetype& archetype);
@@ -108,6 +130,14 @@ namespace mustache {
         template<FunctionSafety _Safety = FunctionSafety::kSafe>
         MUSTACHE_INLINE void destroyNow(Entity entity);
 
+        /**
+         * Destroys every entity that has all components of required and none of exclude.
+         * Matching archetypes are dropped as a whole, without moving entities inside them.
+         * NOT iteration safe, throws if EntityManager is locked.
+         */
+        void destroyAll(const ComponentIdMask& required = ComponentIdMask::null(),
+                        const ComponentIdMask& exclude = ComponentIdMask::null());
+
         Archetype& getArchetype(const ComponentIdMask&, const SharedComponentsInfo& shared_component_mask);
 
         /// iteration safe
@@ -119,6 +149,12 @@ namespace mustache {
         /// iteration safe
         [[nodiscard]] size_t MUSTACHE_INLINE getArchetypesCount() const noexcept;
 
+        /// Unique for every EntityManager, changes when previously returned archetype indexes become invalid.
+        /// Creating an archetype does not change it: archetypes are only appended.
+        [[nodiscard]] uint64_t archetypesEpoch() const noexcept {
+            return archetypes_epoch_;
+        }
+
         /// iteration safe
         template<FunctionSafety _Safety = FunctionSafety::kDefault>
         [[nodiscard]] MUSTACHE_INLINE  Archetype& getArchetype(ArchetypeIndex index) noexcept (!isSafe(_Safety));
@@ -139,9 +175,36 @@ namespace mustache {
         template<typename T, FunctionSafety _Safety = FunctionSafety::kSafe>
         MUSTACHE_INLINE void removeComponent(Entity entity);
 
+        /// Storage of a sparse component (see IsSparseComponent), nullptr if the component was never assigned.
+        /// iteration safe
+        [[nodiscard]] MUSTACHE_INLINE SparseComponentStorage* sparseStorage(ComponentId id) const noexcept {
+            return sparse_storages_.has(id) ? sparse_storages_[id].storage.get() : nullptr;
+        }
+
         /// iteration safe
         void removeComponent(Entity entity, ComponentId component);
 
+        /**
+         * Assigns component to every entity that has all components of required and none of exclude.
+         * Whole archetypes are moved at once: one resize of destination, a column pass per component
+         * and one pass over entity locations, instead of externalMove per entity.
+         * NOT iteration safe, throws if EntityManager is locked.
+         */
+        template<typename T>
+        void addComponentToAll(const ComponentIdMask& required = ComponentIdMask::null(),
+                               const ComponentIdMask& exclude = ComponentIdMask::null());
+
+        void addComponentToAll(ComponentId component, const ComponentIdMask& required, const ComponentIdMask& exclude);
+
+        /// Removes component from every entity that has it, all components of required and none of exclude.
+        /// NOT iteration safe, throws if EntityManager is locked.
+        template<typename T>
+        void removeComponentFromAll(const ComponentIdMask& required = ComponentIdMask::null(),
+                                    const ComponentIdMask& exclude = ComponentIdMask::null());
+
+        void removeComponentFromAll(ComponentId component, const ComponentIdMask& required,
+                                    const ComponentIdMask& exclude);
+
         /// NOT iteration safe
         template<typename T, FunctionSafety _Safety = FunctionSafety::kSafe>
         MUSTACHE_INLINE bool removeSharedComponent(Entity entity);
@@ -223,6 +286,21 @@ namespace mustache {
         template<FunctionSafety _Safety = FunctionSafety::kDefault, typename _ComponentId>
         [[nodiscard]] MUSTACHE_INLINE bool hasComponent(Entity entity, _ComponentId id) const noexcept;
 
+        /**
+         * @brief Enables or disables an entity without moving it to another archetype.
+         *
+         * Disabled entities keep their components but are skipped by jobs and forEach.
+         * The state is one bit of the archetype, it follows the entity when components are added or removed.
+         *
+         * @note This function is iteration safe, the bit is written atomically and is seen by chunks not processed yet.
+         * @note Entities without components are always enabled.
+         */
+        template<FunctionSafety _Safety = FunctionSafety::kDefault>
+        MUSTACHE_INLINE void setEnabled(Entity entity, bool enabled) noexcept;
+
+        template<FunctionSafety _Safety = FunctionSafety::kDefault>
+        [[nodiscard]] MUSTACHE_INLINE bool isEnabled(Entity entity) const noexcept;
+
         /**
          * @brief Returns the WorldVersion of the last update of a component for a given entity.
          *
@@ -384,6 +462,17 @@ namespace mustache {
          */
         void addChunkSizeFunction(const ArchetypeChunkSizeFunction& function);
 
+        /**
+         * @brief Adds a function that selects cold components of new archetypes.
+         *
+         * Columns of cold components are kept in a separate heap allocation, so columns that are iterated
+         * together stay packed in one buffer. Components marked with IsColdComponent are always cold.
+         * Archetypes that already exist keep their layout.
+         *
+         * @param function The function returning cold components for an archetype mask.
+         */
+        void addColdComponentsFunction(const ArchetypeColdComponentsFunction& function);
+
         /**
          * @brief Adds a chunk size function for the given archetype.
          *
@@ -499,6 +588,9 @@ namespace mustache {
             auto dest = createWithOutInit();
             entity_map.add(source, dest);
             arch->cloneEntity(source, dest, location.index, entity_map);
+            if (sparse_storages_.size() > 0u) {
+                cloneSparseComponents(source, dest, entity_map);
+            }
             return dest;
         }
 
@@ -527,10 +619,19 @@ namespace mustache {
         void* assign(Entity e, ComponentId component_id);
 
         MUSTACHE_INLINE void releaseEntityIdUnsafe(Entity entity) noexcept {
+            if (sparse_storages_.size() > 0u) {
+                destroySparseComponents(entity);
+            }
+            freeEntityIdUnsafe(entity);
+        }
+
+        // sparse components must be already released, see eraseSparseComponents
+        MUSTACHE_INLINE void freeEntityIdUnsafe(Entity entity) noexcept {
             const auto id = entity.id();
             if (!locations_.has(id)) {
                 locations_.resize(id.next().toInt());
             }
+            locations_[id].marked_for_delete = false;
             locations_[id].entity.reset(empty_slots_ ? next_slot_ : id.next(), entity.version().next());
             next_slot_ = id;
             ++empty_slots_;
@@ -544,16 +645,46 @@ namespace mustache {
         MUSTACHE_INLINE void onUnlock() noexcept {
             MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__);
             if (was_temporal_storage_used_.exchange(false)) {
+                applyStorages();
                 for (auto& storage: temporal_storages_) {
-                    applyStorage(storage);
                     storage.clear();
                 }
             }
         }
 
-        void applyStorage(TemporalStorage& storage);
-        void applyCommandPack(TemporalStorage& storage, size_t begin, size_t end);
+        // destroys entities marked by destroy(), grouped by archetype
+        void destroyMarked();
+
+        /**
+         * Applies commands of all temporal storages grouped by entity, so every entity changes archetype once.
+         * New entities that are not destroyed and have no afterAssign hooks or constructors taking World&
+         * are inserted in parallel:
+         * destination slots are reserved serially, so entity ids and positions do not depend on the thread count.
+         */
+        void applyStorages();
+        // all commands of one entity, creation (if any) is the first one
+        void applyCommandPack(const TemporalCommand* begin, const TemporalCommand* end);
+        // moves the last payload of every assigned component, components of alive mask are move-assigned
+        void moveAssignedComponents(Archetype& archetype, ArchetypeEntityIndex index, const ComponentIdMask& alive,
+                                    const TemporalCommand* begin, const TemporalCommand* end, bool call_after_assign);
         void applyCommandPackUnoptimized(TemporalStorage& storage, size_t begin, size_t end);
+        // assigns and removes sparse components of the pack in command order
+        void applySparseCommands(Entity entity, const TemporalCommand* begin, const TemporalCommand* end);
+        [[nodiscard]] bool isSparseCommand(const TemporalCommand& command) const noexcept {
+            const auto action = command.action->action;
+            return (action == TemporalStorage::Action::kAssignComponent ||
+                    action == TemporalStorage::Action::kRemoveComponent) &&
+                    sparseStorage(command.action->component_id) != nullptr;
+        }
+
+        // storage of the sparse component, created on first use, nullptr if the component is stored in archetypes
+        SparseComponentStorage* sparseStorageOf(ComponentId id);
+        // removes the entity from all sparse storages, beforeRemove hooks are called
+        void destroySparseComponents(Entity entity) noexcept;
+        // destroys sparse components without beforeRemove hooks
+        void eraseSparseComponents(EntityId id) noexcept;
+        [[nodiscard]] bool hasSparseBeforeRemoveHooks(EntityId id) const noexcept;
+        void cloneSparseComponents(Entity source, Entity dest, CloneEntityMap& entity_map);
 
         Entity createLocked(const ComponentIdMask& components, const SharedComponentsInfo& shared) noexcept {
             // you need to store this entity in entities_ in onUnlock()
@@ -573,7 +704,8 @@ namespace mustache {
         [[nodiscard]] ThreadId threadId() const noexcept;
 
         [[nodiscard]] TemporalStorage& getTemporalStorage() noexcept {
-            static thread_local const auto thread_id = threadId();
+            // not cached: a thread may work for dispatchers of several worlds
+            const auto thread_id = threadId();
             was_temporal_storage_used_.store(true, std::memory_order_relaxed);
             return temporal_storages_[thread_id];
         }
@@ -596,6 +728,8 @@ namespace mustache {
             constexpr bool call_default_constructor = !call_custom_constructor && !std::is_trivially_default_constructible<Component>::value;
             constexpr bool has_event = detail::hasAfterAssign<Component>(nullptr);
             constexpr auto safety = FunctionSafety::kUnsafe;
+            static_assert(!IsSparseComponent<Component>::value,
+                          "Sparse components are not part of archetypes, use assign()");
             if constexpr (call_constructor || has_event) {
                 static const auto component_id = ComponentFactory::instance().registerComponent<Component>();
                 const auto component_index = archetype.getComponentIndex<safety>(component_id);
@@ -631,6 +765,10 @@ namespace mustache {
             return world_version_;
         }
 
+        // getArchetype for the archetype with one component added / removed, cached in Archetype's transition edges
+        Archetype& archetypeWithComponent(Archetype& archetype, ComponentId component);
+        Archetype& archetypeWithoutComponent(Archetype& archetype, ComponentId component);
+
         friend Archetype;
         void updateLocation(Entity e, Archetype* archetype, ArchetypeEntityIndex index) noexcept {
             if (e.id().isValid()) {
@@ -657,9 +795,17 @@ namespace mustache {
 
         uint32_t empty_slots_{0};
         ArrayWrapper<EntityLocationInWorld, EntityId, true> locations_;
-        mustache::set<Entity, std::less<Entity>, Allocator<Entity> > marked_for_delete_;
+        mustache::vector<Entity, Allocator<Entity> > marked_for_delete_;
         WorldId this_world_id_;
         WorldVersion world_version_;
+        uint64_t archetypes_epoch_;
+        ArchetypeIndex compact_cursor_ = ArchetypeIndex::make(0);
+        struct SparseStorageSlot {
+            std::unique_ptr<SparseComponentStorage> storage;
+            bool checked = false; // ComponentInfo::sparse was read for the id
+        };
+        // NOTE: declared before archetypes_, so archetypes are cleared while storages are alive
+        ArrayWrapper<SparseStorageSlot, ComponentId, false> sparse_storages_;
         // TODO: replace shared pointed with some kind of unique_ptr but with deleter calling clearArchetype
         // NOTE: must be the last field(for correct default destructor).
         ArrayWrapper<std::shared_ptr<Archetype>, ArchetypeIndex, true> archetypes_;
@@ -673,6 +819,7 @@ namespace mustache {
         };
         ArchetypeVersionChunkSize archetype_chunk_size_info_;
         mustache::vector<ArchetypeChunkSizeFunction> get_chunk_size_functions_;
+        mustache::vector<ArchetypeColdComponentsFunction> cold_components_functions_;
         const bool enable_version_control_ {false};
     };
 
@@ -743,6 +890,8 @@ namespace mustache {
 
     template<typename... Components>
     Entity EntityManager::create() {
+        static_assert(!(IsSparseComponent<typename ComponentType<Components>::type>::value || ...),
+                      "Sparse components are not part of archetypes, use assign()");
         const auto& factory = ComponentFactory::instance();
         return create(factory.makeMask<Components...>(), factory.makeSharedInfo<Components...>());
     }
@@ -750,13 +899,17 @@ namespace mustache {
     void EntityManager::destroy(Entity entity) {
         if (isLocked()) {
             getTemporalStorage().destroy(entity);
-        } else {
-            marked_for_delete_.insert(entity);
+        } else if (isEntityValid(entity)) {
+            auto& location = locations_[entity.id()];
+            if (!location.marked_for_delete) {
+                location.marked_for_delete = true;
+                marked_for_delete_.push_back(entity);
+            }
         }
     }
 
     bool EntityManager::isMarkedForDestroy(Entity entity) const noexcept {
-        return marked_for_delete_.count(entity) > 0u;
+        return isEntityValid(entity) && locations_[entity.id()].marked_for_delete;
     }
 
     template<FunctionSafety _Safety>
@@ -771,15 +924,26 @@ namespace mustache {
                 return;
             }
         }
-        const auto& location = locations_[entity.id()];
-        if (!location.archetype) {
+        if (!locations_[entity.id()].archetype) {
             return;
         }
         if constexpr (isSafe(_Safety)) {
             // No need to check archetypes_ anymore
         }
+        if (sparse_storages_.size() > 0u) {
+            // sparse beforeRemove hooks see the entity with all its components, they may destroy it themselves
+            destroySparseComponents(entity);
+            if (!isEntityValid(entity) || !locations_[entity.id()].archetype) {
+                return;
+            }
+        }
+        const auto& location = locations_[entity.id()];
         location.archetype->remove(entity, location.index, ComponentIdMask::null());
-        releaseEntityIdUnsafe(entity);
+        if (sparse_storages_.size() > 0u) {
+            // components assigned by hooks of the removed entity
+            eraseSparseComponents(entity.id());
+        }
+        freeEntityIdUnsafe(entity);
     }
 
     template<typename... ARGS>
@@ -812,9 +976,19 @@ namespace mustache {
         }
         const auto& location = locations_[entity.id()];
         ResultType result = nullptr;
+        if (const auto sparse = sparseStorage(component_id); sparse != nullptr) {
+            if (!isSafe(_Safety) || location.entity == entity) {
+                result = sparse->get(entity.id());
+            }
+            return result;
+        }
         if (!isSafe(_Safety) || location.entity == entity) {
             const auto arch = location.archetype;
             const auto ptr_index = arch->getComponentNoMarkDirty(component_id, location.index);
+            if (ptr_index.first == nullptr) {
+                // tag components have no column
+                return static_cast<ResultType>(arch->hasComponent(component_id) ? ComponentInfo::tagData() : nullptr);
+            }
             if constexpr (!_Const) {
                 if ((!isSafe(_Safety) || ptr_index.second.isValid()) && arch->versionControlEnabled(ptr_index.second)) {
                     arch->markComponentDirty(ptr_index.second, location.index, world_version_);
@@ -851,6 +1025,22 @@ namespace mustache {
         return static_cast<const T*>(ptr);
     }
 
+    template<typename T>
+    void EntityManager::addComponentToAll(const ComponentIdMask& required, const ComponentIdMask& exclude) {
+        static_assert(!isComponentShared<T>(), "Component is shared, bulk assign supports unique components only");
+        static_assert(!IsSparseComponent<T>::value, "Bulk assign supports archetype components only");
+        static const auto component_id = ComponentFactory::instance().registerComponent<T>();
+        addComponentToAll(component_id, required, exclude);
+    }
+
+    template<typename T>
+    void EntityManager::removeComponentFromAll(const ComponentIdMask& required, const ComponentIdMask& exclude) {
+        static_assert(!isComponentShared<T>(), "Component is shared, bulk remove supports unique components only");
+        static_assert(!IsSparseComponent<T>::value, "Bulk remove supports archetype components only");
+        static const auto component_id = ComponentFactory::instance().registerComponent<T>();
+        removeComponentFromAll(component_id, required, exclude);
+    }
+
     template<typename T, FunctionSafety _Safety>
     bool EntityManager::removeSharedComponent(Entity entity) {
         static const auto component_id = ComponentFactory::instance().registerSharedComponent<T>();
@@ -877,14 +1067,24 @@ namespace mustache {
     template<bool _SkipConstructor>
     void* EntityManager::assign(Entity e, ComponentId component_id) {
         if (!isLocked()) {
+            if (const auto sparse = sparseStorageOf(component_id); sparse != nullptr) {
+                return sparse->assign(world_, e, _SkipConstructor);
+            }
             const auto& location = locations_[e.id()];
             auto& prev_arch = *location.archetype;
-            ComponentIdMask mask = prev_arch.mask_;
-            mask.add(component_id);
-            auto& arch = getArchetype(mask, prev_arch.sharedComponentInfo());
+            auto& arch = archetypeWithComponent(prev_arch, component_id);
             const auto prev_index = location.index;
-            arch.externalMove(e, prev_arch, prev_index, _SkipConstructor ? mask : ComponentIdMask::null());
-            const auto component_index = arch.getComponentIndex<FunctionSafety::kUnsafe>(component_id);
+            if constexpr (_SkipConstructor) {
+                ComponentIdMask mask = prev_arch.mask_;
+                mask.add(component_id);
+                arch.externalMove(e, prev_arch, prev_index, mask);
+            } else {
+                arch.externalMove(e, prev_arch, prev_index, ComponentIdMask::null());
+            }
+            const auto component_index = arch.getComponentIndex(component_id);
+            if (component_index.isNull()) {
+                return ComponentInfo::tagData();
+            }
             return arch.getComponent<FunctionSafety::kUnsafe>(component_index, location.index);
         } else {
             return getTemporalStorage().assignComponent(world_, e, component_id, _SkipConstructor);
@@ -898,7 +1098,10 @@ namespace mustache {
         auto component_ptr = assign<use_custom_constructor>(e, component_id);
         if constexpr(use_custom_constructor) {
             component_ptr = static_cast<void*>(new(component_ptr) T{std::forward<_ARGS>(args)...});
-            ComponentInfo::afterComponentAssign<T>(component_ptr, e, world_);
+            if (!isLocked()) {
+                // the hook of a recorded component is called when the command is applied
+                ComponentInfo::afterComponentAssign<T>(component_ptr, e, world_);
+            }
         }
         return *reinterpret_cast<T*>(component_ptr);
     }
@@ -943,6 +1146,11 @@ namespace mustache {
                 return false;
             }
         }
+        if constexpr (std::is_same_v<_ComponentId, ComponentId>) {
+            if (const auto sparse = sparseStorage(id); sparse != nullptr) {
+                return sparse->has(entity.id());
+            }
+        }
         const auto& location = locations_[entity.id()];
         if (location.archetype == nullptr) {
             return false;
@@ -951,6 +1159,30 @@ namespace mustache {
         return archetype.hasComponent(id);
     }
 
+    template<FunctionSafety _Safety>
+    void EntityManager::setEnabled(Entity entity, bool enabled) noexcept {
+        if constexpr (isSafe(_Safety)) {
+            if (!isEntityValid(entity)) {
+                return;
+            }
+        }
+        const auto& location = locations_[entity.id()];
+        if (location.archetype != nullptr) {
+            location.archetype->setEnabled(location.index, enabled);
+        }
+    }
+
+    template<FunctionSafety _Safety>
+    bool EntityManager::isEnabled(Entity entity) const noexcept {
+        if constexpr (isSafe(_Safety)) {
+            if (!isEntityValid(entity)) {
+                return false;
+            }
+        }
+        const auto& location = locations_[entity.id()];
+        return location.archetype == nullptr || location.archetype->isEnabled(location.index);
+    }
+
     template<typename T, FunctionSafety _Safety>
     bool EntityManager::hasComponent(Entity entity) const noexcept {
         if constexpr (isComponentShared<T>()) {
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <mustache/ecs/job.hpp>
+
+#include <algorithm>
+#include <tuple>
+
+namespace mustache {
+
+    /**
+     * Runs several PerEntityJobs in one pass: every block of entities is passed to all matching stages in order,
+     * so later stages see the writes of earlier stages while the block is still in cache.
+     * Entities and updated component versions are the same as for separate runs of the stages,
+     * stage checkMask, extraChunkFilterCheck, reductions and task/job hooks are not used, override them in FusedJob.
+     */
+    template<typename... _Stages>
+    class FusedJob : public BaseJob {
+    public:
+        static_assert(sizeof...(_Stages) > 0u, "FusedJob needs at least one stage");
+        static constexpr size_t stages_count = sizeof...(_Stages);
+
+        FusedJob() {
+            // only archetypes that match at least one stage are visited, see extraArchetypeFilterCheck
+            filter_result_.mask = JobInfo<std::tuple_element_t<0, std::tuple<_Stages...> > >::componentMask();
+            ((filter_result_.mask = filter_result_.mask.intersection(JobInfo<_Stages>::componentMask())), ...);
+            filter_result_.exclude_mask = JobInfo<std::tuple_element_t<0, std::tuple<_Stages...> > >::excludeMask();
+            ((filter_result_.exclude_mask = filter_result_.exclude_mask.intersection(JobInfo<_Stages>::excludeMask())), ...);
+            SharedComponentIdMask shared_mask = JobInfo<std::tuple_element_t<0, std::tuple<_Stages...> > >::sharedComponentMask();
+            ((shared_mask = shared_mask.intersection(JobInfo<_Stages>::sharedComponentMask())), ...);
+            filter_result_.shared_component_mask = shared_mask;
+        }
+
+        template<size_t _I>
+        [[nodiscard]] auto& stage() noexcept {
+            return std::get<_I>(stages_);
+        }
+
+        template<typename _Stage>
+        [[nodiscard]] _Stage& stage() noexcept {
+            return std::get<_Stage>(stages_);
+        }
+
+        ComponentIdMask checkMask() const noexcept override {
+            return ComponentIdMask::null();
+        }
+
+        ComponentIdMask updateMask() const noexcept override {
+            return mergedMask([](const auto& stage) {
+                return stage.updateMask();
+            });
+        }
+
+        ComponentIdMask archetypeUpdateMask(const Archetype& archetype, const ComponentIdMask&) const noexcept override {
+            ComponentIdMask result;
+            const auto merge_stage = [&result, &archetype](const auto& stage) {
+                if (stage.isArchetypeMatch(archetype)) {
+                    result = result.merge(stage.updateMask());
+                }
+            };
+            std::apply([&merge_stage](const auto&... stage) {
+                (merge_stage(stage), ...);
+            }, stages_);
+            return result;
+        }
+
+        bool isComponentAccessDeclared() const noexcept override {
+            return std::apply([](const auto&... stage) {
+                return (stage.isComponentAccessDeclared() && ...);
+            }, stages_);
+        }
+
+        ComponentIdMask readMask() const noexcept override {
+            return mergedMask([](const auto& stage) {
+                return stage.readMask();
+            });
+        }
+
+        ComponentIdMask writeMask() const noexcept override {
+            return mergedMask([](const auto& stage) {
+                return stage.writeMask();
+            });
+        }
+
+        bool extraArchetypeFilterCheck(const Archetype& archetype) const noexcept override {
+            return std::apply([&archetype](const auto&... stage) {
+                return (stage.isArchetypeMatch(archetype) || ...);
+            }, stages_);
+        }
+
+        const char* nameCStr() const noexcept override {
+            static const auto name = type_name<FusedJob>();
+            return name.c_str();
+        }
+
+        void singleTask(World& world, ArchetypeGroup archetype_group, JobInvocationIndex invocation_index) override {
+            std::array<bool, stages_count> is_stage_match;
+            for (const auto& info : archetype_group) {
+                auto& archetype = *info.archetype();
+                matchStages(archetype, is_stage_match, std::make_index_sequence<stages_count>());
+                for (auto array : ArrayView::make(filter_result_, info.archetype_index,
+                                                  info.first_entity, info.current_size)) {
+                    auto index = array.entityIndex();
+                    uint32_t rest = array.arraySize().toInt();
+                    while (rest > 0u) {
+                        const auto size = std::min(rest, block_size);
+                        runStages(world, archetype, is_stage_match, index, ComponentArraySize::make(size),
+                                  invocation_index, std::make_index_sequence<stages_count>());
+                        invocation_index.entity_index_in_task =
+                                ParallelTaskItemIndexInTask::make(invocation_index.entity_index_in_task.toInt() + size);
+                        invocation_index.entity_index =
+                                ParallelTaskGlobalItemIndex::make(invocation_index.entity_index.toInt() + size);
+                        index = ArchetypeEntityIndex::make(index.toInt() + size);
+                        rest -= size;
+                    }
+                }
+            }
+        }
+
+    private:
+        static constexpr uint32_t blockSize() noexcept {
+            constexpr size_t target_block_bytes = 16u * 1024u;
+            const size_t entity_size = std::max(static_cast<size_t>(1u),
+                    (JobInfo<_Stages>::FunctionInfo::totalUniqueComponentsSize() + ...));
+            return static_cast<uint32_t>(std::max(static_cast<size_t>(16u), target_block_bytes / entity_size));
+        }
+        // entities passed to the stages at once, all stage components of a block fit in L1 cache
+        static constexpr uint32_t block_size = blockSize();
+
+        template<typename _F>
+        ComponentIdMask mergedMask(_F&& get_mask) const {
+            ComponentIdMask result;
+            std::apply([&result, &get_mask](const auto&... stage) {
+                ((result = result.merge(get_mask(stage))), ...);
+            }, stages_);
+            return result;
+        }
+
+        template<size_t... _I>
+        void matchStages(const Archetype& archetype, std::array<bool, stages_count>& is_stage_match,
+                         const std::index_sequence<_I...>&) const noexcept {
+            ((is_stage_match[_I] = std::get<_I>(stages_).isArchetypeMatch(archetype)), ...);
+        }
+
+        template<size_t... _I>
+        void runStages(World& world, Archetype& archetype, const std::array<bool, stages_count>& is_stage_match,
+                       ArchetypeEntityIndex first, ComponentArraySize size, JobInvocationIndex invocation_index,
+                       const std::index_sequence<_I...>&) {
+            ((is_stage_match[_I] ? std::get<_I>(stages_).runForArray(world, archetype, first, size, invocation_index)
+                                 : void()), ...);
+        }
+
+        std::tuple<_Stages...> stages_;
+    };
+}
@@ -2,6 +2,7 @@
 
 #include <mustache/ecs/world.hpp>
 #include <mustache/ecs/base_job.hpp>
+#include <mustache/ecs/job_reduction.hpp>
 #include <mustache/ecs/task_view.hpp>
 #include <mustache/ecs/world_filter.hpp>
 #include <mustache/ecs/entity_manager.hpp>
@@ -42,6 +43,14 @@ namespace mustache {
                 ++invocation_index.entity_index;
             }
         }
+        MUSTACHE_INLINE static void incInvocationIndex(JobInvocationIndex& invocation_index, uint32_t count) noexcept {
+            if constexpr(Info::FunctionInfo::Position::job_invocation >= 0) {
+                invocation_index.entity_index_in_task =
+                        ParallelTaskItemIndexInTask::make(invocation_index.entity_index_in_task.toInt() + count);
+                invocation_index.entity_index =
+                        ParallelTaskGlobalItemIndex::make(invocation_index.entity_index.toInt() + count);
+            }
+        }
 
         template<size_t _I>
         static auto getComponentHandler(Archetype& archetype, ArchetypeEntityIndex index, ComponentIndex component) noexcept {
@@ -49,7 +58,20 @@ namespace mustache {
 
             using ArgType = typename Info::FunctionInfo::template UniqueComponentType<_I>::type;
             using Component = typename ComponentType<ArgType>::type;
-            if constexpr (IsComponentRequired<ArgType>::value) {
+            if constexpr (IsSparseComponent<Component>::value) {
+                static const auto id = ComponentFactory::instance().registerComponent<Component>();
+                const auto storage = archetype.world().entities().sparseStorage(id);
+                return SparseComponentHandler<Component, IsComponentRequired<ArgType>::value> {
+                        storage, archetype.entityAt<Safety>(index)
+                };
+            } else if constexpr (isTagComponent<Component>()) {
+                constexpr bool is_required = IsComponentRequired<ArgType>::value;
+                static const auto id = ComponentFactory::instance().registerComponent<Component>();
+                const bool has_tag = is_required || archetype.hasComponent(id);
+                return TagComponentHandler<Component, is_required> {
+                        static_cast<Component*>(has_tag ? ComponentInfo::tagData() : nullptr)
+                };
+            } else if constexpr (IsComponentRequired<ArgType>::value) {
                 auto ptr = archetype.getData<Safety>(component, index);
                 return RequiredComponent<Component> {reinterpret_cast<Component*>(ptr)};
             } else {
@@ -69,6 +91,10 @@ namespace mustache {
         template<size_t _I>
         static auto getComponentIndex(const Archetype& archetype, ComponentId id) noexcept {
             using ArgType = typename Info::FunctionInfo::template UniqueComponentType<_I>::type;
+            using Component = typename ComponentType<ArgType>::type;
+            if constexpr (IsSparseComponent<Component>::value || isTagComponent<Component>()) {
+                return ComponentIndex::null();
+            }
             constexpr bool is_required = IsComponentRequired<ArgType>::value;
             constexpr auto Safety = is_required ? FunctionSafety::kUnsafe : FunctionSafety::kSafe;
             return archetype.getComponentIndex<Safety>(id);
@@ -81,11 +107,29 @@ namespace mustache {
                     typename FunctionInfo::template UniqueComponentType<_I>::type>::is_component_mutable;
         }
 
+        // sparse and tag components have no chunk versions
+        template<size_t _I>
+        constexpr static bool isArchetypeComponentMutable() {
+            using FunctionInfo = typename Info::FunctionInfo;
+            using Component = typename ComponentType<typename FunctionInfo::template UniqueComponentType<_I>::type>::type;
+            return isComponentMutable<_I>() && !IsSparseComponent<Component>::value && !isTagComponent<Component>();
+        }
+
+        template<typename _Handler>
+        MUSTACHE_INLINE static bool hasComponentAt([[maybe_unused]] const _Handler& handler,
+                                                   [[maybe_unused]] size_t i) noexcept {
+            if constexpr (IsRequiredSparseHandler<_Handler>::value) {
+                return handler.has(i);
+            } else {
+                return true;
+            }
+        }
+
         template<size_t... _I>
         static void updateVersion(WorldVersion version, Archetype& archetype,
                                   const std::array<ComponentIndex, sizeof...(_I)>& component_indexes) noexcept {
             static constexpr std::array<bool, sizeof...(_I)> is_mutable = {
-                    isComponentMutable<_I>()...
+                    isArchetypeComponentMutable<_I>()...
             };
             const auto last_chunk = ChunkIndex::make(archetype.chunkCount());
             for (auto chunk = ChunkIndex::make(0); chunk != last_chunk; ++chunk) {
@@ -120,10 +164,20 @@ namespace mustache {
                                     [[maybe_unused]] JobInvocationIndex& invocation_index,
                                     [[maybe_unused]] size_t count,
                                     [[maybe_unused]] _ARGS&& __restrict... args) {
-            MUSTACHE_UNROLL(4)
-            for (size_t i = 0u; i < count; ++i) {
-                invoke(function, world, invocation_index, args[i]...);
-                incInvocationIndex(invocation_index);
+            if constexpr ((IsRequiredSparseHandler<std::decay_t<_ARGS> >::value || ...)) {
+                // entities without required sparse components are skipped
+                for (size_t i = 0u; i < count; ++i) {
+                    if ((hasComponentAt(args, i) && ...)) {
+                        invoke(function, world, invocation_index, ArgFilterTag{}, args[i]...);
+                    }
+                    incInvocationIndex(invocation_index);
+                }
+            } else {
+                MUSTACHE_UNROLL(4)
+                for (size_t i = 0u; i < count; ++i) {
+                    invoke(function, world, invocation_index, ArgFilterTag{}, args[i]...);
+                    incInvocationIndex(invocation_index);
+                }
             }
         }
     };
@@ -135,6 +189,8 @@ namespace mustache {
 
         PerEntityJob() {
             filter_result_.mask = Info::componentMask();
+            filter_result_.exclude_mask = Info::excludeMask();
+            filter_result_.any_mask = Info::anyMask();
             filter_result_.shared_component_mask = Info::sharedComponentMask();
         }
 
@@ -146,6 +202,19 @@ namespace mustache {
             return Info::updateMask();
         }
 
+        bool isComponentAccessDeclared() const noexcept override {
+            return true;
+        }
+
+        ComponentIdMask readMask() const noexcept override {
+            // optional components are read too, so they must order the job against their writers
+            return Info::accessMask();
+        }
+
+        ComponentIdMask writeMask() const noexcept override {
+            return Info::updateMask();
+        }
+
         virtual const char* nameCStr() const noexcept override {
             static const auto job_type_name = type_name<T>();
             static const auto result = job_type_name.c_str();
@@ -158,54 +227,151 @@ namespace mustache {
             singleTask(world, task, invocation_index, unique_components, shared_components);
         }
 
+        // calls the job function for size entities of the archetype starting from first,
+        // entities must be in one component array (see Archetype::distToChunkEnd), no version is updated
+        void runForArray(World& world, Archetype& archetype, ArchetypeEntityIndex first, ComponentArraySize size,
+                         JobInvocationIndex invocation_index) {
+            static constexpr auto unique_components = std::make_index_sequence<Info::FunctionInfo::components_count>();
+            static constexpr auto shared_components = std::make_index_sequence<Info::FunctionInfo::shared_components_count>();
+            runForArray(world, archetype, first, size, invocation_index, unique_components, shared_components);
+        }
+
     protected:
         template<typename... _ARGS>
-        MUSTACHE_INLINE void forEachArrayGenerated(World& world, ComponentArraySize count,
-                                                   JobInvocationIndex& invocation_index,
+        MUSTACHE_INLINE void forEachLaneGenerated(World& world, ArchetypeEntityIndex first_entity,
+                                                  ComponentArraySize count, JobInvocationIndex& invocation_index,
+                                                  _ARGS... pointers) noexcept(Info::is_noexcept) {
+            using TargetType = typename std::conditional<Info ::is_const_this, const T, T>::type;
+            using FunctionInfo = typename Info::FunctionInfo;
+            using LaneMaskArg = typename FunctionInfo::FC::template arg<FunctionInfo::Position::array_size>::type;
+            using Mask = std::remove_cv_t<std::remove_reference_t<LaneMaskArg> >;
+            constexpr uint32_t width = Mask::width;
+            TargetType& self = *static_cast<TargetType*>(this);
+            uint32_t rest = count.toInt();
+
+            // partial head lane, so full lanes start at archetype index multiple of width (aligned column address)
+            const uint32_t misalignment = first_entity.toInt() % width;
+            if (misalignment != 0u && rest > 0u) {
+                const uint32_t head = std::min(rest, width - misalignment);
+                invokeMethod(self, &T::forEachLane, world, Mask{head}, invocation_index, ArgFilterTag{}, pointers...);
+                JobHelper<T>::incPtrsRuntimeCount(head, pointers...);
+                JobHelper<T>::incInvocationIndex(invocation_index, head);
+                rest -= head;
+            }
+            for (; rest >= width; rest -= width) {
+                invokeMethod(self, &T::forEachLane, world, Mask{}, invocation_index, ArgFilterTag{}, pointers...);
+                JobHelper<T>::template incPtrs<width>(pointers...);
+                JobHelper<T>::incInvocationIndex(invocation_index, width);
+            }
+            if (rest > 0u) {
+                invokeMethod(self, &T::forEachLane, world, Mask{rest}, invocation_index, ArgFilterTag{}, pointers...);
+                JobHelper<T>::incInvocationIndex(invocation_index, rest);
+            }
+        }
+
+        template<typename... _ARGS>
+        MUSTACHE_INLINE void forEachArrayGenerated(World& world, [[maybe_unused]] ArchetypeEntityIndex first_entity,
+                                                   ComponentArraySize count, JobInvocationIndex& invocation_index,
                                                    _ARGS... pointers) noexcept(Info::is_noexcept) {
             using TargetType = typename std::conditional<Info ::is_const_this, const T, T>::type;
             TargetType& self = *static_cast<TargetType*>(this);
+            static_assert(!Info::has_sparse_components || !(Info::has_for_each_array || Info::has_for_each_lane),
+                          "Sparse components are not stored in arrays, use operator()");
             if constexpr (Info::has_for_each_array) {
-                invokeMethod(self, &T::forEachArray, world, count, invocation_index, pointers...);
+                invokeMethod(self, &T::forEachArray, world, count, invocation_index, ArgFilterTag{}, pointers...);
+            } else if constexpr (Info::has_for_each_lane) {
+                forEachLaneGenerated(world, first_entity, count, invocation_index, pointers...);
             } else {
                 JobHelper<TargetType>::template forEachInArrays<_Unroll>(world, self, invocation_index, count.toInt(), pointers...);
             }
         }
+        template<size_t... _I>
+        static const std::array<ComponentId, sizeof...(_I)>& uniqueComponentIds(const std::index_sequence<_I...>&) {
+            static const std::array<ComponentId, sizeof...(_I)> ids {
+                    ComponentFactory::instance().registerComponent<typename ComponentType<typename Info::FunctionInfo::
+                    template UniqueComponentType<_I>::type>::type>()...
+            };
+            return ids;
+        }
+
+        template<typename _Shared, size_t... _I, size_t... _SI>
+        MUSTACHE_INLINE void forEachInArray(World& world, Archetype& archetype,
+                                            const std::array<ComponentIndex, sizeof...(_I)>& component_indexes,
+                                            const _Shared& shared_components, ArchetypeEntityIndex index_in_archetype,
+                                            ComponentArraySize size, JobInvocationIndex& invocation_index,
+                                            const std::index_sequence<_I...>& unique, const std::index_sequence<_SI...>& shared) {
+            if (archetype.disabledCount() == 0u) {
+                forEachInRun(world, archetype, component_indexes, shared_components, index_in_archetype, size,
+                             invocation_index, unique, shared);
+                return;
+            }
+            // disabled entities are skipped by runs, invocation index still counts them
+            uint32_t processed = index_in_archetype.toInt();
+            archetype.forEachEnabledRun(index_in_archetype, size.toInt(), [&](ArchetypeEntityIndex first, uint32_t count) {
+                JobHelper<T>::incInvocationIndex(invocation_index, first.toInt() - processed);
+                forEachInRun(world, archetype, component_indexes, shared_components, first,
+                             ComponentArraySize::make(count), invocation_index, unique, shared);
+                processed = first.toInt() + count;
+            });
+            JobHelper<T>::incInvocationIndex(invocation_index, index_in_archetype.toInt() + size.toInt() - processed);
+        }
+
+        template<typename _Shared, size_t... _I, size_t... _SI>
+        MUSTACHE_INLINE void forEachInRun(World& world, Archetype& archetype,
+                                          const std::array<ComponentIndex, sizeof...(_I)>& component_indexes,
+                                          const _Shared& shared_components, ArchetypeEntityIndex index_in_archetype,
+                                          ComponentArraySize size, JobInvocationIndex& invocation_index,
+                                          const std::index_sequence<_I...>&, const std::index_sequence<_SI...>&) {
+            if constexpr (Info::FunctionInfo::Position::entity >= 0) {
+                forEachArrayGenerated(world, index_in_archetype, size, invocation_index,
+                                      RequiredComponent<Entity>(archetype.entityAt<FunctionSafety::kUnsafe>(index_in_archetype)),
+                                      JobHelper<T>::template getComponentHandler<_I>(archetype, index_in_archetype, component_indexes[_I])...,
+                                      JobHelper<T>::makeShared(std::get<_SI>(shared_components))...);
+            } else {
+                forEachArrayGenerated(world, index_in_archetype, size, invocation_index,
+                                      JobHelper<T>::template getComponentHandler<_I>(archetype, index_in_archetype, component_indexes[_I])...,
+                                      JobHelper<T>::makeShared(std::get<_SI>(shared_components))...);
+            }
+        }
+
         template<size_t... _I, size_t... _SI>
         MUSTACHE_INLINE void singleTask(World& world, ArchetypeGroup archetype_group, JobInvocationIndex invocation_index,
-                                        const std::index_sequence<_I...>&, const std::index_sequence<_SI...>&) {
+                                        const std::index_sequence<_I...>& unique, const std::index_sequence<_SI...>& shared) {
             auto shared_components = std::make_tuple(
                     JobHelper<T>::template getNullptr<_SI>()...
             );
+            const auto& ids = uniqueComponentIds(unique);
             for (const auto& info : archetype_group) {
                 auto& archetype = *info.archetype();
                 archetype.getSharedComponents(shared_components);
-                static const std::array<ComponentId, sizeof...(_I)> ids {
-                        ComponentFactory::instance().registerComponent<typename ComponentType<typename Info::FunctionInfo::
-                        template UniqueComponentType<_I>::type>::type>()...
-                };
                 std::array<ComponentIndex, sizeof...(_I)> component_indexes {
                         archetype.getComponentIndex(ids[_I])...
                 };
 
                 for (auto array : ArrayView::make(filter_result_, info.archetype_index,
                                                   info.first_entity, info.current_size)) {
-
-                    const auto index_in_archetype = array.entityIndex();
-                    if constexpr (Info::FunctionInfo::Position::entity >= 0) {
-                        forEachArrayGenerated(world, array.arraySize(), invocation_index,
-                                              RequiredComponent<Entity>(archetype.entityAt<FunctionSafety::kUnsafe>(index_in_archetype)),
-                                              JobHelper<T>::template getComponentHandler<_I>(archetype, index_in_archetype, component_indexes[_I])...,
-                                              JobHelper<T>::makeShared(std::get<_SI>(shared_components))...);
-                    } else {
-                        forEachArrayGenerated(world, array.arraySize(), invocation_index,
-                                              JobHelper<T>::template getComponentHandler<_I>(archetype, index_in_archetype, component_indexes[_I])...,
-                                              JobHelper<T>::makeShared(std::get<_SI>(shared_components))...);
-                    }
+                    forEachInArray(world, archetype, component_indexes, shared_components, array.entityIndex(),
+                                   array.arraySize(), invocation_index, unique, shared);
                 }
             }
         }
 
+        template<size_t... _I, size_t... _SI>
+        MUSTACHE_INLINE void runForArray(World& world, Archetype& archetype, ArchetypeEntityIndex first,
+                                         ComponentArraySize size, JobInvocationIndex& invocation_index,
+                                         const std::index_sequence<_I...>& unique, const std::index_sequence<_SI...>& shared) {
+            auto shared_components = std::make_tuple(
+                    JobHelper<T>::template getNullptr<_SI>()...
+            );
+            archetype.getSharedComponents(shared_components);
+            const auto& ids = uniqueComponentIds(unique);
+            const std::array<ComponentIndex, sizeof...(_I)> component_indexes {
+                    archetype.getComponentIndex(ids[_I])...
+            };
+            forEachInArray(world, archetype, component_indexes, shared_components, first, size,
+                           invocation_index, unique, shared);
+        }
+
     };
     // task with no filter stage, single thread only
     template<typename _Function, JobUnroll _Unroll = JobUnroll::kAuto>
@@ -217,6 +383,8 @@ namespace mustache {
         using Info = JobInfo<_Function>;
         ComponentFactory* factory;
         ComponentIdMask component_id_mask;
+        ComponentIdMask exclude_mask = Info::excludeMask();
+        ComponentIdMask any_mask = Info::anyMask();
         uint32_t max_task_size = 0;
         double gb_per_second = 0.0;
         uint32_t calibrations_done = 0;
@@ -296,7 +464,7 @@ namespace mustache {
                 const auto archetype_index = ArchetypeIndex::make(ai);
                 auto& arch = entities.getArchetype<Safety>(archetype_index);
                 auto entities_to_process = arch.size();
-                if (entities_to_process  < 1 || !arch.isMatch(component_id_mask)) {
+                if (entities_to_process  < 1 || !arch.isMatch(component_id_mask, exclude_mask, any_mask)) {
                     continue;
                 }
                 if (!was_locked) {
@@ -316,16 +484,26 @@ namespace mustache {
                 constexpr size_t total_components_size = std::max(static_cast<size_t>(1ull), FunctionInfo::totalUniqueComponentsSize());
                 constexpr size_t bytes_to_calibrate = 4 * MemoryManager::page_size;
                 constexpr size_t entities_to_calibrate = bytes_to_calibrate / total_components_size;
+                const auto make_handlers = [&](ArchetypeEntityIndex index) {
+                    return std::make_tuple(arch.entityAt<safety>(index),
+                                           JobHelper<_Function>::template getComponentHandler<_I>(arch, index, component_indexes[_I])...,
+                                           JobHelper<_Function>::makeShared(std::get<_SI>(shared_components))...);
+                };
                 while (entities_to_process > 0) {
-
-                    auto handlers = std::make_tuple(arch.entityAt<safety>(cur_index),
-                                                    JobHelper<_Function>::template getComponentHandler<_I>(arch, cur_index, component_indexes[_I])...,
-                                                    JobHelper<_Function>::makeShared(std::get<_SI>(shared_components))...);
                     const auto chunk_size = arch.distToChunkEnd(cur_index);
-                    if (max_task_size != 0 || chunk_size < entities_to_calibrate) {
-                        invokeForTasksInChunk(world, function, invocation_index, chunk_size, handlers, handlers_is);
+                    if (arch.disabledCount() > 0u) {
+                        // disabled entities are skipped by runs, invocation index still counts them
+                        uint32_t processed = cur_index.toInt();
+                        arch.forEachEnabledRun(cur_index, chunk_size, [&](ArchetypeEntityIndex first, uint32_t count) {
+                            JobHelper<_Function>::incInvocationIndex(invocation_index, first.toInt() - processed);
+                            invokeForTasksInChunk(world, function, invocation_index, count, make_handlers(first), handlers_is);
+                            processed = first.toInt() + count;
+                        });
+                        JobHelper<_Function>::incInvocationIndex(invocation_index, cur_index.toInt() + chunk_size - processed);
+                    } else if (max_task_size != 0 || chunk_size < entities_to_calibrate) {
+                        invokeForTasksInChunk(world, function, invocation_index, chunk_size, make_handlers(cur_index), handlers_is);
                     } else {
-                        invokeForChunkAndCalibrate(world, function, invocation_index, chunk_size, handlers, handlers_is);
+                        invokeForChunkAndCalibrate(world, function, invocation_index, chunk_size, make_handlers(cur_index), handlers_is);
                     }
                     entities_to_process -= chunk_size;
                     cur_index = ArchetypeEntityIndex::make(cur_index.toInt() + chunk_size);
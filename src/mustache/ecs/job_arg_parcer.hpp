@@ -36,9 +36,87 @@ namespace mustache {
         static constexpr bool value = IsOneOfTypes<T, JobInvocationIndex, const JobInvocationIndex&>::value;
     };
 
+    // active elements of a fixed-width lane for Job::forEachLane, partial lanes are active from 0 to count
+    template<uint32_t _Width>
+    struct LaneMask {
+        static_assert(_Width > 0u && (_Width & (_Width - 1u)) == 0u, "lane width must be a power of two");
+        static constexpr uint32_t width = _Width;
+        uint32_t count = _Width;
+
+        [[nodiscard]] constexpr bool isFull() const noexcept {
+            return count == _Width;
+        }
+        [[nodiscard]] constexpr bool isActive(uint32_t lane) const noexcept {
+            return lane < count;
+        }
+    };
+
+    template <typename T>
+    struct IsLaneMask {
+        static constexpr bool value = false;
+    };
+
+    template <uint32_t _Width>
+    struct IsLaneMask<LaneMask<_Width> > {
+        static constexpr bool value = true;
+    };
+
+    template <typename T>
+    struct IsArgLaneMask {
+        static constexpr bool value = IsLaneMask<std::remove_cv_t<std::remove_reference_t<T> > >::value;
+    };
+
     template <typename T>
     struct IsArgComponentArraySize {
-        static constexpr bool value = IsOneOfTypes<T, ComponentArraySize, const ComponentArraySize&>::value;
+        static constexpr bool value = IsOneOfTypes<T, ComponentArraySize, const ComponentArraySize&>::value ||
+                IsArgLaneMask<T>::value;
+    };
+
+    // value passed to job functions in place of Without / AnyOf arguments
+    struct ArgFilterTag {};
+
+    // job argument marker: entities with any of the components are skipped
+    template<typename... T>
+    struct Without {
+        constexpr Without() noexcept = default;
+        constexpr Without(ArgFilterTag) noexcept {}
+    };
+
+    // job argument marker: entities must have at least one of the components
+    template<typename... T>
+    struct AnyOf {
+        constexpr AnyOf() noexcept = default;
+        constexpr AnyOf(ArgFilterTag) noexcept {}
+    };
+
+    template <typename T>
+    struct ArgFilterMask {
+        static constexpr bool is_filter = false;
+        static void exclude(ComponentIdMask&) noexcept {}
+        static void any(ComponentIdMask&) noexcept {}
+    };
+
+    template <typename... T>
+    struct ArgFilterMask<Without<T...> > {
+        static constexpr bool is_filter = true;
+        static void exclude(ComponentIdMask& mask) noexcept {
+            (mask.set(ComponentFactory::instance().registerComponent<T>(), true), ...);
+        }
+        static void any(ComponentIdMask&) noexcept {}
+    };
+
+    template <typename... T>
+    struct ArgFilterMask<AnyOf<T...> > {
+        static constexpr bool is_filter = true;
+        static void exclude(ComponentIdMask&) noexcept {}
+        static void any(ComponentIdMask& mask) noexcept {
+            (mask.set(ComponentFactory::instance().registerComponent<T>(), true), ...);
+        }
+    };
+
+    template <typename T>
+    struct IsArgFilter {
+        static constexpr bool value = ArgFilterMask<std::remove_cv_t<std::remove_reference_t<T> > >::is_filter;
     };
 
     template <typename T>
@@ -76,7 +154,8 @@ namespace mustache {
                 kEntity = 2,
                 kInvocationIndex = 3,
                 kArraySize = 4,
-                kWorld = 5
+                kWorld = 5,
+                kFilter = 6
             };
             ArgType type;
             uint32_t position;
@@ -103,6 +182,9 @@ namespace mustache {
             if constexpr(IsArgWorld<ArgType>::value) {
                 return ArgInfo(ArgInfo::kWorld, _I, true);
             }
+            if constexpr(IsArgFilter<ArgType>::value) {
+                return ArgInfo(ArgInfo::kFilter, _I, false);
+            }
 
             // Arg is component
             if constexpr (isComponentShared<ArgType>()) {
@@ -339,6 +421,15 @@ namespace mustache {
             return false;
         }
         template<typename C>
+        static constexpr bool testForEachLane(decltype(&C::forEachLane)) noexcept {
+            return true;
+        }
+
+        template<typename C>
+        static constexpr bool testForEachLane(...) noexcept {
+            return false;
+        }
+        template<typename C>
         static constexpr bool testCallOperator(decltype(&C::operator())) noexcept {
             return true;
         }
@@ -351,6 +442,8 @@ namespace mustache {
         static constexpr auto getJobFunctionInfo() noexcept {
             if constexpr (testForEachArray<T>(nullptr)) {
                 return JobFunctionInfo<decltype(&T::forEachArray)>{};
+            } else if constexpr (testForEachLane<T>(nullptr)) {
+                return JobFunctionInfo<decltype(&T::forEachLane)>{};
             } else {
                 return JobFunctionInfo<T>{};
             }
@@ -360,6 +453,9 @@ namespace mustache {
             if constexpr (testForEachArray<T>(nullptr)) {
                 return noexcept(&T::forEachArray);
             }
+            if constexpr (testForEachLane<T>(nullptr)) {
+                return noexcept(&T::forEachLane);
+            }
             if constexpr (testCallOperator<T>(nullptr)) {
                 return noexcept(&T::operator());
             }
@@ -369,6 +465,9 @@ namespace mustache {
             if constexpr (testForEachArray<T>(nullptr)) {
                 return checkConst(&T::forEachArray);
             }
+            if constexpr (testForEachLane<T>(nullptr)) {
+                return checkConst(&T::forEachLane);
+            }
             if constexpr (testCallOperator<T>(nullptr)) {
                 return checkConst(&T::operator());
             }
@@ -393,11 +492,20 @@ namespace mustache {
 
 
         static constexpr bool has_for_each_array = testForEachArray<T>(nullptr);
+        static constexpr bool has_for_each_lane = !has_for_each_array && testForEachLane<T>(nullptr);
         static constexpr bool is_noexcept = isNoexcept();
         static constexpr bool is_const_this = isConstThis();
 
         using FunctionInfo = decltype(getJobFunctionInfo());
 
+        template<size_t... _I>
+        static constexpr bool hasSparseComponents(const std::index_sequence<_I...>&) noexcept {
+            return (IsSparseComponent<typename ComponentType<
+                    typename FunctionInfo::template UniqueComponentType<_I>::type>::type>::value || ...);
+        }
+        static constexpr bool has_sparse_components =
+                hasSparseComponents(std::make_index_sequence<FunctionInfo::components_count>());
+
         template<size_t... _I>
         static ComponentIdMask componentMask(const std::index_sequence<_I...>&) noexcept {
             return ComponentFactory::instance().makeMask<typename FunctionInfo::template UniqueComponentType<_I> ::type...>();
@@ -406,6 +514,37 @@ namespace mustache {
             return componentMask(std::make_index_sequence<FunctionInfo::components_count>());
         }
 
+        template<size_t... _I>
+        static ComponentIdMask sparseMask(const std::index_sequence<_I...>&) noexcept {
+            return ComponentFactory::instance().makeSparseMask<typename FunctionInfo::template UniqueComponentType<_I> ::type...>();
+        }
+        // required and optional sparse components, they are not part of componentMask()
+        static ComponentIdMask sparseMask() noexcept {
+            return sparseMask(std::make_index_sequence<FunctionInfo::components_count>());
+        }
+
+        template<size_t... _I>
+        static ComponentIdMask excludeMask(const std::index_sequence<_I...>&) noexcept {
+            ComponentIdMask result;
+            (ArgFilterMask<std::decay_t<typename FunctionInfo::FC::template arg<_I>::type> >::exclude(result), ...);
+            return result;
+        }
+        // components from Without<...> arguments
+        static ComponentIdMask excludeMask() noexcept {
+            return excludeMask(FunctionInfo::args_indexes);
+        }
+
+        template<size_t... _I>
+        static ComponentIdMask anyMask(const std::index_sequence<_I...>&) noexcept {
+            ComponentIdMask result;
+            (ArgFilterMask<std::decay_t<typename FunctionInfo::FC::template arg<_I>::type> >::any(result), ...);
+            return result;
+        }
+        // components from AnyOf<...> arguments
+        static ComponentIdMask anyMask() noexcept {
+            return anyMask(FunctionInfo::args_indexes);
+        }
+
         template<size_t... _I>
         static SharedComponentIdMask sharedComponentMask(const std::index_sequence<_I...>&) noexcept {
             return ComponentFactory::instance().makeSharedMask<typename FunctionInfo::template SharedComponentType<_I> ::type...>();
@@ -439,6 +578,26 @@ namespace mustache {
                 return updateMask(std::make_index_sequence<FunctionInfo::components_count>());
             }
         }
+
+        template<size_t... _I>
+        static ComponentIdMask accessMask(std::index_sequence<_I...>&&) noexcept {
+            ComponentIdMask result;
+            std::array array {
+                    componentInfo<typename FunctionInfo::template UniqueComponentType<_I> ::type>()...
+            };
+            for (const auto& pair : array) {
+                result.set(pair.first, true);
+            }
+            return result;
+        }
+        // every component argument: required, optional and sparse, const or not
+        static ComponentIdMask accessMask() noexcept {
+            if constexpr (FunctionInfo::components_count < 1) {
+                return ComponentIdMask::null();
+            } else {
+                return accessMask(std::make_index_sequence<FunctionInfo::components_count>());
+            }
+        }
     };
 
 }
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <mustache/utils/memory_manager.hpp>
+#include <mustache/utils/container_vector.hpp>
+
+#include <mustache/ecs/base_job.hpp>
+
+#include <functional>
+
+namespace mustache {
+
+    /**
+     * Per task accumulator of a job, e.g. sum, min/max, histogram or bounding box of components.
+     * Every task owns a cache line padded slot, slots are reset before the job starts
+     * and combined in task order when the job is done.
+     * Result does not depend on JobRunMode for associative and commutative operations,
+     * floating point results are stable for the same task count.
+     */
+    template<typename T, typename Combine = std::plus<T> >
+    class JobReduction : public JobReductionBase {
+    public:
+        JobReduction(BaseJob& job, T identity = T{}, Combine combine = Combine{}):
+                identity_{identity},
+                result_{identity},
+                combine_{std::move(combine)} {
+            job.registerReduction(*this);
+        }
+
+        [[nodiscard]] T& local(ParallelTaskId task) noexcept {
+            return slots_[task.toInt()].value;
+        }
+
+        [[nodiscard]] T& local(const JobInvocationIndex& invocation_index) noexcept {
+            return local(invocation_index.task_index);
+        }
+
+        [[nodiscard]] const T& result() const noexcept {
+            return result_;
+        }
+
+        [[nodiscard]] const T& identity() const noexcept {
+            return identity_;
+        }
+
+        void begin(TasksCount task_count) override {
+            slots_.assign(task_count.toInt(), Slot{identity_});
+        }
+
+        void end() override {
+            result_ = identity_;
+            for (const auto& slot : slots_) {
+                result_ = combine_(result_, slot.value);
+            }
+        }
+
+    private:
+        struct alignas(MemoryManager::cache_line_size) Slot {
+            T value;
+        };
+        mustache::vector<Slot> slots_;
+        T identity_;
+        T result_;
+        Combine combine_;
+    };
+}
@@ -0,0 +1,256 @@
+#include "job_scheduler.hpp"
+
+#include <mustache/utils/profiler.hpp>
+#include <mustache/utils/dispatch.hpp>
+#include <mustache/utils/container_vector.hpp>
+
+#include <mustache/ecs/world.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+using namespace mustache;
+
+namespace {
+    bool isConflict(const BaseJob& lhs, const BaseJob& rhs) noexcept {
+        if (!lhs.isComponentAccessDeclared() || !rhs.isComponentAccessDeclared()) {
+            return true;
+        }
+        const auto lhs_write = lhs.writeMask();
+        const auto rhs_write = rhs.writeMask();
+        return !lhs_write.intersection(rhs.readMask().merge(rhs_write)).isEmpty() ||
+               !rhs_write.intersection(lhs.readMask()).isEmpty();
+    }
+}
+
+struct JobScheduler::Data {
+    struct Node {
+        BaseJob* job = nullptr;
+        JobRunMode mode = JobRunMode::kDefault;
+        mustache::vector<uint32_t> dependents;
+        uint32_t dependency_count = 0u;
+        // length of the longest dependency chain before the job
+        uint32_t level = 0u;
+    };
+    struct ExplicitDependency {
+        const BaseJob* before;
+        const BaseJob* after;
+    };
+
+    // shared with dispatcher tasks: a task may start after the run is over and find no job
+    struct RunState {
+        mustache::vector<uint32_t> ready;
+        std::mutex ready_mutex;
+        std::unique_ptr<std::atomic<uint32_t>[]> pending_dependencies;
+        std::atomic<uint32_t> jobs_left{0u};
+        World* world = nullptr;
+
+        bool popReady(uint32_t& index) {
+            std::lock_guard<std::mutex> lock{ready_mutex};
+            if (ready.empty()) {
+                return false;
+            }
+            index = ready.back();
+            ready.pop_back();
+            return true;
+        }
+    };
+
+    mustache::vector<Node> nodes;
+    mustache::vector<ExplicitDependency> explicit_dependencies;
+    std::shared_ptr<RunState> state;
+    uint32_t levels_count = 0u;
+    WorldVersion base_version;
+    bool is_graph_valid = false;
+
+    uint32_t indexOf(const BaseJob& job) const {
+        for (uint32_t i = 0; i < nodes.size(); ++i) {
+            if (nodes[i].job == &job) {
+                return i;
+            }
+        }
+        throw std::runtime_error("Job is not added to the scheduler");
+    }
+
+    void addEdge(uint32_t before, uint32_t after) {
+        auto& dependents = nodes[before].dependents;
+        for (auto index : dependents) {
+            if (index == after) {
+                return;
+            }
+        }
+        dependents.push_back(after);
+        ++nodes[after].dependency_count;
+    }
+
+    void buildGraph() {
+        MUSTACHE_PROFILER_BLOCK_LVL_1(__FUNCTION__ );
+        for (auto& node : nodes) {
+            node.dependents.clear();
+            node.dependency_count = 0u;
+        }
+        for (uint32_t after = 1; after < nodes.size(); ++after) {
+            for (uint32_t before = 0; before < after; ++before) {
+                if (isConflict(*nodes[before].job, *nodes[after].job)) {
+                    addEdge(before, after);
+                }
+            }
+        }
+        for (const auto& dependency : explicit_dependencies) {
+            const auto before = indexOf(*dependency.before);
+            const auto after = indexOf(*dependency.after);
+            if (before >= after) {
+                throw std::runtime_error("Job dependency contradicts the order jobs were added");
+            }
+            addEdge(before, after);
+        }
+        // edges always go from an earlier job to a later one
+        levels_count = nodes.empty() ? 0u : 1u;
+        for (auto& node : nodes) {
+            node.level = 0u;
+        }
+        for (const auto& node : nodes) {
+            for (auto dependent : node.dependents) {
+                auto& level = nodes[dependent].level;
+                level = std::max(level, node.level + 1u);
+                levels_count = std::max(levels_count, level + 1u);
+            }
+        }
+        state = std::make_shared<RunState>();
+        state->pending_dependencies.reset(new std::atomic<uint32_t>[nodes.size()]);
+        is_graph_valid = true;
+    }
+
+    void pushReady(Dispatcher& dispatcher, uint32_t index) {
+        {
+            std::lock_guard<std::mutex> lock{state->ready_mutex};
+            state->ready.push_back(index);
+        }
+        if (dispatcher.threadCount() < 1u) {
+            return; // the thread which called run() takes all jobs
+        }
+        // some thread picks a ready job, it may be the thread which called run()
+        dispatcher.addParallelTask([this, &dispatcher, run_state = state] {
+            uint32_t job_index = 0u;
+            if (run_state->popReady(job_index)) {
+                runJob(dispatcher, *run_state->world, job_index);
+            }
+        });
+    }
+
+    void runJob(Dispatcher& dispatcher, World& world, uint32_t index) {
+        auto& node = nodes[index];
+        // a job always gets a newer version than jobs it depends on, so it stamps writes that jobs
+        // which read the component before it see in the next run, and does not see its own writes
+        node.job->runScheduled(world, WorldVersion::make(base_version.toInt() + node.level), node.mode);
+        for (auto dependent : node.dependents) {
+            if (state->pending_dependencies[dependent].fetch_sub(1u) == 1u) {
+                pushReady(dispatcher, dependent);
+            }
+        }
+        state->jobs_left.fetch_sub(1u);
+    }
+
+    void run(World& world) {
+        if (!is_graph_valid) {
+            buildGraph();
+        }
+        auto& dispatcher = world.dispatcher();
+        base_version = world.version();
+        state->world = &world;
+        state->jobs_left = static_cast<uint32_t>(nodes.size());
+        for (uint32_t i = 0; i < nodes.size(); ++i) {
+            state->pending_dependencies[i] = nodes[i].dependency_count;
+        }
+        for (uint32_t i = 0; i < nodes.size(); ++i) {
+            if (nodes[i].dependency_count < 1u) {
+                pushReady(dispatcher, i);
+            }
+        }
+        while (state->jobs_left.load() > 0u) {
+            uint32_t job_index = 0u;
+            if (state->popReady(job_index)) {
+                runJob(dispatcher, world, job_index);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+JobScheduler::JobScheduler():
+        data_{new Data} {
+
+}
+
+JobScheduler::~JobScheduler() = default;
+
+JobScheduler::JobScheduler(JobScheduler&&) noexcept = default;
+JobScheduler& JobScheduler::operator=(JobScheduler&&) noexcept = default;
+
+void JobScheduler::addJob(BaseJob& job, JobRunMode mode) {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+    auto& node = data_->nodes.emplace_back();
+    node.job = &job;
+    node.mode = mode;
+    data_->is_graph_valid = false;
+}
+
+void JobScheduler::addDependency(const BaseJob& before, const BaseJob& after) {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+    data_->explicit_dependencies.push_back({&before, &after});
+    data_->is_graph_valid = false;
+}
+
+void JobScheduler::clear() noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+    data_->nodes.clear();
+    data_->explicit_dependencies.clear();
+    data_->is_graph_valid = false;
+}
+
+uint32_t JobScheduler::jobCount() const noexcept {
+    return static_cast<uint32_t>(data_->nodes.size());
+}
+
+bool JobScheduler::dependsOn(uint32_t after, uint32_t before) const {
+    if (!data_->is_graph_valid) {
+        data_->buildGraph();
+    }
+    if (before >= after || after >= data_->nodes.size()) {
+        return false;
+    }
+    mustache::vector<bool> visited(data_->nodes.size(), false);
+    mustache::vector<uint32_t> stack{before};
+    while (!stack.empty()) {
+        const auto current = stack.back();
+        stack.pop_back();
+        for (auto dependent : data_->nodes[current].dependents) {
+            if (dependent == after) {
+                return true;
+            }
+            if (!visited[dependent]) {
+                visited[dependent] = true;
+                stack.push_back(dependent);
+            }
+        }
+    }
+    return false;
+}
+
+void JobScheduler::run(World& world) {
+    MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
+    if (data_->nodes.empty()) {
+        return;
+    }
+    world.entities().lock();
+    data_->run(world);
+    // every dependency level used its own version
+    for (uint32_t i = 0; i < data_->levels_count; ++i) {
+        world.incrementVersion();
+    }
+    world.entities().unlock();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <mustache/utils/uncopiable.hpp>
+
+#include <mustache/ecs/base_job.hpp>
+
+#include <cstdint>
+#include <memory>
+
+namespace mustache {
+    class World;
+
+    /**
+     * Runs a set of jobs once per call to run(), builds a dependency graph from the components they read and write.
+     * Jobs that do not conflict run concurrently on the world dispatcher, conflicting jobs run in the order
+     * they were added. A job conflicts with an earlier one if either of them writes a component the other one touches.
+     * The EntityManager stays locked for the whole run. Every dependency level uses its own world version,
+     * so a job which writes a component after another job read it is seen by the change filter of the reader.
+     */
+    class MUSTACHE_EXPORT JobScheduler : public Uncopiable {
+    public:
+        JobScheduler();
+        ~JobScheduler();
+
+        JobScheduler(JobScheduler&&) noexcept;
+        JobScheduler& operator=(JobScheduler&&) noexcept;
+
+        // the job must outlive the scheduler or be removed with clear()
+        void addJob(BaseJob& job, JobRunMode mode = JobRunMode::kDefault);
+
+        // explicit ordering on top of component access
+        void addDependency(const BaseJob& before, const BaseJob& after);
+
+        void clear() noexcept;
+
+        [[nodiscard]] uint32_t jobCount() const noexcept;
+
+        // true if the job at index 'after' waits for the job at index 'before' (directly or not)
+        [[nodiscard]] bool dependsOn(uint32_t after, uint32_t before) const;
+
+        void run(World& world);
+
+    private:
+        struct Data;
+        std::unique_ptr<Data> data_;
+    };
+}
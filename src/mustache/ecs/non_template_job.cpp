@@ -3,6 +3,25 @@
 
 using namespace mustache;
 
+namespace {
+    // calls func(first, count) for every run of enabled entities of the array,
+    // invocation index is advanced by the whole array, so disabled entities keep their indexes
+    template<typename _F>
+    void forEachEnabledRun(const Archetype& archetype, ArchetypeEntityIndex first, uint32_t count,
+                           JobInvocationIndex& invocation_index, _F&& func) {
+        const auto base = invocation_index;
+        const auto set_offset = [&invocation_index, &base](uint32_t offset) {
+            invocation_index.entity_index = ParallelTaskGlobalItemIndex::make(base.entity_index.toInt() + offset);
+            invocation_index.entity_index_in_task = ParallelTaskItemIndexInTask::make(
+                    base.entity_index_in_task.toInt() + offset);
+        };
+        archetype.forEachEnabledRun(first, count, [&](ArchetypeEntityIndex run_first, uint32_t run_size) {
+            set_offset(run_first.toInt() - first.toInt());
+            func(run_first, run_size);
+        });
+        set_offset(count);
+    }
+}
 
 void NonTemplateJob::fastRunCurrentThread(World& world) {
     constexpr auto Safety = FunctionSafety::kUnsafe;
@@ -36,7 +55,10 @@ void NonTemplateJob::fastRunCurrentThread(World& world) {
     };
     const auto update_per_array_data = [&](Archetype& archetype, ArchetypeEntityIndex index) {
         for (uint32_t i = 0; i < component_indexes.size(); ++i) {
-            if (component_requests[i].is_required) {
+            if (component_indexes[i].isNull()) {
+                // tag components have no column
+                component_ptr[i] = archetype.hasComponent(component_requests[i].id) ? ComponentInfo::tagData() : nullptr;
+            } else if (component_requests[i].is_required) {
                 component_ptr[i] = archetype.getData<FunctionSafety::kUnsafe>(component_indexes[i], index);
             } else {
                 component_ptr[i] = archetype.getData<FunctionSafety::kSafe>(component_indexes[i], index);
@@ -46,7 +68,7 @@ void NonTemplateJob::fastRunCurrentThread(World& world) {
         const auto last_chunk = ChunkIndex::make(archetype.chunkCount());
         for (auto chunk = ChunkIndex::make(0); chunk != last_chunk; ++chunk) {
             for (uint32_t i = 0; i < component_requests.size(); ++i) {
-                if (!component_requests[i].is_const) {
+                if (!component_requests[i].is_const && !component_indexes[i].isNull()) {
                     archetype.setVersion(version, chunk, component_indexes[i]);
                 }
             }
@@ -58,7 +80,8 @@ void NonTemplateJob::fastRunCurrentThread(World& world) {
         const auto archetype_index = ArchetypeIndex::make(ai);
         auto& arch = entities.getArchetype<Safety>(archetype_index);
         auto entities_to_process = arch.size();
-        if (entities_to_process  < 1 || !arch.isMatch(required_mask) || !arch.isMatch(required_shared)) {
+        if (entities_to_process  < 1 || !arch.isMatch(required_mask, exclude_mask, any_mask) ||
+            !arch.isMatch(required_shared)) {
             continue;
         }
         if (!was_locked) {
@@ -69,11 +92,11 @@ void NonTemplateJob::fastRunCurrentThread(World& world) {
         auto cur_index = ArchetypeEntityIndex::make(0);
         while (entities_to_process > 0) {
             const auto chunk_size = arch.distToChunkEnd(cur_index);
-            update_per_array_data(arch, cur_index);
-            args.count = ComponentArraySize::make(chunk_size);
-            callback(args);
-            invocation_index.entity_index = ParallelTaskGlobalItemIndex::make(invocation_index.entity_index.toInt() + chunk_size);
-            invocation_index.entity_index_in_task = ParallelTaskItemIndexInTask::make(invocation_index.entity_index_in_task.toInt() + chunk_size);
+            forEachEnabledRun(arch, cur_index, chunk_size, invocation_index, [&](ArchetypeEntityIndex first, uint32_t count) {
+                update_per_array_data(arch, first);
+                args.count = ComponentArraySize::make(count);
+                callback(args);
+            });
             entities_to_process -= chunk_size;
             cur_index = ArchetypeEntityIndex::make(cur_index.toInt() + chunk_size);
         }
@@ -102,11 +125,12 @@ void NonTemplateJob::singleTask(World&, ArchetypeGroup archetype_group, JobInvoc
             shared_components[i] = archetype.getSharedComponent(index);
         }
     };
-    const auto update_per_array_data = [&](const ArrayView& array_view) {
-        auto& archetype = *array_view.archetype();
-        const auto index = array_view.entityIndex();
+    const auto update_per_array_data = [&](Archetype& archetype, ArchetypeEntityIndex index) {
         for (uint32_t i = 0; i < component_indexes.size(); ++i) {
-            if (component_requests[i].is_required) {
+            if (component_indexes[i].isNull()) {
+                // tag components have no column
+                component_ptr[i] = archetype.hasComponent(component_requests[i].id) ? ComponentInfo::tagData() : nullptr;
+            } else if (component_requests[i].is_required) {
                 component_ptr[i] = archetype.getData<FunctionSafety::kUnsafe>(component_indexes[i], index);
             } else {
                 component_ptr[i] = archetype.getData<FunctionSafety::kSafe>(component_indexes[i], index);
@@ -121,15 +145,13 @@ void NonTemplateJob::singleTask(World&, ArchetypeGroup archetype_group, JobInvoc
 
         for (auto array : ArrayView::make(filter_result_, info.archetype_index,
                                           info.first_entity, info.current_size)) {
-            update_per_array_data(array);
-            args.count = array.arraySize();
-
-            callback(args);
-
-            args.invocation_index.entity_index = ParallelTaskGlobalItemIndex::make(
-                    args.count.toInt() + args.invocation_index.entity_index.toInt());
-            args.invocation_index.entity_index_in_task = ParallelTaskItemIndexInTask::make(
-                    args.count.toInt() + args.invocation_index.entity_index_in_task.toInt());
+            auto& archetype = *array.archetype();
+            forEachEnabledRun(archetype, array.entityIndex(), array.arraySize().toInt(), args.invocation_index,
+                              [&](ArchetypeEntityIndex first, uint32_t count) {
+                update_per_array_data(archetype, first);
+                args.count = ComponentArraySize::make(count);
+                callback(args);
+            });
         }
     }
 }
@@ -146,6 +168,22 @@ ComponentIdMask NonTemplateJob::updateMask() const noexcept {
     return write_mask;
 }
 
+bool NonTemplateJob::isComponentAccessDeclared() const noexcept {
+    return true;
+}
+
+ComponentIdMask NonTemplateJob::readMask() const noexcept {
+    ComponentIdMask read_mask;
+    for (const auto& request : component_requests) {
+        read_mask.set(request.id, true);
+    }
+    return read_mask;
+}
+
+ComponentIdMask NonTemplateJob::writeMask() const noexcept {
+    return updateMask();
+}
+
 void NonTemplateJob::onTaskBegin(World& world, TaskSize size, ParallelTaskId task_id) noexcept {
     if (task_begin) {
         task_begin(world, size, task_id);
@@ -176,6 +214,8 @@ const char* NonTemplateJob::nameCStr() const noexcept {
 
 uint32_t NonTemplateJob::applyFilter(World& world) noexcept {
     filter_result_.mask = ComponentIdMask::null();
+    filter_result_.exclude_mask = exclude_mask;
+    filter_result_.any_mask = any_mask;
     filter_result_.shared_component_mask = SharedComponentIdMask::null();
 
     for (const auto& request : component_requests) {
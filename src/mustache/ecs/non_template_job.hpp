@@ -30,6 +30,12 @@ namespace mustache {
 
         ComponentIdMask updateMask() const noexcept override;
 
+        bool isComponentAccessDeclared() const noexcept override;
+
+        ComponentIdMask readMask() const noexcept override;
+
+        ComponentIdMask writeMask() const noexcept override;
+
         void onTaskBegin(World& world, TaskSize size, ParallelTaskId task_id) noexcept override;
 
         void onTaskEnd(World& world, TaskSize size, ParallelTaskId task_id) noexcept override;
@@ -53,6 +59,8 @@ namespace mustache {
         ComponentIdMask update_mask;
 
         ComponentIdMask version_check_mask;
+        ComponentIdMask exclude_mask; // entities with any of these components are skipped
+        ComponentIdMask any_mask; // if not empty, entities must have at least one of these components
 
         Callback callback;
         TaskEvent task_begin;
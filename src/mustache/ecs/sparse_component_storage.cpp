@@ -0,0 +1,163 @@
+#include "sparse_component_storage.hpp"
+
+#include <mustache/utils/profiler.hpp>
+#include <mustache/utils/memory_manager.hpp>
+
+#include <mustache/ecs/component_factory.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using namespace mustache;
+
+namespace {
+    constexpr size_t target_dense_page_bytes = 16u * 1024u;
+}
+
+SparseComponentStorage::SparseComponentStorage(MemoryManager& memory_manager, ComponentId id):
+        memory_manager_{&memory_manager},
+        id_{id},
+        info_{ComponentFactory::instance().componentInfo(id)} {
+    MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__);
+    // components per dense page is a power of two, so the page and the offset are found by shift and mask
+    const auto per_page = std::max(static_cast<size_t>(1u), target_dense_page_bytes / std::max(info_.size, size_t{1u}));
+    while ((size_t{2u} << dense_page_shift_) <= per_page) {
+        ++dense_page_shift_;
+    }
+    dense_page_mask_ = (1u << dense_page_shift_) - 1u;
+}
+
+SparseComponentStorage::~SparseComponentStorage() {
+    MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__);
+    clear();
+    for (auto page : sparse_pages_) {
+        if (page != nullptr) {
+            memory_manager_->deallocate(page);
+        }
+    }
+    for (auto page : dense_pages_) {
+        memory_manager_->deallocate(page);
+    }
+}
+
+uint32_t& SparseComponentStorage::sparseSlot(EntityId id) {
+    const auto page = id.toInt() >> sparse_page_shift;
+    if (page >= sparse_pages_.size()) {
+        sparse_pages_.resize(page + 1u, nullptr);
+    }
+    auto& ptr = sparse_pages_[page];
+    if (ptr == nullptr) {
+        ptr = static_cast<uint32_t*>(memory_manager_->allocate(sparse_page_size * sizeof(uint32_t)));
+        if (ptr == nullptr) {
+            throw std::runtime_error("Can not allocate sparse page for: " + info_.name);
+        }
+        std::fill(ptr, ptr + sparse_page_size, null_index);
+    }
+    return ptr[id.toInt() & (sparse_page_size - 1u)];
+}
+
+void* SparseComponentStorage::emplace(Entity entity, bool& constructed) {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
+    auto& slot = sparseSlot(entity.id());
+    if (slot != null_index) {
+        entities_[slot] = entity;
+        constructed = true;
+        return dataAt(slot);
+    }
+    const auto index = static_cast<uint32_t>(entities_.size());
+    if ((index >> dense_page_shift_) >= dense_pages_.size()) {
+        const size_t page_size = (dense_page_mask_ + 1u) * info_.size;
+        auto page = static_cast<std::byte*>(memory_manager_->allocate(page_size, info_.align));
+        if (page == nullptr) {
+            throw std::runtime_error("Can not allocate dense page for: " + info_.name);
+        }
+        dense_pages_.push_back(page);
+    }
+    entities_.push_back(entity);
+    slot = index;
+    constructed = false;
+    return dataAt(index);
+}
+
+void* SparseComponentStorage::assign(World& world, Entity entity, bool skip_constructor) {
+    MUSTACHE_PROFILER_BLOCK_LVL_2(__FUNCTION__);
+    bool constructed = false;
+    auto ptr = emplace(entity, constructed);
+    if (skip_constructor) {
+        // caller constructs the component in place
+        if (constructed && info_.functions.destroy) {
+            info_.functions.destroy(ptr);
+        }
+    } else if (!constructed) {
+        if (!info_.functions.create && !info_.default_value.empty()) {
+            memcpy(ptr, info_.default_value.data(), info_.size);
+        }
+        ComponentFactory::instance().initComponents(world, entity, info_, ptr, 1u);
+    }
+    return ptr;
+}
+
+bool SparseComponentStorage::remove(World& world, Entity entity) {
+    MUSTACHE_PROFILER_BLOCK_LVL_2(__FUNCTION__);
+    const auto index = denseIndex(entity.id());
+    if (index == null_index) {
+        return false;
+    }
+    if (info_.functions.before_remove) {
+        info_.functions.before_remove(dataAt(index), entity, world);
+    }
+    // the hook may have removed the component
+    const auto current = denseIndex(entity.id());
+    if (current != null_index) {
+        eraseAt(entity.id(), current);
+    }
+    return true;
+}
+
+bool SparseComponentStorage::erase(EntityId id) noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
+    const auto index = denseIndex(id);
+    if (index == null_index) {
+        return false;
+    }
+    eraseAt(id, index);
+    return true;
+}
+
+void SparseComponentStorage::eraseAt(EntityId id, uint32_t index) noexcept {
+    auto dest = dataAt(index);
+    if (info_.functions.destroy) {
+        info_.functions.destroy(dest);
+    }
+    const auto last = static_cast<uint32_t>(entities_.size() - 1u);
+    if (index != last) {
+        auto source = dataAt(last);
+        if (info_.trivially_relocatable) {
+            memcpy(dest, source, info_.size);
+        } else {
+            info_.functions.move_constructor(dest, source);
+            if (info_.functions.destroy) {
+                info_.functions.destroy(source);
+            }
+        }
+        const auto moved = entities_[last];
+        entities_[index] = moved;
+        sparse_pages_[moved.id().toInt() >> sparse_page_shift][moved.id().toInt() & (sparse_page_size - 1u)] = index;
+    }
+    entities_.pop_back();
+    sparse_pages_[id.toInt() >> sparse_page_shift][id.toInt() & (sparse_page_size - 1u)] = null_index;
+}
+
+void SparseComponentStorage::clear() noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__);
+    const auto count = size();
+    for (uint32_t i = 0u; i < count; ++i) {
+        if (info_.functions.destroy) {
+            info_.functions.destroy(dataAt(i));
+        }
+        const auto id = entities_[i].id();
+        sparse_pages_[id.toInt() >> sparse_page_shift][id.toInt() & (sparse_page_size - 1u)] = null_index;
+    }
+    entities_.clear();
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <mustache/utils/dll_export.h>
+#include <mustache/utils/uncopiable.hpp>
+#include <mustache/utils/default_settings.hpp>
+#include <mustache/utils/container_vector.hpp>
+
+#include <mustache/ecs/entity.hpp>
+#include <mustache/ecs/id_deff.hpp>
+#include <mustache/ecs/component_info.hpp>
+#include <mustache/ecs/component_handler.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mustache {
+
+    class World;
+    class MemoryManager;
+
+    /**
+     * Paged sparse set of one component, see IsSparseComponent.
+     * Sparse pages map EntityId to an index of the packed dense arrays, pages are allocated on first use.
+     * Dense pages are never moved, remove moves the last component into the hole.
+     * Lookups are read only and may be done from several threads while nothing is assigned or removed.
+     */
+    class MUSTACHE_EXPORT SparseComponentStorage : public Uncopiable {
+    public:
+        SparseComponentStorage(MemoryManager& memory_manager, ComponentId id);
+        ~SparseComponentStorage();
+
+        [[nodiscard]] MUSTACHE_INLINE void* get(EntityId id) const noexcept {
+            const auto index = denseIndex(id);
+            return index != null_index ? dataAt(index) : nullptr;
+        }
+
+        [[nodiscard]] MUSTACHE_INLINE bool has(EntityId id) const noexcept {
+            return denseIndex(id) != null_index;
+        }
+
+        // constructs the component if the entity has no one, memory is left uninitialized if skip_constructor is set
+        void* assign(World& world, Entity entity, bool skip_constructor);
+
+        // memory for the component of entity, constructed is false if the entity has no component yet
+        void* emplace(Entity entity, bool& constructed);
+
+        // calls beforeRemove hook and destroys the component
+        bool remove(World& world, Entity entity);
+
+        // destroys the component without hooks
+        bool erase(EntityId id) noexcept;
+
+        void clear() noexcept;
+
+        [[nodiscard]] uint32_t size() const noexcept {
+            return static_cast<uint32_t>(entities_.size());
+        }
+
+        [[nodiscard]] ComponentId componentId() const noexcept {
+            return id_;
+        }
+
+        [[nodiscard]] const ComponentInfo& componentInfo() const noexcept {
+            return info_;
+        }
+
+        [[nodiscard]] Entity entityAt(uint32_t index) const noexcept {
+            return entities_[index];
+        }
+
+        [[nodiscard]] MUSTACHE_INLINE void* dataAt(uint32_t index) const noexcept {
+            return dense_pages_[index >> dense_page_shift_] + (index & dense_page_mask_) * info_.size;
+        }
+
+    private:
+        static constexpr uint32_t null_index = ~0u;
+        static constexpr uint32_t sparse_page_shift = 12u;
+        static constexpr uint32_t sparse_page_size = 1u << sparse_page_shift;
+
+        [[nodiscard]] MUSTACHE_INLINE uint32_t denseIndex(EntityId id) const noexcept {
+            const auto page = id.toInt() >> sparse_page_shift;
+            if (page >= sparse_pages_.size() || sparse_pages_[page] == nullptr) {
+                return null_index;
+            }
+            return sparse_pages_[page][id.toInt() & (sparse_page_size - 1u)];
+        }
+
+        uint32_t& sparseSlot(EntityId id);
+        void eraseAt(EntityId id, uint32_t index) noexcept;
+
+        MemoryManager* memory_manager_;
+        ComponentId id_;
+        ComponentInfo info_;
+        uint32_t dense_page_shift_ = 0u;
+        uint32_t dense_page_mask_ = 0u;
+        mustache::vector<uint32_t*> sparse_pages_;
+        mustache::vector<std::byte*> dense_pages_;
+        mustache::vector<Entity> entities_;
+    };
+
+    /**
+     * Job argument of a sparse component, components are found by entities of the processed array.
+     * Entities without a required sparse component are skipped.
+     */
+    template<typename T, bool _IsRequired>
+    class SparseComponentHandler {
+    public:
+        SparseComponentHandler(const SparseComponentStorage* storage, const Entity* entities) noexcept:
+                storage_{storage},
+                entities_{entities} {
+        }
+
+        [[nodiscard]] MUSTACHE_INLINE bool has(size_t i) const noexcept {
+            return storage_ != nullptr && storage_->has(entities_[i].id());
+        }
+
+        MUSTACHE_INLINE decltype(auto) operator[](size_t i) const noexcept {
+            T* ptr = storage_ != nullptr ? static_cast<T*>(storage_->get(entities_[i].id())) : nullptr;
+            if constexpr (_IsRequired) {
+                return *ptr;
+            } else {
+                return OptionalComponent<T>{ptr};
+            }
+        }
+
+        MUSTACHE_INLINE SparseComponentHandler operator+=(size_t count) noexcept {
+            SparseComponentHandler cpy = *this;
+            entities_ += count;
+            return cpy;
+        }
+
+        MUSTACHE_INLINE SparseComponentHandler operator++(int) noexcept {
+            return *this += 1;
+        }
+
+    private:
+        const SparseComponentStorage* storage_;
+        const Entity* entities_;
+    };
+
+    template<typename T>
+    struct IsRequiredSparseHandler : std::false_type {};
+
+    template<typename T>
+    struct IsRequiredSparseHandler<SparseComponentHandler<T, true> > : std::true_type {};
+}
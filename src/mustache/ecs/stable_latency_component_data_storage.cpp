@@ -9,19 +9,29 @@
 #include <mustache/utils/logger.hpp>
 #include "component_factory.hpp"
 #include <cassert>
+#include <cstring>
 #include <algorithm>
 
 using namespace mustache;
 
 namespace {
     constexpr size_t min_initial_capacity = 1;
+    // every component array starts at a cache line, so lanes of Job::forEachLane are aligned
+    constexpr size_t column_alignment = MemoryManager::cache_line_size;
+
+    constexpr size_t alignColumn(size_t size) noexcept {
+        return (size + column_alignment - 1) & ~(column_alignment - 1);
+    }
 }
 
 StableLatencyComponentDataStorage::StableLatencyComponentDataStorage(
         const ComponentIdMask& mask,
-        MemoryManager& memory_manager) :
+        MemoryManager& memory_manager,
+        PagePolicy page_policy,
+        const ComponentIdMask& cold_mask) :
         capacity_(0),
-        buffers_{Buffer{memory_manager}, Buffer{memory_manager}} {
+        buffers_{Buffer{memory_manager, page_policy}, Buffer{memory_manager, page_policy}},
+        cold_buffers_{Buffer{memory_manager, PagePolicy::kDefault}, Buffer{memory_manager, PagePolicy::kDefault}} {
     MUSTACHE_PROFILER_BLOCK_LVL_0("StableLatencyComponentDataStorage::ctor");
 
     size_t offset = 0;
@@ -38,9 +48,11 @@ StableLatencyComponentDataStorage::StableLatencyComponentDataStorage(
         Meta meta {
                 {nullptr, nullptr},
                 info.size,
-                offset,
-                info.functions.move_constructor_and_destroy,
-                id
+                info.trivially_relocatable ? ComponentInfo::MoveFunction{} : info.functions.move_constructor_and_destroy,
+                info.trivially_relocatable ? ComponentInfo::MoveFunction{} : info.functions.move_constructor,
+                info.functions.destroy,
+                id,
+                info.cold || cold_mask.has(id)
         };
         meta_.push_back(meta);
         offset += info.size;
@@ -62,8 +74,9 @@ StableLatencyComponentDataStorage::StableLatencyComponentDataStorage(
     } else {
         capacity_ = static_cast<uint32_t>(memory_manager.pageSize());
     }
-    const size_t initial_bytes = capacity_ * block_size_;
-    buffers_[0].resize(initial_bytes, block_align_);
+    initial_capacity_ = capacity_;
+    buffers_[0].resize(bufferSize(capacity_, false), column_alignment);
+    cold_buffers_[0].resize(bufferSize(capacity_, true), column_alignment);
     precomputeBases();
 }
 
@@ -71,11 +84,18 @@ void StableLatencyComponentDataStorage::clear(bool free_chunks) {
     MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__);
     size_ = 0;
     migration_pos_ = 0;
-    capacity_ = 0;
     if (free_chunks) {
         buffers_[0].clear();
         buffers_[1].clear();
+        cold_buffers_[0].clear();
+        cold_buffers_[1].clear();
+        capacity_ = 0;
+        next_capacity_ = 0;
+    } else {
+        // nothing is left to migrate, the newest buffers are kept
+        finishMigration();
     }
+    precomputeBases();
 }
 
 void StableLatencyComponentDataStorage::reserve(size_t new_capacity) {
@@ -92,25 +112,23 @@ void StableLatencyComponentDataStorage::reserve(size_t new_capacity) {
 
 void StableLatencyComponentDataStorage::incSize() noexcept {
     if (needGrow()) grow();
-    if (isMigrationStage()) {
+    if (hasNextBuffer()) {
+        // new items are placed to the next buffer, old ones are moved a few per insertion
         migrationSteps(migrationStepsCount());
-    } else {
+    }
+    if (!hasNextBuffer()) {
         ++migration_pos_;
     }
     ++size_;
 }
 
-void StableLatencyComponentDataStorage::decrSize() noexcept {
-    --size_;
+void StableLatencyComponentDataStorage::decrSize(uint32_t count) noexcept {
+    size_ -= count;
     migration_pos_ = std::min(size_, migration_pos_);
 }
 
-bool StableLatencyComponentDataStorage::isMigrationStage() const noexcept {
-    return size_ >= capacity_;
-}
-
 bool StableLatencyComponentDataStorage::needGrow() const noexcept {
-    return buffers_[1].empty() ? (size_ >= capacity_) : (size_ >= 2 * capacity_);
+    return size_ >= (hasNextBuffer() ? next_capacity_ : capacity_);
 }
 
 uint32_t StableLatencyComponentDataStorage::migrationStepsCount() noexcept {
@@ -118,58 +136,205 @@ uint32_t StableLatencyComponentDataStorage::migrationStepsCount() noexcept {
 }
 
 void StableLatencyComponentDataStorage::precomputeBases() noexcept {
+    const bool has_next = hasNextBuffer();
     const size_t cap1 = static_cast<size_t>(capacity_);
-    const size_t cap2 = buffers_[1].empty() ? cap1 : cap1 * 2;
+    const size_t cap2 = static_cast<size_t>(next_capacity_);
+    // offsets of hot and cold columns, index 1 is for cold buffers
+    std::array<size_t, 2> offset1 = {0, 0};
+    std::array<size_t, 2> offset2 = {0, 0};
     uint32_t component_index = 0;
     for (auto& meta : meta_) {
-        meta.base[0] = buffers_[0].data_ + meta.offset * cap1;
-        meta.base[1] = buffers_[1].empty() ? nullptr : buffers_[1].data_ + meta.offset * cap2;
+        const auto& buffers = meta.cold ? cold_buffers_ : buffers_;
+        meta.base[0] = buffers[0].data_ + offset1[meta.cold];
+        meta.base[1] = has_next ? buffers[1].data_ + offset2[meta.cold] : nullptr;
+        offset1[meta.cold] += alignColumn(meta.stride * cap1);
+        offset2[meta.cold] += alignColumn(meta.stride * cap2);
         get_meta_[meta.id.toInt()] = {meta.base, static_cast<uint32_t>(meta.stride),
                                       ComponentIndex::make(component_index++)};
     }
 }
 
+size_t StableLatencyComponentDataStorage::bufferSize(size_t capacity, bool cold) const noexcept {
+    size_t result = 0;
+    for (const auto& meta : meta_) {
+        if (meta.cold == cold) {
+            result += alignColumn(meta.stride * capacity);
+        }
+    }
+    return result;
+}
+
+size_t StableLatencyComponentDataStorage::allocatedSize() const noexcept {
+    size_t result = bufferSize(capacity_, false) + bufferSize(capacity_, true);
+    if (hasNextBuffer()) {
+        result += bufferSize(next_capacity_, false) + bufferSize(next_capacity_, true);
+    }
+    return result;
+}
+
+void StableLatencyComponentDataStorage::resizeNextBuffers(size_t capacity) {
+    buffers_[1].resize(bufferSize(capacity, false), column_alignment);
+    cold_buffers_[1].resize(bufferSize(capacity, true), column_alignment);
+    next_capacity_ = static_cast<uint32_t>(capacity);
+    migration_pos_ = size_;
+    precomputeBases();
+}
+
 void StableLatencyComponentDataStorage::emplace(ComponentStorageIndex position) {
     MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
     const auto next = position.next();
     reserve(next.toInt());
 }
 
+void StableLatencyComponentDataStorage::emplaceBack(uint32_t count) {
+    MUSTACHE_PROFILER_BLOCK_LVL_2(__FUNCTION__);
+    const uint32_t new_size = size_ + count;
+    if (block_size_ == 0) {
+        size_ = new_size;
+        return;
+    }
+
+    while (true) {
+        migrationSteps();
+        const uint32_t available = hasNextBuffer() ? next_capacity_ : capacity_;
+        if (new_size <= available) {
+            break;
+        }
+        grow();
+    }
+    size_ = new_size;
+    if (!hasNextBuffer()) {
+        migration_pos_ = size_;
+    }
+    precomputeBases();
+}
+
 void StableLatencyComponentDataStorage::grow() {
-    if (!buffers_[1].empty()) {
-        Buffer::swap(buffers_[0], buffers_[1]);
-        capacity_ = capacity_ == 0 ? min_initial_capacity : capacity_ * 2;
+    // pending migration (possible after a shrink) is finished first, so there are at most two buffers
+    migrationSteps();
+    if (capacity_ == 0u) {
+        // buffers were released, see compact
+        capacity_ = initial_capacity_;
+        buffers_[0].resize(bufferSize(capacity_, false), column_alignment);
+        cold_buffers_[0].resize(bufferSize(capacity_, true), column_alignment);
+        migration_pos_ = size_;
+        precomputeBases();
+        return;
     }
+    resizeNextBuffers(capacity_ * 2ull);
+}
 
-    const size_t new_bytes = capacity_ * 2 * block_size_;
-    buffers_[1].resize(new_bytes, block_align_);
+bool StableLatencyComponentDataStorage::migrationSteps(uint32_t count) {
+    if (!hasNextBuffer()) {
+        return false;
+    }
+    if (migration_pos_ > 0) {
+        count = count == 0 ? migration_pos_ : std::min(count, migration_pos_);
+        uint32_t start = migration_pos_ - count;
+        for (auto& meta : meta_) {
+            std::byte* source = meta.base[0] + meta.stride * start;
+            std::byte* dest   = meta.base[1] + meta.stride * start;
+            if (meta.move_and_destroy) {
+                for (uint32_t i = 0; i < count; ++i) {
+                    meta.move_and_destroy(dest, source);
+                    dest   += meta.stride;
+                    source += meta.stride;
+                }
+            } else if (meta.move_constructor) {
+                for (uint32_t i = 0; i < count; ++i) {
+                    meta.move_constructor(dest, source);
+                    if (meta.destroy) {
+                        meta.destroy(source);
+                    }
+                    dest   += meta.stride;
+                    source += meta.stride;
+                }
+            } else {
+                memcpy(dest, source, meta.stride * count);
+            }
+        }
+        migration_pos_ -= count;
+    }
+    if (migration_pos_ == 0) {
+        finishMigration();
+        return true;
+    }
+    return false;
+}
 
+void StableLatencyComponentDataStorage::finishMigration() noexcept {
+    if (!hasNextBuffer() || migration_pos_ != 0u) {
+        return;
+    }
+    // every item is in the next buffer, the old one is released right away
+    Buffer::swap(buffers_[0], buffers_[1]);
+    Buffer::swap(cold_buffers_[0], cold_buffers_[1]);
+    buffers_[1].clear();
+    cold_buffers_[1].clear();
+    capacity_ = next_capacity_;
+    next_capacity_ = 0;
     migration_pos_ = size_;
     precomputeBases();
 }
 
-bool StableLatencyComponentDataStorage::migrationSteps(uint32_t count) {
-    if (migration_pos_ == 0 || buffers_[1].empty()) {
+bool StableLatencyComponentDataStorage::shouldShrink() const noexcept {
+    if (block_size_ == 0 || hasNextBuffer() || capacity_ == 0u) {
         return false;
     }
-    count = count == 0 ? migration_pos_ : std::min(count, migration_pos_);
-    uint32_t start = migration_pos_ - count;
-    for (auto& meta : meta_) {
-        std::byte* source = meta.base[0] + meta.stride * start;
-        std::byte* dest   = meta.base[1] + meta.stride * start;
-        for (uint32_t i = 0; i < count; ++i) {
-            meta.move_and_destroy(dest, source);
-            dest   += meta.stride;
-            source += meta.stride;
+    // hysteresis: the storage grows when it is full and shrinks when it is a quarter full or less,
+    // so small size changes never reallocate it back and forth
+    return size_ == 0u || (capacity_ > initial_capacity_ && size_ <= capacity_ / shrink_ratio);
+}
+
+uint32_t StableLatencyComponentDataStorage::compact(uint32_t budget) {
+    MUSTACHE_PROFILER_BLOCK_LVL_2(__FUNCTION__);
+    uint32_t moved = 0u;
+    // a pending growth migration is finished first, the storage may need a shrink after it
+    while (true) {
+        if (!hasNextBuffer()) {
+            if (!shouldShrink()) {
+                break;
+            }
+            if (size_ == 0u) {
+                clear(true);
+                break;
+            }
+            // the new capacity is at least twice the size, so insertions finish the migration before it is full
+            uint32_t new_capacity = capacity_;
+            while (new_capacity / 2u >= initial_capacity_ && new_capacity / 2u >= 2u * size_) {
+                new_capacity /= 2u;
+            }
+            resizeNextBuffers(new_capacity);
         }
+        const uint32_t count = std::min(budget - moved, migration_pos_);
+        if (count == 0u && migration_pos_ > 0u) {
+            break;
+        }
+        migrationSteps(std::max(count, 1u));
+        moved += count;
     }
-    migration_pos_ -= count;
-    return migration_pos_ == 0;
+    return moved;
+}
+
+bool StableLatencyComponentDataStorage::isCompacted() const noexcept {
+    return !hasNextBuffer() && !shouldShrink();
 }
 
 void StableLatencyComponentDataStorage::Buffer::resize(size_t total_size, size_t alignment) {
     clear();
+    if (total_size == 0u) {
+        // all columns are in the other buffer set
+        return;
+    }
     const std::size_t aligned_size = (total_size + alignment - 1) & ~(alignment - 1);
+    // smaller buffers would waste most of a huge page
+    if (policy_ == PagePolicy::kHugePages && aligned_size >= MemoryManager::large_page_size) {
+        data_ = static_cast<std::byte*>(memory_manager_->allocateHugePages(aligned_size, &type_));
+        if (data_ != nullptr) {
+            return;
+        }
+    }
+    type_ = PageType::kHeap;
     data_ = static_cast<std::byte*>(memory_manager_->allocateSmart(
             aligned_size,
             alignment,
@@ -179,6 +344,13 @@ void StableLatencyComponentDataStorage::Buffer::resize(size_t total_size, size_t
 }
 
 void StableLatencyComponentDataStorage::Buffer::clear() {
-    memory_manager_->deallocateSmart(data_);
+    if (data_ == nullptr) {
+        return;
+    }
+    if (type_ == PageType::kHeap) {
+        memory_manager_->deallocateSmart(data_);
+    } else {
+        memory_manager_->deallocateHugePages(data_);
+    }
     data_ = nullptr;
 }
@@ -2,6 +2,7 @@
 
 #include <mustache/utils/default_settings.hpp>
 #include <mustache/utils/array_wrapper.hpp>
+#include <mustache/utils/memory_manager.hpp>
 #include <mustache/ecs/base_component_data_storage.hpp>
 #include <mustache/ecs/component_factory.hpp>
 #include <mustache/ecs/component_mask.hpp>
@@ -11,19 +12,44 @@
 
 namespace mustache {
 
-    class MemoryManager;
     class MUSTACHE_EXPORT StableLatencyComponentDataStorage {
     public:
-        StableLatencyComponentDataStorage(const ComponentIdMask& mask, MemoryManager& mmgr);
+        // columns of cold_mask and of cold components (see IsColdComponent) are kept in separate heap buffers
+        StableLatencyComponentDataStorage(const ComponentIdMask& mask, MemoryManager& mmgr,
+                                          PagePolicy page_policy = PagePolicy::kDefault,
+                                          const ComponentIdMask& cold_mask = ComponentIdMask::null());
         ~StableLatencyComponentDataStorage() = default;
 
         uint32_t capacity() const noexcept {
-            return capacity_ + (buffers_[1].empty() ? 0 : capacity_);
+            return hasNextBuffer() ? next_capacity_ : capacity_;
         }
 
+        // bytes of component buffers, including the old buffer of a pending migration
+        [[nodiscard]] size_t allocatedSize() const noexcept;
+
+        /**
+         * Moves at most budget items to a smaller buffer, returns the number of moved items.
+         * Shrinking starts when the storage is a quarter full or less and uses the same incremental migration
+         * as growth: the old buffer is released when the last item is moved, insertions move items too.
+         * Buffers of an empty storage are released at once, a pending growth migration is continued too.
+         */
+        uint32_t compact(uint32_t budget);
+
+        // no shrink is pending or needed
+        [[nodiscard]] bool isCompacted() const noexcept;
+
         void reserve(size_t new_capacity);
         void clear(bool free_chunks);
 
+        // pages of the newest buffer of hot columns
+        [[nodiscard]] PageType pageType() const noexcept {
+            return hasNextBuffer() ? buffers_[1].type_ : buffers_[0].type_;
+        }
+
+        [[nodiscard]] bool isCold(ComponentIndex index) const noexcept {
+            return meta_[index.toInt()].cold;
+        }
+
         MUSTACHE_INLINE void* getDataUnsafe(ComponentIndex ci, ComponentStorageIndex idx) const noexcept {
             const uint32_t comp = ci.toInt();
             const uint32_t i    = idx.toInt();
@@ -83,10 +109,14 @@ namespace mustache {
         }
 
         void emplace(ComponentStorageIndex pos);
+        // appends count uninitialized items at once, pending migration is finished first so new items are never moved
+        void emplaceBack(uint32_t count);
         void incSize() noexcept;
-        void decrSize() noexcept;
+        void decrSize(uint32_t count = 1u) noexcept;
 
     private:
+        static constexpr uint32_t shrink_ratio = 4u;
+
         struct GetMeta {
             std::array<std::byte*, 2> base;
             uint32_t   stride;
@@ -96,15 +126,21 @@ namespace mustache {
         struct Meta {
             std::array<std::byte*, 2> base;
             size_t    stride;
-            size_t offset;
+            // all functions are null for trivially relocatable components
             ComponentInfo::MoveFunction move_and_destroy;
+            ComponentInfo::MoveFunction move_constructor; // used if move_and_destroy is not set (C API components)
+            ComponentInfo::Destructor destroy;
             ComponentId id;
+            bool cold;
         };
         struct Buffer {
             std::byte* data_ = nullptr;
             MemoryManager* memory_manager_ = nullptr;
-            explicit Buffer(MemoryManager& manager):
-                    memory_manager_{&manager} {
+            PagePolicy policy_ = PagePolicy::kDefault;
+            PageType type_ = PageType::kHeap;
+            Buffer(MemoryManager& manager, PagePolicy policy):
+                    memory_manager_{&manager},
+                    policy_{policy} {
             }
             ~Buffer() {
                 clear();
@@ -122,12 +158,20 @@ namespace mustache {
             void clear();
             static void swap(Buffer& a, Buffer& b) noexcept {
                 std::swap(a.data_, b.data_);
+                std::swap(a.type_, b.type_);
             }
         };
 
+        // buffers of hot and cold columns grow and migrate together
+        [[nodiscard]] bool hasNextBuffer() const noexcept {
+            return !buffers_[1].empty() || !cold_buffers_[1].empty();
+        }
+        void resizeNextBuffers(size_t capacity);
         void precomputeBases() noexcept;
-        [[nodiscard]] bool isMigrationStage() const noexcept;
+        [[nodiscard]] size_t bufferSize(size_t capacity, bool cold) const noexcept;
         [[nodiscard]] bool needGrow() const noexcept;
+        [[nodiscard]] bool shouldShrink() const noexcept;
+        void finishMigration() noexcept;
         [[nodiscard]] static uint32_t migrationStepsCount() noexcept;
         void grow();
         bool migrationSteps(uint32_t count = 0);
@@ -135,7 +179,10 @@ namespace mustache {
         vector<GetMeta> get_meta_;
         uint32_t migration_pos_ = 0;
         uint32_t capacity_ = 0;
+        uint32_t next_capacity_ = 0;
+        uint32_t initial_capacity_ = 0;
         std::array<Buffer, 2> buffers_;
+        std::array<Buffer, 2> cold_buffers_;
         uint32_t block_align_ = 0;
         size_t block_size_  = 0;
         vector<Meta> meta_;
@@ -85,4 +85,14 @@ namespace mustache {
         uint32_t target_chunk_size_ = 4096u;
         uint32_t total_size_ = 0u;
     };
+
+    // command of one of the thread storages, commands of all storages are applied grouped by entity
+    struct TemporalCommand {
+        const TemporalStorage* storage = nullptr;
+        const TemporalStorage::ActionInfo* action = nullptr;
+
+        [[nodiscard]] bool isCreate() const noexcept {
+            return action->action == TemporalStorage::Action::kCreateEntity;
+        }
+    };
 }
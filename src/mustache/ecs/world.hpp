@@ -18,6 +18,7 @@ namespace mustache {
         std::shared_ptr<MemoryManager> memory_manager;
         std::shared_ptr<Dispatcher> dispatcher;
         std::shared_ptr<EventManager> events;
+        PagePolicy storage_page_policy = PagePolicy::kDefault; // pages of archetype component storages
     };
 
 //    template <bool EnableAutoVersionControl = true>
@@ -59,6 +60,10 @@ namespace mustache {
         }
 
 
+        [[nodiscard]] PagePolicy storagePagePolicy() const noexcept {
+            return context_.storage_page_policy;
+        }
+
         [[nodiscard]] EventManager& events() noexcept {
             if (!context_.events) {
                 context_.events = std::make_shared<EventManager>(memoryManager());
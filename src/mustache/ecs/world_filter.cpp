@@ -20,3 +20,10 @@ void WorldFilterResult::clear() noexcept {
     total_entity_count = 0u;
     filtered_archetypes.clear();
 }
+
+void ArchetypeQueryCache::reset() noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__);
+    archetypes_epoch = 0u;
+    archetypes_checked = 0u;
+    matching.clear();
+}
@@ -26,6 +26,22 @@ namespace mustache {
         using WorldFilterParam::WorldFilterParam;
     };
 
+    /**
+     * Archetypes matching a job mask, updated incrementally: only archetypes created since the previous
+     * update are checked. Reset when the mask or the EntityManager changes.
+     */
+    struct MUSTACHE_EXPORT ArchetypeQueryCache {
+        void reset() noexcept;
+
+        uint64_t archetypes_epoch{0u};
+        uint32_t archetypes_checked{0u};
+        ComponentIdMask mask;
+        ComponentIdMask exclude_mask;
+        ComponentIdMask any_mask;
+        SharedComponentIdMask shared_component_mask;
+        mustache::vector<ArchetypeIndex> matching;
+    };
+
     /**
      * Stores result of archetype filtering
      */
@@ -41,13 +57,15 @@ namespace mustache {
             Archetype* archetype {nullptr};
             uint32_t entities_count {0};
             void addBlock(const EntityBlock& block) noexcept;
-            ArrayWrapper<EntityBlock, BlockIndex, false> blocks; // TODO: use memory manager
+            ArrayWrapper<EntityBlock, BlockIndex, true> blocks; // size class pool, TODO: use memory manager of the world
         };
 
         void clear() noexcept;
 
         mustache::vector<ArchetypeFilterResult> filtered_archetypes;
         ComponentIdMask mask;
+        ComponentIdMask exclude_mask; // archetypes with any of these components are skipped
+        ComponentIdMask any_mask; // if not empty, archetypes must have at least one of these components
         SharedComponentIdMask shared_component_mask;
         uint32_t total_entity_count{0u};
     };
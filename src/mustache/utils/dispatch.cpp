@@ -1,9 +1,11 @@
 #include "dispatch.hpp"
 #include <mustache/utils/container_map.hpp>
-#include <mustache/utils/container_set.hpp>
 #include <mustache/utils/container_queue.hpp>
 #include <mustache/utils/container_vector.hpp>
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <string>
 
 #ifdef __EMSCRIPTEN__
@@ -13,39 +15,215 @@
 #define NUMBER_OF_CORES std::thread::hardware_concurrency()
 #endif
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
 #include <mustache/utils/profiler.hpp>
 
 using namespace mustache;
 
 namespace {
+    enum : uint32_t {
+        kInitialDequeCapacity = 256u,
+        kSpinCountBeforePark = 256u,
+    };
+
+    inline void cpuRelax() noexcept {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        _mm_pause();
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        __builtin_ia32_pause();
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    /// Counter of unfinished tasks of one batch, the waiting thread sleeps until the last task signals it.
+    struct BatchCompletion {
+        std::atomic<uint32_t> remaining{0u};
+        std::mutex mutex;
+        std::condition_variable finished;
+
+        void onTaskDone() {
+            // decremented under the mutex: the waiter may destroy the batch as soon as it sees zero
+            std::lock_guard<std::mutex> lock{mutex};
+            if (remaining.fetch_sub(1u, std::memory_order_acq_rel) == 1u) {
+                finished.notify_all();
+            }
+        }
+
+        void wait() {
+            for (uint32_t i = 0u; i < kSpinCountBeforePark && remaining.load(std::memory_order_acquire) > 0u; ++i) {
+                cpuRelax();
+            }
+            std::unique_lock<std::mutex> lock{mutex};
+            finished.wait(lock, [this] {
+                return remaining.load(std::memory_order_acquire) == 0u;
+            });
+        }
+    };
+
+    struct Task {
+        explicit Task(Job&& task_job, BatchCompletion* task_batch = nullptr):
+                job{std::move(task_job)},
+                batch{task_batch},
+                references{task_batch != nullptr ? 2u : 1u} {
+
+        }
+        Job job;
+        // batch task is referenced by a deque and by its batch, both of them may try to run it
+        BatchCompletion* batch;
+        std::atomic<bool> claimed{false};
+        std::atomic<uint32_t> references;
+
+        [[nodiscard]] bool claim() noexcept {
+            return batch == nullptr || !claimed.exchange(true, std::memory_order_acq_rel);
+        }
+        void release() noexcept {
+            if (references.fetch_sub(1u, std::memory_order_acq_rel) == 1u) {
+                delete this;
+            }
+        }
+        void run(ThreadId thread_id, std::atomic<uint32_t>& unfinished_tasks) {
+            {
+                MUSTACHE_PROFILER_BLOCK_LVL_3("Run task");
+                job(thread_id);
+            }
+            if (batch != nullptr) {
+                batch->onTaskDone();
+            }
+            unfinished_tasks.fetch_sub(1u, std::memory_order_acq_rel);
+        }
+    };
+
+    /// Chase-Lev work-stealing deque (Le, Pop, Cohen, Nardelli: "Correct and Efficient Work-Stealing
+    /// for Weak Memory Models"). Only one thread at a time may push / pop (the owner), any thread may steal.
+    class WorkStealingDeque : public Uncopiable {
+    public:
+        WorkStealingDeque():
+                array_{new Array{kInitialDequeCapacity}} {
+            retired_.emplace_back(array_.load(std::memory_order_relaxed));
+        }
+
+        ~WorkStealingDeque() {
+            for (auto array : retired_) {
+                delete array;
+            }
+        }
+
+        void push(Task* task) {
+            const auto bottom = bottom_.load(std::memory_order_relaxed);
+            const auto top = top_.load(std::memory_order_acquire);
+            auto array = array_.load(std::memory_order_relaxed);
+            if (bottom - top > static_cast<int64_t>(array->capacity) - 1) {
+                array = grow(array, bottom, top);
+            }
+            array->put(bottom, task);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+
+        Task* pop() noexcept {
+            const auto bottom = bottom_.load(std::memory_order_relaxed) - 1;
+            const auto array = array_.load(std::memory_order_relaxed);
+            bottom_.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto top = top_.load(std::memory_order_relaxed);
+            if (top > bottom) {
+                bottom_.store(bottom + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            Task* task = array->get(bottom);
+            if (top == bottom) {
+                if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                                  std::memory_order_relaxed)) {
+                    task = nullptr;
+                }
+                bottom_.store(bottom + 1, std::memory_order_relaxed);
+            }
+            return task;
+        }
+
+        Task* steal() noexcept {
+            auto top = top_.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const auto bottom = bottom_.load(std::memory_order_acquire);
+            if (top >= bottom) {
+                return nullptr;
+            }
+            Task* task = array_.load(std::memory_order_acquire)->get(top);
+            if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                              std::memory_order_relaxed)) {
+                return nullptr; // lost the race with the owner or another thief
+            }
+            return task;
+        }
+
+        [[nodiscard]] bool maybeEmpty() const noexcept {
+            return top_.load(std::memory_order_relaxed) >= bottom_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Array {
+            explicit Array(uint64_t size):
+                    capacity{size},
+                    mask{size - 1},
+                    items{new std::atomic<Task*>[size]} {
+
+            }
+            Task* get(int64_t index) const noexcept {
+                return items[static_cast<uint64_t>(index) & mask].load(std::memory_order_relaxed);
+            }
+            void put(int64_t index, Task* task) noexcept {
+                items[static_cast<uint64_t>(index) & mask].store(task, std::memory_order_relaxed);
+            }
+            uint64_t capacity;
+            uint64_t mask;
+            std::unique_ptr<std::atomic<Task*>[]> items;
+        };
+
+        Array* grow(Array* array, int64_t bottom, int64_t top) {
+            MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+            auto new_array = new Array{array->capacity * 2u};
+            for (auto i = top; i < bottom; ++i) {
+                new_array->put(i, array->get(i));
+            }
+            // thieves may still read from the old array, so it is released with the deque
+            retired_.emplace_back(new_array);
+            array_.store(new_array, std::memory_order_release);
+            return new_array;
+        }
+
+        alignas(64) std::atomic<int64_t> top_{0};
+        alignas(64) std::atomic<int64_t> bottom_{0};
+        alignas(64) std::atomic<Array*> array_;
+        mustache::vector<Array*> retired_;
+    };
+
     enum class JobState : uint8_t {
-        kParallelQueue = 0u,
-        kUnlocked,
+        kUnlocked = 0u,
         kLocked
     };
 
     struct JobQueue {
         mustache::queue<Job> jobs;
-        JobState state{JobState::kParallelQueue};
+        JobState state{JobState::kUnlocked};
+        bool ready{false};
 
         bool isEmpty() const noexcept {
             return jobs.empty();
         }
         void onTaskBegin() noexcept {
-            if(state == JobState::kUnlocked) {
-                state = JobState ::kLocked;
-            }
+            state = JobState::kLocked;
         }
         void onTaskEnd() noexcept {
-            if(state == JobState::kLocked) {
-                state = JobState ::kUnlocked;
-            }
+            state = JobState::kUnlocked;
         }
         bool isLocked() const noexcept {
             return state == JobState::kLocked;
         }
-        /// TODO: rename
-        bool isOk() const noexcept {
+        bool hasAvailableJob() const noexcept {
             return !isLocked() && !jobs.empty();
         }
 
@@ -60,35 +238,79 @@ namespace {
         void push(Job&& job) {
             jobs.emplace(std::move(job));
         }
-
-        void clear() {
-            while (!jobs.empty()) {
-                jobs.pop();
-            }
-        }
     };
 
     thread_local ThreadId g_thread_id;
+    thread_local const void* g_thread_owner = nullptr;
+    thread_local uint32_t g_random_state = 0u;
+
+    uint32_t nextRandom() noexcept {
+        // xorshift32, good enough to spread victims
+        auto x = g_random_state;
+        if (x == 0u) {
+            x = static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id())) | 1u;
+        }
+        x ^= x << 13u;
+        x ^= x >> 17u;
+        x ^= x << 5u;
+        g_random_state = x;
+        return x;
+    }
 }
 
+struct ParallelBatch::Data {
+    std::atomic<uint32_t>* unfinished_dispatcher_tasks = nullptr;
+    BatchCompletion completion;
+    mustache::vector<Task*> tasks;
+    size_t first_not_claimed = 0u;
+    ThreadId thread_id;
+
+    ~Data() {
+        for (auto task : tasks) {
+            task->release();
+        }
+    }
+
+    void wait() {
+        MUSTACHE_PROFILER_BLOCK_LVL_3("Wait batch");
+        // tasks which are not started yet are run here, in order they were added
+        for (; first_not_claimed < tasks.size(); ++first_not_claimed) {
+            auto task = tasks[first_not_claimed];
+            if (task->claim()) {
+                task->run(thread_id, *unfinished_dispatcher_tasks);
+            }
+        }
+        // tasks taken by other threads are still running, the thread sleeps until the last one is done
+        completion.wait();
+    }
+};
+
 struct Dispatcher::Data {
     uint32_t thread_count = 0;
-    JobQueue parallel_jobs;
-    mutable std::mutex mutex;
     std::mutex thread_create_mutex;
-    std::condition_variable jobs_available;
     mustache::vector<std::thread> threads;
-    mustache::set<std::thread::id> thread_ids;
-    uint32_t threads_waiting{0u};
+
+    /// deques[0] receives tasks from threads not owned by this dispatcher (pushes are serialized with
+    /// external_push_mutex), deques[i] is owned by worker i.
+    mustache::vector<std::unique_ptr<WorkStealingDeque> > deques;
+    std::mutex external_push_mutex;
+    std::atomic<uint32_t> queued_parallel_tasks{0u};
+    std::atomic<uint32_t> unfinished_parallel_tasks{0u};
+
+    std::mutex park_mutex;
+    std::condition_variable jobs_available;
+    std::atomic<uint32_t> threads_parked{0u};
 
     struct {
+        mutable std::mutex mutex;
         mustache::vector<std::unique_ptr<JobQueue> > array;
         mustache::multimap<int32_t, QueueId> by_priority;
         mustache::map<std::string, QueueId> by_name;
+        std::atomic<uint32_t> ready_count{0u};
     } extra;
 
-    bool terminate {false};
-    bool single_thread_mode{false};
+    std::atomic<bool> terminate {false};
+    std::atomic<bool> single_thread_mode{false};
 
     void initThreads() {
         std::unique_lock lock {thread_create_mutex};
@@ -99,112 +321,209 @@ struct Dispatcher::Data {
         threads.reserve(thread_count);
         for(uint32_t i = 0; i < thread_count; ++i) {
             MUSTACHE_PROFILER_BLOCK_LVL_0("Create worker");
-            auto& thread = threads.emplace_back([this, i]() noexcept {
+            threads.emplace_back([this, i]() noexcept {
                 threadTask(ThreadId::make(i + 1));
             });
-            thread_ids.insert(thread.get_id());
         }
     }
 
-    JobQueue* findQueue() {
-        MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
-        if(parallel_jobs.isOk()) {
-            return &parallel_jobs;
+    [[nodiscard]] ThreadId currentThreadId() const noexcept {
+        return g_thread_owner == this ? g_thread_id : ThreadId::make(0);
+    }
+
+    void wakeUpWorker() {
+        if (threads_parked.load() > 0u) {
+            std::lock_guard<std::mutex> lock{park_mutex};
+            jobs_available.notify_one();
+        }
+    }
+
+    void pushParallelTask(Task* task) {
+        unfinished_parallel_tasks.fetch_add(1u);
+        queued_parallel_tasks.fetch_add(1u);
+        const auto thread_id = currentThreadId();
+        if (thread_id.isValid() && thread_id.toInt() > 0u) {
+            deques[thread_id.toInt()]->push(task);
+        } else {
+            std::lock_guard<std::mutex> lock{external_push_mutex};
+            deques.front()->push(task);
+        }
+        wakeUpWorker();
+    }
+
+    Task* stealParallelTask(ThreadId thread_id) noexcept {
+        if (queued_parallel_tasks.load(std::memory_order_relaxed) < 1u) {
+            return nullptr;
+        }
+        Task* task = nullptr;
+        if (thread_id.toInt() > 0u) {
+            task = deques[thread_id.toInt()]->pop();
         }
+        const auto num_deques = static_cast<uint32_t>(deques.size());
+        const auto first_victim = nextRandom() % num_deques;
+        for (uint32_t i = 0; task == nullptr && i < num_deques; ++i) {
+            auto victim = first_victim + i;
+            if (victim >= num_deques) {
+                victim -= num_deques;
+            }
+            const bool is_own_deque = victim != 0u && victim == thread_id.toInt();
+            if (!is_own_deque && !deques[victim]->maybeEmpty()) {
+                task = deques[victim]->steal();
+            }
+        }
+        if (task != nullptr) {
+            queued_parallel_tasks.fetch_sub(1u);
+        }
+        return task;
+    }
+
+    void runParallelTask(Task* task, ThreadId thread_id) {
+        if (task->claim()) {
+            task->run(thread_id, unfinished_parallel_tasks);
+        }
+        task->release();
+    }
+
+    void updateReadyState(JobQueue& queue) {
+        const bool ready = queue.hasAvailableJob();
+        if (ready != queue.ready) {
+            queue.ready = ready;
+            if (ready) {
+                extra.ready_count.fetch_add(1u);
+                wakeUpWorker();
+            } else {
+                extra.ready_count.fetch_sub(1u);
+            }
+        }
+    }
+
+    bool runExtraJob(ThreadId thread_id) {
+        if (extra.ready_count.load(std::memory_order_relaxed) < 1u) {
+            return false;
+        }
+        MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+        std::unique_lock<std::mutex> lock{extra.mutex};
+        JobQueue* queue = nullptr;
         for(auto& pair : extra.by_priority) {
             JobQueue* ptr = extra.array[pair.second].get();
-            if(ptr->isOk()) {
-                return ptr;
+            if(ptr->hasAvailableJob()) {
+                queue = ptr;
+                break;
             }
         }
-        return nullptr;
+        if (queue == nullptr) {
+            return false;
+        }
+        runExtraJob(*queue, lock, thread_id);
+        return true;
     }
 
-    [[nodiscard]] ThreadId currentThreadId() noexcept {
-        MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
-        auto thread_id = g_thread_id;
-        if (thread_id.isNull() || thread_ids.count(std::this_thread::get_id()) < 1) {
-            thread_id = ThreadId::make(0);
+    void runExtraJob(JobQueue& queue, std::unique_lock<std::mutex>& lock, ThreadId thread_id) {
+        auto job = std::move(queue.front());
+        queue.pop();
+        queue.onTaskBegin();
+        updateReadyState(queue);
+        lock.unlock();
+        {
+            MUSTACHE_PROFILER_BLOCK_LVL_3("Run task");
+            job(thread_id);
         }
-        return thread_id;
+        lock.lock();
+        queue.onTaskEnd();
+        updateReadyState(queue);
+    }
+
+    bool hasWork() const noexcept {
+        return queued_parallel_tasks.load() > 0u || extra.ready_count.load() > 0u;
     }
 
-#define DOUBLE_LOCK 1
+    void park() {
+        MUSTACHE_PROFILER_BLOCK_LVL_3("Wait for job");
+        std::unique_lock<std::mutex> lock{park_mutex};
+        threads_parked.fetch_add(1u);
+        jobs_available.wait(lock, [this] {
+            return terminate.load() || hasWork();
+        });
+        threads_parked.fetch_sub(1u);
+    }
 
     void threadTask(ThreadId thread_id) noexcept {
         [[maybe_unused]] const std::string thread_name = "Worker: " + std::to_string(thread_id.toInt());
         MUSTACHE_PROFILER_THREAD(thread_name.c_str());
 
         g_thread_id = thread_id;
-        JobQueue* queue = nullptr;
-        while (!terminate) {
-            std::unique_lock<std::mutex> lock{ mutex };
-#if !DOUBLE_LOCK
-            if(queue) {
-                queue->onTaskEnd();
+        g_thread_owner = this;
+        g_random_state = thread_id.toInt() * 0x9E3779B9u;
+        uint32_t idle_iterations = 0u;
+        while (!terminate.load(std::memory_order_relaxed)) {
+            if (auto task = stealParallelTask(thread_id)) {
+                runParallelTask(task, thread_id);
+                idle_iterations = 0u;
+                continue;
             }
-#endif
-            queue = findQueue();
-            {
-                MUSTACHE_PROFILER_BLOCK_LVL_3("Wait for job");
-                while (!terminate && !queue) {
-                    ++threads_waiting;
-                    {
-                        jobs_available.wait(lock);
-                    }
-                    --threads_waiting;
-                    queue = findQueue();
-                }
+            if (runExtraJob(thread_id)) {
+                idle_iterations = 0u;
+                continue;
             }
-            if (terminate) {
-                break;
+            if (++idle_iterations < kSpinCountBeforePark) {
+                cpuRelax();
+                continue;
             }
+            park();
+            idle_iterations = 0u;
+        }
+    }
 
-            auto job = std::move(queue->front());
-            queue->pop();
-            queue->onTaskBegin();
-            lock.unlock();
-            {
-                MUSTACHE_PROFILER_BLOCK_LVL_3("Run task");
-                job(thread_id);
+    void waitParallel() {
+        MUSTACHE_PROFILER_BLOCK_LVL_3("Wait parallel tasks");
+        const auto thread_id = currentThreadId();
+        uint32_t idle_iterations = 0u;
+        while (unfinished_parallel_tasks.load(std::memory_order_acquire) > 0u) {
+            if (auto task = stealParallelTask(thread_id)) {
+                runParallelTask(task, thread_id);
+                idle_iterations = 0u;
+            } else if (++idle_iterations < kSpinCountBeforePark) {
+                cpuRelax();
+            } else {
+                std::this_thread::yield();
             }
-#if DOUBLE_LOCK
-            lock.lock();
-            queue->onTaskEnd();
-#endif
         }
     }
 
-    void wait(JobQueue& queue) {
+    void waitQueue(JobQueue& queue) {
         MUSTACHE_PROFILER_BLOCK_LVL_3("Wait queue");
-        while (!terminate) {
-            std::unique_lock<std::mutex> lock{mutex};
-            if (queue.isEmpty()) {
-                break;
+        const auto thread_id = currentThreadId();
+        std::unique_lock<std::mutex> lock{extra.mutex};
+        while (!terminate.load(std::memory_order_relaxed) && !queue.isEmpty()) {
+            if (queue.isLocked()) {
+                lock.unlock();
+                std::this_thread::yield();
+                lock.lock();
+                continue;
             }
-            auto job = std::move(queue.front());
-
-            queue.pop();
-            queue.onTaskBegin();
-            lock.unlock();
-            {
-                MUSTACHE_PROFILER_BLOCK_LVL_3("Run task");
-                job(currentThreadId());
-            }
-            lock.lock();
-            queue.onTaskEnd();
+            runExtraJob(queue, lock, thread_id);
         }
         {
             MUSTACHE_PROFILER_BLOCK_LVL_3("Wait other threads");
-            if (queue.state == JobState::kParallelQueue) {
-                const auto num_threads = threads.size();
-                while (threads_waiting != num_threads) {
-                    std::this_thread::yield();
-                }
-            } else {
-                while (queue.isLocked()) {
-                    std::this_thread::yield();
+            while (queue.isLocked()) {
+                lock.unlock();
+                std::this_thread::yield();
+                lock.lock();
+            }
+        }
+    }
+
+    void clearParallelTasks() noexcept {
+        for (auto& deque : deques) {
+            while (auto task = deque->steal()) {
+                queued_parallel_tasks.fetch_sub(1u);
+                if (task->claim()) {
+                    if (task->batch != nullptr) {
+                        task->batch->onTaskDone();
+                    }
+                    unfinished_parallel_tasks.fetch_sub(1u);
                 }
+                task->release();
             }
         }
     }
@@ -219,6 +538,10 @@ Dispatcher::Dispatcher(uint32_t thread_count):
     } else {
         data_->thread_count = thread_count;
     }
+    data_->deques.reserve(data_->thread_count + 1u);
+    for (uint32_t i = 0; i <= data_->thread_count; ++i) {
+        data_->deques.emplace_back(new WorkStealingDeque);
+    }
 }
 
 Dispatcher::Dispatcher(Dispatcher&&) = default;
@@ -231,7 +554,10 @@ Dispatcher::~Dispatcher() {
     }
     data_->terminate = true;
     clear();
-    data_->jobs_available.notify_all();
+    {
+        std::lock_guard<std::mutex> lock{data_->park_mutex};
+        data_->jobs_available.notify_all();
+    }
     for (auto& thread : data_->threads)  {
         if (thread.joinable())
             thread.join();
@@ -245,40 +571,61 @@ void Dispatcher::initThreads() {
 
 void Dispatcher::clear() noexcept {
     MUSTACHE_PROFILER_BLOCK_LVL_0(__FUNCTION__ );
-    // TODO: ?
-    std::lock_guard<std::mutex> lock { data_->mutex };
-    data_->parallel_jobs.clear();
+    data_->clearParallelTasks();
 }
 
 void Dispatcher::waitForParallelFinish() const noexcept {
     MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
-    data_->wait(data_->parallel_jobs);
+    data_->waitParallel();
 }
 
 void Dispatcher::addJob(Job&& job) {
     MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
 
-    if(data_->single_thread_mode) {
+    if(data_->single_thread_mode.load(std::memory_order_relaxed)) {
         MUSTACHE_PROFILER_BLOCK_LVL_3("Run task");
         job(ThreadId::make(0));
         return;
     }
 
     initThreads();
-    {
-        std::unique_lock<std::mutex> lock{ data_->mutex };
-        data_->parallel_jobs.push(std::move(job));
+    data_->pushParallelTask(new Task{std::move(job)});
+}
+
+ParallelBatch Dispatcher::createBatch() {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+    ParallelBatch batch;
+    batch.data_->unfinished_dispatcher_tasks = &data_->unfinished_parallel_tasks;
+    batch.data_->thread_id = currentThreadId();
+    return batch;
+}
+
+void Dispatcher::addParallelTask(ParallelBatch& batch, Job&& job) {
+    MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
+    if (!batch.valid() || batch.data_->unfinished_dispatcher_tasks != &data_->unfinished_parallel_tasks) {
+        throw std::runtime_error("Batch was created by another dispatcher");
     }
-    data_->jobs_available.notify_one();
+
+    if(data_->single_thread_mode.load(std::memory_order_relaxed)) {
+        MUSTACHE_PROFILER_BLOCK_LVL_3("Run task");
+        job(ThreadId::make(0));
+        return;
+    }
+
+    initThreads();
+    auto& batch_data = *batch.data_;
+    auto task = new Task{std::move(job), &batch_data.completion};
+    batch_data.tasks.push_back(task);
+    batch_data.completion.remaining.fetch_add(1u);
+    data_->pushParallelTask(task);
 }
 
 Queue Dispatcher::createQueue(const std::string& name, int32_t priority) {
     MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
-    std::lock_guard<std::mutex> lock { data_->mutex };
+    std::lock_guard<std::mutex> lock { data_->extra.mutex };
     const QueueId index = static_cast<QueueId>(data_->extra.array.size());
     auto& info = data_->extra.array.emplace_back();
     info.reset(new JobQueue);
-    info->state = JobState::kUnlocked;
     data_->extra.by_name.emplace(name, index);
     data_->extra.by_priority.emplace(priority, index);
     Queue result;
@@ -289,17 +636,21 @@ Queue Dispatcher::createQueue(const std::string& name, int32_t priority) {
 
 void Dispatcher::async(QueueId queue_id, Job &&job) {
     MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
-    {
-        std::lock_guard<std::mutex> lock{data_->mutex};
-        data_->extra.array[queue_id]->jobs.emplace(std::move(job));
-    }
     initThreads();
-    data_->jobs_available.notify_one();
+    std::lock_guard<std::mutex> lock{data_->extra.mutex};
+    auto& queue = *data_->extra.array[queue_id];
+    queue.push(std::move(job));
+    data_->updateReadyState(queue);
 }
 
 void Dispatcher::waitQueue(QueueId queue_id) const noexcept {
     MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
-    data_->wait(*data_->extra.array[queue_id]);
+    JobQueue* queue = nullptr;
+    {
+        std::lock_guard<std::mutex> lock{data_->extra.mutex};
+        queue = data_->extra.array[queue_id].get();
+    }
+    data_->waitQueue(*queue);
 }
 
 uint32_t Dispatcher::maxThreadCount() noexcept {
@@ -310,7 +661,6 @@ uint32_t Dispatcher::maxThreadCount() noexcept {
 
 void Dispatcher::setSingleThreadMode(bool on) noexcept {
     MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
-    std::lock_guard<std::mutex> lock{data_->mutex};
     data_->single_thread_mode = on;
 }
 
@@ -324,6 +674,39 @@ ThreadId mustache::Dispatcher::currentThreadId() const noexcept {
     return data_->currentThreadId();
 }
 
+ParallelBatch::ParallelBatch():
+        data_{new Data} {
+
+}
+
+ParallelBatch::ParallelBatch(ParallelBatch&&) noexcept = default;
+
+ParallelBatch& ParallelBatch::operator=(ParallelBatch&& other) noexcept {
+    if (this != &other) {
+        wait();
+        data_ = std::move(other.data_);
+    }
+    return *this;
+}
+
+ParallelBatch::~ParallelBatch() {
+    wait();
+}
+
+bool ParallelBatch::isFinished() const noexcept {
+    return !data_ || data_->completion.remaining.load(std::memory_order_acquire) < 1u;
+}
+
+uint32_t ParallelBatch::taskCount() const noexcept {
+    return data_ ? static_cast<uint32_t>(data_->tasks.size()) : 0u;
+}
+
+void ParallelBatch::wait() const noexcept {
+    if (data_) {
+        data_->wait();
+    }
+}
+
 void Queue::async(Job&& job) {
     MUSTACHE_PROFILER_BLOCK_LVL_3(__FUNCTION__ );
     if(!valid()) {
@@ -2,6 +2,7 @@
 
 #include <mustache/utils/uncopiable.hpp>
 #include <mustache/utils/index_like.hpp>
+#include <mustache/utils/invoke.hpp>
 #include <mustache/utils/container_vector.hpp>
 
 #include <cstdint>
@@ -41,6 +42,28 @@ namespace mustache {
     struct ParallelTaskItemIndexInTask : public IndexLike<uint32_t , ParallelTaskItemIndexInTask> {};
     struct ParallelTaskGlobalItemIndex : public IndexLike<uint32_t , ParallelTaskGlobalItemIndex> {};
 
+    /// Handle of a group of parallel tasks with its own completion counter.
+    /// wait() runs not yet started tasks of this batch on the calling thread and returns as soon as the batch is done,
+    /// it does not wait for tasks of other batches. The destructor waits for unfinished tasks.
+    class MUSTACHE_EXPORT ParallelBatch : public Uncopiable {
+    public:
+        ParallelBatch();
+        ParallelBatch(ParallelBatch&&) noexcept;
+        ParallelBatch& operator=(ParallelBatch&&) noexcept;
+        ~ParallelBatch();
+
+        [[nodiscard]] bool valid() const noexcept {
+            return data_ != nullptr;
+        }
+        [[nodiscard]] bool isFinished() const noexcept;
+        [[nodiscard]] uint32_t taskCount() const noexcept;
+        void wait() const noexcept;
+    private:
+        friend Dispatcher;
+        struct Data;
+        std::unique_ptr<Data> data_;
+    };
+
     class MUSTACHE_EXPORT Dispatcher : public Uncopiable {
     public:
         uint32_t threadCount() const noexcept;
@@ -69,26 +92,43 @@ namespace mustache {
 
         template<typename _F>
         void parallelFor(_F&& function, size_t begin, size_t end, uint32_t task_count = 0u) {
-            const size_t size = end - begin;
-            if (task_count < 1u) {
-                task_count = size < threadCount() ? static_cast<uint32_t>(size) : threadCount();
-            }
-            const size_t ept = size / task_count;
-            const size_t tasks_with_extra_item = size - task_count * ept;
-
-            size_t task_begin = begin;
-            for (uint32_t task = 0; task < task_count; ++task) {
-                const auto task_size = task < tasks_with_extra_item ? ept + 1 : ept;
-                const auto task_id = ParallelTaskId::make(task);
-                addParallelTask([task_id, &function, task_end = task_begin + task_size, task_begin]{
+            auto batch = createBatch();
+            splitRange(begin, end, task_count, [this, &batch, &function](ParallelTaskId task_id,
+                    size_t task_begin, size_t task_end) {
+                addParallelTask(batch, [task_id, &function, task_end, task_begin]{
                     for (size_t i = task_begin; i < task_end; ++i) {
                         invoke(function, i, task_id);
                     }
                 });
+            });
+            batch.wait();
+        }
 
-                task_begin += task_size;
-            }
-            waitForParallelFinish();
+        // same as parallelFor, but does not block: the function is copied and the returned batch must be waited
+        template<typename _F>
+        [[nodiscard]] ParallelBatch parallelForAsync(_F&& function, size_t begin, size_t end, uint32_t task_count = 0u) {
+            auto batch = createBatch();
+            auto shared_function = std::make_shared<std::decay_t<_F> >(std::forward<_F>(function));
+            splitRange(begin, end, task_count, [this, &batch, &shared_function](ParallelTaskId task_id,
+                    size_t task_begin, size_t task_end) {
+                addParallelTask(batch, [task_id, shared_function, task_end, task_begin]{
+                    for (size_t i = task_begin; i < task_end; ++i) {
+                        invoke(*shared_function, i, task_id);
+                    }
+                });
+            });
+            return batch;
+        }
+
+        // batch tasks are published immediately, the batch may be waited independently of other tasks
+        [[nodiscard]] ParallelBatch createBatch();
+
+        void addParallelTask(ParallelBatch& batch, Job&& job);
+
+        void addParallelTask(ParallelBatch& batch, std::function<void()>&& job) {
+            addParallelTask(batch, [no_arg_job_job = std::move(job)](ThreadId) {
+                no_arg_job_job();
+            });
         }
 
         void addParallelTask(Job&& job) {
@@ -118,6 +158,27 @@ namespace mustache {
         // 1..threadCount for Dispatcher threads.
         [[nodiscard]] ThreadId currentThreadId() const noexcept;
     private:
+        template<typename _F>
+        void splitRange(size_t begin, size_t end, uint32_t task_count, _F&& add_task) {
+            const size_t size = end > begin ? end - begin : 0u;
+            if (size < 1u) {
+                return;
+            }
+            if (task_count < 1u) {
+                task_count = size < threadCount() ? static_cast<uint32_t>(size) : threadCount();
+                task_count = task_count < 1u ? 1u : task_count;
+            }
+            const size_t ept = size / task_count;
+            const size_t tasks_with_extra_item = size - task_count * ept;
+
+            size_t task_begin = begin;
+            for (uint32_t task = 0; task < task_count; ++task) {
+                const auto task_size = task < tasks_with_extra_item ? ept + 1 : ept;
+                add_task(ParallelTaskId::make(task), task_begin, task_begin + task_size);
+                task_begin += task_size;
+            }
+        }
+
         void addJob(Job&& job);
         struct Data;
         std::unique_ptr<Data> data_;
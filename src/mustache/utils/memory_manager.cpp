@@ -3,6 +3,8 @@
 #include <mustache/utils/profiler.hpp>
 #include <mustache/utils/container_map.hpp>
 
+#include <algorithm>
+#include <array>
 #include <cstdlib>
 #include <cstring>
 #include <mutex>
@@ -67,14 +69,8 @@ namespace {
 
     std::mutex pages_mutex;
     std::unordered_map<void*, size_t> pages;
-}
-
-using namespace mustache;
-
-const size_t MemoryManager::cache_size_l1d = get_l1d_cache_size();
 
-void* MemoryManager::allocate(size_t size, size_t align) noexcept {
-    MUSTACHE_PROFILER_BLOCK_LVL_3("MemoryManager::allocate");
+    void* alignedAllocate(size_t size, size_t align) noexcept {
 #ifdef _MSC_BUILD
 #define ALIGNED_ALLOC(size, align) _aligned_malloc(size, align)
 #elif defined(ANDROID)
@@ -82,23 +78,133 @@ void* MemoryManager::allocate(size_t size, size_t align) noexcept {
 #else
 #define ALIGNED_ALLOC(size, align) aligned_alloc(align, size)
 #endif
-    constexpr size_t min_align = 8;
-    if (align < min_align) {
-        align = min_align;
-        size = (size + align - 1) & ~(align - 1);
-    }
+        constexpr size_t min_align = 8;
+        if (align < min_align) {
+            align = min_align;
+            size = (size + align - 1) & ~(align - 1);
+        }
 #ifdef __APPLE__
-    void* ptr = (align < 8) ? malloc(size) : ALIGNED_ALLOC(size, align);
+        void* ptr = (align < 8) ? malloc(size) : ALIGNED_ALLOC(size, align);
 #else
-    void* ptr = (align == 0) ? malloc(size) : ALIGNED_ALLOC(size, align);
+        void* ptr = (align == 0) ? malloc(size) : ALIGNED_ALLOC(size, align);
 #endif
 
 #undef ALIGNED_ALLOC
 
-    if (ptr == nullptr) {
-        ptr = malloc(size);
+        if (ptr == nullptr) {
+            ptr = malloc(size);
+        }
+        return ptr;
     }
-    return ptr;
+
+    void alignedFree(void* ptr) noexcept {
+        if (ptr) {
+#ifdef _MSC_BUILD
+            _aligned_free(ptr);
+#else
+            free(ptr);
+#endif
+        }
+    }
+
+    // size classes are powers of two from min_pool_block_size to max_pool_block_size
+    constexpr size_t min_pool_block_size = 16;
+    constexpr size_t pool_size_class_count = 9;
+    constexpr size_t pool_slab_size = 64 * 1024;
+    // blocks moved between thread cache and central pool at once
+    constexpr uint32_t pool_batch_size = 32;
+    static_assert((min_pool_block_size << (pool_size_class_count - 1)) == mustache::MemoryManager::max_pool_block_size);
+
+    constexpr size_t poolSizeClass(size_t size, size_t align) noexcept {
+        size = std::max(std::max(size, align), min_pool_block_size);
+        size_t size_class = 0;
+        while ((min_pool_block_size << size_class) < size) {
+            ++size_class;
+        }
+        return size_class;
+    }
+
+    constexpr bool isPoolBlock(size_t size, size_t align) noexcept {
+        return size > 0 && size <= mustache::MemoryManager::max_pool_block_size && align <= mustache::MemoryManager::max_pool_block_size;
+    }
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct FreeList {
+        FreeBlock* head = nullptr;
+        uint32_t count = 0;
+
+        void push(FreeBlock* block) noexcept {
+            block->next = head;
+            head = block;
+            ++count;
+        }
+        FreeBlock* pop() noexcept {
+            FreeBlock* block = head;
+            head = block->next;
+            --count;
+            return block;
+        }
+        // moves up to max_count blocks to other list
+        void moveTo(FreeList& other, uint32_t max_count) noexcept {
+            while (head != nullptr && max_count-- > 0) {
+                other.push(pop());
+            }
+        }
+    };
+
+    struct CentralPool {
+        std::mutex mutex;
+        std::array<FreeList, pool_size_class_count> lists;
+
+        // slabs are never returned to the system
+        void refill(FreeList& thread_list, size_t size_class) {
+            std::lock_guard lock {mutex};
+            auto& list = lists[size_class];
+            if (list.head == nullptr) {
+                const size_t block_size = min_pool_block_size << size_class;
+                auto slab = static_cast<std::byte*>(alignedAllocate(pool_slab_size, mustache::MemoryManager::max_pool_block_size));
+                for (size_t offset = 0; offset + block_size <= pool_slab_size; offset += block_size) {
+                    list.push(reinterpret_cast<FreeBlock*>(slab + offset));
+                }
+            }
+            list.moveTo(thread_list, pool_batch_size);
+        }
+        void release(FreeList& thread_list, size_t size_class, uint32_t count) {
+            std::lock_guard lock {mutex};
+            thread_list.moveTo(lists[size_class], count);
+        }
+    };
+
+    CentralPool& centralPool() {
+        // never destroyed, thread caches return blocks at thread exit
+        static auto pool = new CentralPool;
+        return *pool;
+    }
+
+    struct ThreadCache {
+        std::array<FreeList, pool_size_class_count> lists;
+
+        ~ThreadCache() {
+            for (size_t size_class = 0; size_class < pool_size_class_count; ++size_class) {
+                centralPool().release(lists[size_class], size_class, lists[size_class].count);
+            }
+        }
+    };
+
+    thread_local ThreadCache thread_cache;
+}
+
+using namespace mustache;
+
+const size_t MemoryManager::cache_size_l1d = get_l1d_cache_size();
+
+void* MemoryManager::allocate(size_t size, size_t align) noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_3("MemoryManager::allocate");
+    allocations_.fetch_add(1u, std::memory_order_relaxed);
+    return alignedAllocate(size, align);
 }
 
 void* MemoryManager::allocateAndClear(size_t size, size_t align) noexcept {
@@ -111,14 +217,109 @@ void* MemoryManager::allocateAndClear(size_t size, size_t align) noexcept {
 void MemoryManager::deallocate(void* ptr) noexcept {
     MUSTACHE_PROFILER_BLOCK_LVL_3("MemoryManager::deallocate");
     if (ptr) {
-#ifdef _MSC_BUILD
-        _aligned_free(ptr);
-#else
-        free(ptr);
-#endif
+        deallocations_.fetch_add(1u, std::memory_order_relaxed);
+        alignedFree(ptr);
+    }
+}
+
+void* MemoryManager::poolAllocate(size_t size, size_t align) noexcept {
+    if (!isPoolBlock(size, align)) {
+        return alignedAllocate(size, align);
+    }
+    const auto size_class = poolSizeClass(size, align);
+    auto& list = thread_cache.lists[size_class];
+    if (list.head == nullptr) {
+        centralPool().refill(list, size_class);
+    }
+    return list.pop();
+}
+
+void MemoryManager::poolDeallocate(void* ptr, size_t size, size_t align) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    if (!isPoolBlock(size, align)) {
+        alignedFree(ptr);
+        return;
+    }
+    const auto size_class = poolSizeClass(size, align);
+    auto& list = thread_cache.lists[size_class];
+    list.push(static_cast<FreeBlock*>(ptr));
+    if (list.count > 2 * pool_batch_size) {
+        centralPool().release(list, size_class, pool_batch_size);
     }
 }
 
+void* MemoryManager::allocatePooled(size_t size, size_t align) noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_3("MemoryManager::allocatePooled");
+    allocations_.fetch_add(1u, std::memory_order_relaxed);
+    if (isPoolBlock(size, align)) {
+        pool_allocations_.fetch_add(1u, std::memory_order_relaxed);
+    }
+    return poolAllocate(size, align);
+}
+
+void MemoryManager::deallocatePooled(void* ptr, size_t size, size_t align) noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_3("MemoryManager::deallocatePooled");
+    if (ptr != nullptr) {
+        deallocations_.fetch_add(1u, std::memory_order_relaxed);
+        poolDeallocate(ptr, size, align);
+    }
+}
+
+void* MemoryManager::allocateFrame(size_t size, size_t align) noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_3("MemoryManager::allocateFrame");
+    align = std::max(align, alignof(std::max_align_t));
+    frame_allocations_.fetch_add(1u, std::memory_order_relaxed);
+    frame_bytes_.fetch_add(size, std::memory_order_relaxed);
+
+    std::lock_guard lock {frame_mutex_};
+    if (!frame_chunks_.empty()) {
+        const auto& [data, chunk_size] = frame_chunks_.back();
+        const auto address = reinterpret_cast<uintptr_t>(data) + frame_offset_;
+        const size_t offset = frame_offset_ + (((address + align - 1) & ~(align - 1)) - address);
+        if (offset + size <= chunk_size) {
+            frame_offset_ = offset + size;
+            return data + offset;
+        }
+    }
+    const size_t chunk_size = std::max(frame_chunk_size, (size + align + cache_line_size - 1) & ~(cache_line_size - 1));
+    auto data = static_cast<std::byte*>(alignedAllocate(chunk_size, cache_line_size));
+    frame_chunks_.emplace_back(data, chunk_size);
+    const auto address = reinterpret_cast<uintptr_t>(data);
+    const size_t offset = ((address + align - 1) & ~(align - 1)) - address;
+    frame_offset_ = offset + size;
+    return data + offset;
+}
+
+void MemoryManager::resetFrame() noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_2("MemoryManager::resetFrame");
+    std::lock_guard lock {frame_mutex_};
+    frame_bytes_.store(0u, std::memory_order_relaxed);
+    frame_offset_ = 0;
+    if (frame_chunks_.size() < 2) {
+        return;
+    }
+    // next frame of the same size fits in one chunk
+    size_t total_size = 0;
+    for (const auto& [data, size] : frame_chunks_) {
+        total_size += size;
+        alignedFree(data);
+    }
+    frame_chunks_.clear();
+    frame_chunks_.emplace_back(static_cast<std::byte*>(alignedAllocate(total_size, cache_line_size)), total_size);
+}
+
+MemoryManager::Statistics MemoryManager::statistics() const noexcept {
+    Statistics result;
+    result.allocations = allocations_.load(std::memory_order_relaxed);
+    result.deallocations = deallocations_.load(std::memory_order_relaxed);
+    result.pool_allocations = pool_allocations_.load(std::memory_order_relaxed);
+    result.frame_allocations = frame_allocations_.load(std::memory_order_relaxed);
+    result.frame_bytes = frame_bytes_.load(std::memory_order_relaxed);
+    return result;
+}
+
 void* MemoryManager::allocateSmart(size_t size, size_t align, bool allow_pages, bool allow_large_pages) noexcept {
     void* ptr = nullptr;
     if (allow_large_pages && size >= large_page_size) {
@@ -153,9 +354,9 @@ void* MemoryManager::allocateSmart(size_t size, size_t align, bool allow_pages,
 
 void MemoryManager::deallocateSmart(void* ptr) noexcept {
     if (reinterpret_cast<uintptr_t>(ptr) % page_size == 0) {
+        std::lock_guard lock {pages_mutex};
         const auto find_res = pages.find(ptr);
         if (find_res != pages.end()) {
-            std::lock_guard lock {pages_mutex};
 #ifdef _WIN32
             VirtualFree(ptr, 0, MEM_RELEASE);
 #else
@@ -169,3 +370,120 @@ void MemoryManager::deallocateSmart(void* ptr) noexcept {
     deallocate(ptr);
 }
 
+
+MemoryManager::~MemoryManager() {
+    for (const auto& [ptr, block] : huge_pages_) {
+        freeHugePagesBlock(ptr, block);
+    }
+    for (const auto& [data, size] : frame_chunks_) {
+        alignedFree(data);
+    }
+}
+
+void* MemoryManager::allocateHugePages(size_t size, PageType* type) noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_2("MemoryManager::allocateHugePages");
+    size = (size + large_page_size - 1) & ~(large_page_size - 1);
+
+    std::lock_guard lock {huge_pages_mutex_};
+    // reuse blocks that are at most twice as large as requested
+    const auto free_block = free_huge_pages_.lower_bound(size);
+    if (free_block != free_huge_pages_.end() && free_block->first <= 2 * size) {
+        void* ptr = free_block->second;
+        free_huge_pages_.erase(free_block);
+        auto& block = huge_pages_[ptr];
+        block.is_free = false;
+        if (type != nullptr) {
+            *type = block.type;
+        }
+        return ptr;
+    }
+
+    void* ptr = nullptr;
+    PageType result_type = PageType::kHugePages;
+#ifdef _WIN32
+    ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if (ptr == nullptr) {
+        ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        result_type = PageType::kPages;
+    }
+#else
+#ifdef MAP_HUGETLB
+    ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr == MAP_FAILED) ptr = nullptr;
+#endif
+    if (ptr == nullptr) {
+        // regular pages aligned to large_page_size, so the kernel can back them with transparent huge pages
+        const size_t mapped_size = size + large_page_size;
+        auto mapped = static_cast<std::byte*>(mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (mapped != MAP_FAILED) {
+            const auto address = reinterpret_cast<uintptr_t>(mapped);
+            const size_t head = ((address + large_page_size - 1) & ~(large_page_size - 1)) - address;
+            if (head > 0) {
+                munmap(mapped, head);
+            }
+            munmap(mapped + head + size, large_page_size - head);
+            ptr = mapped + head;
+            result_type = PageType::kPages;
+#ifdef MADV_HUGEPAGE
+            if (madvise(ptr, size, MADV_HUGEPAGE) == 0) {
+                result_type = PageType::kTransparentHugePages;
+            }
+#endif
+        }
+    }
+#endif
+    if (ptr == nullptr) {
+        Logger{}.error("Can not allocate %d bytes of pages", static_cast<int>(size));
+        return nullptr;
+    }
+    huge_pages_[ptr] = HugePagesBlock{size, result_type, false};
+    if (type != nullptr) {
+        *type = result_type;
+    }
+    return ptr;
+}
+
+void MemoryManager::deallocateHugePages(void* ptr) noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_2("MemoryManager::deallocateHugePages");
+    if (ptr == nullptr) {
+        return;
+    }
+    std::lock_guard lock {huge_pages_mutex_};
+    const auto find_res = huge_pages_.find(ptr);
+    if (find_res == huge_pages_.end() || find_res->second.is_free) {
+        Logger{}.error("Pointer is not an allocated block of huge pages pool");
+        return;
+    }
+    find_res->second.is_free = true;
+    free_huge_pages_.emplace(find_res->second.size, ptr);
+}
+
+void MemoryManager::releaseHugePagesPool() noexcept {
+    MUSTACHE_PROFILER_BLOCK_LVL_1("MemoryManager::releaseHugePagesPool");
+    std::lock_guard lock {huge_pages_mutex_};
+    for (const auto& [size, ptr] : free_huge_pages_) {
+        const auto find_res = huge_pages_.find(ptr);
+        freeHugePagesBlock(ptr, find_res->second);
+        huge_pages_.erase(find_res);
+    }
+    free_huge_pages_.clear();
+}
+
+size_t MemoryManager::hugePagesPoolSize() const noexcept {
+    std::lock_guard lock {huge_pages_mutex_};
+    size_t result = 0;
+    for (const auto& [size, ptr] : free_huge_pages_) {
+        result += size;
+    }
+    return result;
+}
+
+void MemoryManager::freeHugePagesBlock(void* ptr, const HugePagesBlock& block) noexcept {
+#ifdef _WIN32
+    (void) block;
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    munmap(ptr, block.size);
+#endif
+}
@@ -1,15 +1,54 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
 #include <mustache/utils/uncopiable.hpp>
 #include <mustache/utils/default_settings.hpp>
+#include <mustache/utils/container_map.hpp>
 
 namespace mustache {
     template<typename T>
     class Allocator;
 
+    // how large buffers (e.g. component storages) are allocated
+    enum class PagePolicy : uint32_t {
+        kDefault,   // heap
+        kHugePages  // 2MB pages from the MemoryManager pool
+    };
+
+    // memory actually used for a buffer
+    enum class PageType : uint32_t {
+        kHeap,
+        kPages,                 // regular pages, huge pages are not available
+        kTransparentHugePages,  // regular pages with madvise(MADV_HUGEPAGE), huge pages are not reserved in the system
+        kHugePages
+    };
+
+    enum class AllocationMode : uint32_t {
+        kPool,  // small blocks from size class pool, larger from heap
+        kFrame  // frame arena, deallocate does nothing, memory is released by MemoryManager::resetFrame
+    };
+
     class MUSTACHE_EXPORT MemoryManager : mustache::Uncopiable {
     public:
+        // largest block of size class pool
+        static constexpr size_t max_pool_block_size = 4096;
+        static constexpr size_t frame_chunk_size = 64 * 1024;
+
+        struct Statistics {
+            uint64_t allocations = 0;
+            uint64_t deallocations = 0;
+            uint64_t pool_allocations = 0; // part of allocations served by size class pool
+            uint64_t frame_allocations = 0;
+            uint64_t frame_bytes = 0; // allocated since last resetFrame
+        };
+
+        MemoryManager() = default;
+        ~MemoryManager();
+
         static const size_t cache_size_l1d;
         static constexpr size_t cache_line_size = 64;
         static constexpr size_t page_size = 1 << 12;
@@ -23,15 +62,67 @@ namespace mustache {
         [[nodiscard]] void* allocateSmart(size_t size, size_t align = 0, bool allow_pages = true, bool allow_large_pages = true) noexcept;
         void deallocateSmart(void* ptr) noexcept;
         void deallocate(void* ptr) noexcept;
+
+        /**
+         * Blocks up to max_pool_block_size are taken from process wide size class pool with per thread caches,
+         * larger blocks are allocated on heap. Block must be deallocated with the same size and align.
+         */
+        [[nodiscard]] void* allocatePooled(size_t size, size_t align = 0) noexcept;
+        void deallocatePooled(void* ptr, size_t size, size_t align = 0) noexcept;
+        // pool without statistics, for allocators without MemoryManager
+        [[nodiscard]] static void* poolAllocate(size_t size, size_t align = 0) noexcept;
+        static void poolDeallocate(void* ptr, size_t size, size_t align = 0) noexcept;
+
+        // scratch memory that is valid until resetFrame, thread safe
+        [[nodiscard]] void* allocateFrame(size_t size, size_t align = 0) noexcept;
+        // releases all frame allocations at once, must not run concurrently with allocateFrame
+        void resetFrame() noexcept;
+
+        [[nodiscard]] Statistics statistics() const noexcept;
+
+        /**
+         * Allocates large_page_size aligned block from the huge pages pool, size is rounded up to large_page_size.
+         * Tries hugetlb pages first, then transparent huge pages, type receives the kind of pages used.
+         */
+        [[nodiscard]] void* allocateHugePages(size_t size, PageType* type = nullptr) noexcept;
+        // block is kept in the pool for the next allocateHugePages
+        void deallocateHugePages(void* ptr) noexcept;
+        // returns unused blocks of the pool to the system
+        void releaseHugePagesPool() noexcept;
+        // size of unused blocks of the pool in bytes
+        [[nodiscard]] size_t hugePagesPoolSize() const noexcept;
+
         template<typename T>
-        Allocator<T> allocator() {
-            return Allocator<T>{*this};
+        Allocator<T> allocator(AllocationMode mode = AllocationMode::kPool) {
+            return Allocator<T>{*this, mode};
         }
 
         template<typename T>
         operator Allocator<T>() noexcept {
             return Allocator<T>(*this);
         }
+
+    private:
+        struct HugePagesBlock {
+            size_t size = 0;
+            PageType type = PageType::kHeap;
+            bool is_free = false;
+        };
+        static void freeHugePagesBlock(void* ptr, const HugePagesBlock& block) noexcept;
+
+        mutable std::mutex huge_pages_mutex_;
+        mustache::map<void*, HugePagesBlock> huge_pages_; // all blocks of the pool
+        mustache::multimap<size_t, void*> free_huge_pages_; // unused blocks by size
+
+        std::mutex frame_mutex_;
+        std::vector<std::pair<std::byte*, size_t> > frame_chunks_;
+        size_t frame_offset_ = 0; // in the last chunk
+
+        std::atomic<uint64_t> allocations_{0};
+        std::atomic<uint64_t> deallocations_{0};
+        std::atomic<uint64_t> pool_allocations_{0};
+        std::atomic<uint64_t> frame_allocations_{0};
+        std::atomic<uint64_t> frame_bytes_{0};
     };
 
     template<typename T>
@@ -39,43 +130,48 @@ namespace mustache {
     public:
         Allocator() = default;
 
-        Allocator(const Allocator& oth):
-                manager_{oth.manager_} {
+        Allocator(const Allocator& oth) = default;
+        Allocator& operator=(const Allocator& rhs) = default;
 
-        }
-        Allocator(Allocator&& oth):
-                manager_{oth.manager_} {
+        template<typename U>
+        Allocator(const Allocator<U>& oth) noexcept:
+                manager_{oth.manager_},
+                mode_{oth.mode_} {
 
         }
 
-        Allocator& operator=(const Allocator& rhs) {
-            return manager_ = rhs.manager_;
-        }
-
-        Allocator& operator=(Allocator&& rhs) {
-            return manager_ = rhs.manager_;
-        }
-
         bool operator==(const Allocator& rhs) const {
-            return manager_ == rhs.manager_;
+            return manager_ == rhs.manager_ && mode_ == rhs.mode_;
         }
 
         bool operator!=(const Allocator& rhs) const {
-            return manager_ != rhs.manager_;
+            return !(*this == rhs);
         }
 
-        constexpr Allocator(MemoryManager& manager):
-                manager_{&manager} {
+        constexpr Allocator(MemoryManager& manager, AllocationMode mode = AllocationMode::kPool):
+                manager_{&manager},
+                mode_{mode} {
 
         }
 
         T* allocate(size_t count) noexcept {
-            auto ptr = manager_->allocate(sizeof(T) * count, alignof(T));
+            void* ptr = nullptr;
+            if (manager_ == nullptr) {
+                ptr = MemoryManager::poolAllocate(sizeof(T) * count, alignof(T));
+            } else if (mode_ == AllocationMode::kFrame) {
+                ptr = manager_->allocateFrame(sizeof(T) * count, alignof(T));
+            } else {
+                ptr = manager_->allocatePooled(sizeof(T) * count, alignof(T));
+            }
             return static_cast<T*>(ptr);
         }
 
-        void deallocate(T* ptr, size_t /*count*/) noexcept {
-            manager_->deallocate(ptr);
+        void deallocate(T* ptr, size_t count) noexcept {
+            if (manager_ == nullptr) {
+                MemoryManager::poolDeallocate(ptr, sizeof(T) * count, alignof(T));
+            } else if (mode_ == AllocationMode::kPool) {
+                manager_->deallocatePooled(ptr, sizeof(T) * count, alignof(T));
+            }
         }
 
         operator MemoryManager&() const noexcept {
@@ -83,6 +179,10 @@ namespace mustache {
         }
         using value_type = T;
     private:
+        template<typename U>
+        friend class Allocator;
+
         MemoryManager* manager_ = nullptr;
+        AllocationMode mode_ = AllocationMode::kPool;
     };
 }
@@ -4,7 +4,7 @@
 
 namespace {
     template<size_t>
-    struct Component {
+    struct FactoryComponent {
 
     };
 }
@@ -18,11 +18,11 @@ TEST(ComponentFactory, ComponentMask) {
     };
 
     const std::array component_ids_actual = {
-            mustache::ComponentFactory::instance().registerComponent<Component<0> >(),
-            mustache::ComponentFactory::instance().registerComponent<Component<1> >(),
-            mustache::ComponentFactory::instance().registerComponent<Component<2> >(),
-            mustache::ComponentFactory::instance().registerComponent<Component<3> >(),
-            mustache::ComponentFactory::instance().registerComponent<Component<4> >()
+            mustache::ComponentFactory::instance().registerComponent<FactoryComponent<0> >(),
+            mustache::ComponentFactory::instance().registerComponent<FactoryComponent<1> >(),
+            mustache::ComponentFactory::instance().registerComponent<FactoryComponent<2> >(),
+            mustache::ComponentFactory::instance().registerComponent<FactoryComponent<3> >(),
+            mustache::ComponentFactory::instance().registerComponent<FactoryComponent<4> >()
     };
 
     static_assert(component_ids_actual.size() == component_ids_expected.size());
@@ -36,38 +36,60 @@ TEST(ComponentFactory, ComponentMask) {
     ASSERT_TRUE(mask.isEmpty());
     auto actual_mask = mustache::ComponentFactory::instance().makeMask<>();
     ASSERT_EQ(actual_mask, mask);
-    actual_mask = mustache::ComponentFactory::instance().makeMask<Component<0> >();
+    actual_mask = mustache::ComponentFactory::instance().makeMask<FactoryComponent<0> >();
     mask.add(component_ids_expected[0]);
     ASSERT_EQ(actual_mask, mask);
     mask.add(component_ids_expected[1]);
-    actual_mask = mustache::ComponentFactory::instance().makeMask<Component<0>, Component<1> >();
+    actual_mask = mustache::ComponentFactory::instance().makeMask<FactoryComponent<0>, FactoryComponent<1> >();
     ASSERT_EQ(actual_mask, mask);
     mask.add(component_ids_expected[1]);
     ASSERT_EQ(actual_mask, mask);
-    actual_mask = mustache::ComponentFactory::instance().makeMask<Component<0>, Component<1>, Component<0> >();
+    actual_mask = mustache::ComponentFactory::instance().makeMask<FactoryComponent<0>, FactoryComponent<1>, FactoryComponent<0> >();
     ASSERT_EQ(actual_mask, mask);
-    actual_mask = mustache::ComponentFactory::instance().makeMask<Component<0>, Component<1>, Component<2> >();
+    actual_mask = mustache::ComponentFactory::instance().makeMask<FactoryComponent<0>, FactoryComponent<1>, FactoryComponent<2> >();
     ASSERT_FALSE(actual_mask == mask);
     mask.add(component_ids_expected[2]);
     ASSERT_EQ(actual_mask, mask);
-    actual_mask = mustache::ComponentFactory::instance().makeMask<Component<0>, Component<1>, Component<2>,  Component<4> >();
+    actual_mask = mustache::ComponentFactory::instance().makeMask<FactoryComponent<0>, FactoryComponent<1>, FactoryComponent<2>,  FactoryComponent<4> >();
     mask.add(component_ids_expected[4]);
     ASSERT_EQ(actual_mask, mask);
-    actual_mask = mustache::ComponentFactory::instance().makeMask<Component<1>, Component<0>, Component<3>, Component<2>, Component<4> >();
+    actual_mask = mustache::ComponentFactory::instance().makeMask<FactoryComponent<1>, FactoryComponent<0>, FactoryComponent<3>, FactoryComponent<2>, FactoryComponent<4> >();
     mask.add(component_ids_expected[3]);
     ASSERT_EQ(actual_mask, mask);
 }
 
 TEST(ComponentFactory, ComponentMaskIsMatch) {
-    auto mask_0 = mustache::ComponentFactory::instance().makeMask<Component<0>, Component<1> >();
-    auto mask_1 = mustache::ComponentFactory::instance().makeMask<Component<0>, Component<1> >();
+    auto mask_0 = mustache::ComponentFactory::instance().makeMask<FactoryComponent<0>, FactoryComponent<1> >();
+    auto mask_1 = mustache::ComponentFactory::instance().makeMask<FactoryComponent<0>, FactoryComponent<1> >();
     ASSERT_TRUE(mask_0.isMatch(mask_1));
-    mask_1 = mustache::ComponentFactory::instance().makeMask<Component<0> >();
+    mask_1 = mustache::ComponentFactory::instance().makeMask<FactoryComponent<0> >();
     ASSERT_TRUE(mask_0.isMatch(mask_1));
-    mask_1 = mustache::ComponentFactory::instance().makeMask<Component<2> >();
+    mask_1 = mustache::ComponentFactory::instance().makeMask<FactoryComponent<2> >();
     ASSERT_FALSE(mask_0.isMatch(mask_1));
-    mask_1 = mustache::ComponentFactory::instance().makeMask<Component<0>, Component<1>, Component<2> >();
+    mask_1 = mustache::ComponentFactory::instance().makeMask<FactoryComponent<0>, FactoryComponent<1>, FactoryComponent<2> >();
     ASSERT_FALSE(mask_0.isMatch(mask_1));
-    mask_1 = mustache::ComponentFactory::instance().makeMask<Component<3>, Component<2> >();
+    mask_1 = mustache::ComponentFactory::instance().makeMask<FactoryComponent<3>, FactoryComponent<2> >();
     ASSERT_FALSE(mask_0.isMatch(mask_1));
 }
+
+TEST(ComponentFactory, ComponentFunction) {
+    using Function = mustache::ComponentFunction<int(int)>;
+    static_assert(sizeof(Function) == 3 * sizeof(void*));
+
+    Function empty;
+    ASSERT_FALSE(empty);
+    ASSERT_TRUE(empty == nullptr);
+
+    const Function plain {[](int value) {
+        return value + 1;
+    }};
+    ASSERT_TRUE(plain != nullptr);
+    ASSERT_EQ(plain(1), 2);
+
+    const int offset = 10;
+    const Function with_context {[](const void* context, int value) {
+        return value + *static_cast<const int*>(context);
+    }, &offset};
+    ASSERT_TRUE(with_context);
+    ASSERT_EQ(with_context(1), 11);
+}
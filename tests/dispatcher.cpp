@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
 #include <mustache/utils/dispatch.hpp>
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 TEST(Dispatcher, currentThreadId) {
     using namespace mustache;
     Dispatcher dispatcher0{5u};
@@ -29,3 +33,104 @@ TEST(Dispatcher, currentThreadId) {
         dispatcher1.waitForParallelFinish();
     }
 }
+
+TEST(Dispatcher, parallelForVisitsEveryIndexOnce) {
+    using namespace mustache;
+    Dispatcher dispatcher{4u};
+    constexpr uint32_t kSize = 100000u;
+    std::vector<std::atomic<uint32_t> > visited(kSize);
+    for (uint32_t iteration = 0; iteration < 16; ++iteration) {
+        dispatcher.parallelFor([&visited](size_t index) {
+            visited[index].fetch_add(1u, std::memory_order_relaxed);
+        }, 0, kSize, 64u);
+    }
+    for (const auto& value : visited) {
+        ASSERT_EQ(value.load(), 16u);
+    }
+}
+
+TEST(Dispatcher, tasksAddedFromWorkers) {
+    using namespace mustache;
+    Dispatcher dispatcher{4u};
+    std::atomic<uint32_t> count{0u};
+    constexpr uint32_t kOuterTasks = 64u;
+    constexpr uint32_t kInnerTasks = 32u;
+    for (uint32_t i = 0; i < kOuterTasks; ++i) {
+        dispatcher.addParallelTask([&dispatcher, &count](ThreadId thread_id) {
+            ASSERT_EQ(thread_id, dispatcher.currentThreadId());
+            for (uint32_t j = 0; j < kInnerTasks; ++j) {
+                dispatcher.addParallelTask([&count] {
+                    count.fetch_add(1u, std::memory_order_relaxed);
+                });
+            }
+        });
+    }
+    dispatcher.waitForParallelFinish();
+    ASSERT_EQ(count.load(), kOuterTasks * kInnerTasks);
+}
+
+TEST(Dispatcher, queueRunsOneTaskAtTime) {
+    using namespace mustache;
+    Dispatcher dispatcher{4u};
+    auto queue = dispatcher.createQueue("serial");
+    std::atomic<uint32_t> running{0u};
+    std::atomic<uint32_t> max_running{0u};
+    uint32_t count = 0u;
+    for (uint32_t i = 0; i < 256u; ++i) {
+        queue.async([&](ThreadId) {
+            const auto now_running = running.fetch_add(1u) + 1u;
+            auto prev = max_running.load();
+            while (prev < now_running && !max_running.compare_exchange_weak(prev, now_running)) {
+            }
+            ++count;
+            running.fetch_sub(1u);
+        });
+    }
+    queue.wait();
+    ASSERT_EQ(count, 256u);
+    ASSERT_EQ(max_running.load(), 1u);
+}
+
+TEST(Dispatcher, batchWaitsOnlyForItsOwnTasks) {
+    using namespace mustache;
+    Dispatcher dispatcher{2u};
+    std::atomic<bool> release_slow_task{false};
+    std::atomic<uint32_t> fast_count{0u};
+    dispatcher.addParallelTask([&release_slow_task] {
+        while (!release_slow_task.load()) {
+            std::this_thread::yield();
+        }
+    });
+    auto batch = dispatcher.createBatch();
+    for (uint32_t i = 0; i < 128u; ++i) {
+        dispatcher.addParallelTask(batch, [&fast_count] {
+            fast_count.fetch_add(1u);
+        });
+    }
+    ASSERT_EQ(batch.taskCount(), 128u);
+    batch.wait();
+    ASSERT_TRUE(batch.isFinished());
+    ASSERT_EQ(fast_count.load(), 128u);
+    release_slow_task = true;
+    dispatcher.waitForParallelFinish();
+}
+
+TEST(Dispatcher, parallelForAsync) {
+    using namespace mustache;
+    Dispatcher dispatcher{3u};
+    constexpr uint32_t kSize = 4096u;
+    std::vector<uint32_t> first(kSize, 0u);
+    std::vector<uint32_t> second(kSize, 0u);
+    auto first_batch = dispatcher.parallelForAsync([&first](size_t index) {
+        first[index] = static_cast<uint32_t>(index);
+    }, 0, kSize, 16u);
+    auto second_batch = dispatcher.parallelForAsync([&second](size_t index) {
+        second[index] = static_cast<uint32_t>(2 * index);
+    }, 0, kSize, 16u);
+    second_batch.wait();
+    first_batch.wait();
+    for (uint32_t i = 0; i < kSize; ++i) {
+        ASSERT_EQ(first[i], i);
+        ASSERT_EQ(second[i], 2 * i);
+    }
+}
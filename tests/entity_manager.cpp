@@ -3,6 +3,7 @@
 #include <gtest/gtest.h>
 
 #include <map>
+#include <set>
 #include <sstream>
 namespace {
     std::map<void*, std::string> created_components;
@@ -716,14 +717,15 @@ TEST(EntityManager, component_builder_to_modify) {
 }
 
 TEST(EntityManager, archetype_chunk_size) { // Should fail
+    // empty components are tags without versions, so every component has data here
     struct Component0 {
-
+        uint32_t value = 0;
     };
     struct Component1 {
-
+        uint32_t value = 1;
     };
     struct Component2 {
-
+        uint32_t value = 2;
     };
     mustache::World world;
     auto& entities = world.entities();
@@ -960,3 +962,784 @@ TEST(EntityManager, custom_constructor) {
         }
     });
 }
+
+TEST(EntityManager, archetype_transition_cache) {
+    struct Tag {
+    };
+    struct Extra {
+        uint32_t value = 0xDEADBEEF;
+    };
+
+    mustache::World world;
+    auto& entities = world.entities();
+
+    const auto e = entities.create<PodComponent<0> >();
+    auto* base = entities.getArchetypeOf(e);
+    entities.assign<Tag>(e);
+    auto* with_tag = entities.getArchetypeOf(e);
+    ASSERT_NE(base, with_tag);
+    const auto archetypes_count = entities.getArchetypesCount();
+
+    for (uint32_t i = 0; i < 16; ++i) {
+        entities.removeComponent<Tag>(e);
+        ASSERT_EQ(entities.getArchetypeOf(e), base);
+        ASSERT_FALSE(entities.hasComponent<Tag>(e));
+        entities.assign<Tag>(e);
+        ASSERT_EQ(entities.getArchetypeOf(e), with_tag);
+        ASSERT_TRUE(entities.hasComponent<Tag>(e));
+        ASSERT_TRUE(entities.hasComponent<PodComponent<0> >(e));
+    }
+    ASSERT_EQ(entities.getArchetypesCount(), archetypes_count);
+
+    // new dependency must not reuse transitions cached before it
+    entities.removeComponent<Tag>(e);
+    entities.addDependency<Tag, Extra>();
+    entities.assign<Tag>(e);
+    ASSERT_NE(entities.getArchetypeOf(e), with_tag);
+    ASSERT_TRUE(entities.hasComponent<Tag>(e));
+    ASSERT_TRUE(entities.hasComponent<Extra>(e));
+    ASSERT_EQ(entities.getComponent<Extra>(e)->value, 0xDEADBEEF);
+}
+
+TEST(EntityManager, add_and_remove_component_to_all) {
+    struct Value {
+        uint32_t value = 0u;
+    };
+    struct Name {
+        std::string name;
+    };
+    struct Excluded {
+    };
+    struct Tag {
+        uint32_t value = 0xDEADBEEF;
+    };
+
+    mustache::World world;
+    auto& entities = world.entities();
+    const auto& factory = mustache::ComponentFactory::instance();
+    static constexpr uint32_t kCount = 5000u;
+    mustache::vector<mustache::Entity> all;
+    for (uint32_t i = 0; i < kCount; ++i) {
+        all.push_back(entities.begin().assign<Value>(i).end());
+        all.push_back(entities.begin().assign<Value>(i).assign<Name>(std::to_string(i))
+                              .assign<ComponentWithCheck<5> >().end());
+        if (i % 3 == 0) {
+            all.push_back(entities.begin().assign<Value>(i).assign<Excluded>().end());
+        }
+    }
+    (void) entities.create<Name>();
+    // already has the component, must keep its value
+    entities.assign<Tag>(all[14]).value = 7u;
+
+    const auto check = [&entities, &all](bool tag_expected) {
+        for (const auto entity : all) {
+            ASSERT_TRUE(entities.isEntityValid(entity));
+            const auto value = entities.getComponent<Value>(entity)->value;
+            ASSERT_LT(value, kCount);
+            const auto name = entities.getComponent<Name>(entity);
+            if (name != nullptr) {
+                ASSERT_EQ(name->name, std::to_string(value));
+            }
+            const auto tag = entities.getComponent<Tag>(entity);
+            const bool is_excluded = entities.hasComponent<Excluded>(entity);
+            ASSERT_EQ(tag != nullptr, tag_expected && !is_excluded);
+            if (tag != nullptr) {
+                ASSERT_EQ(tag->value, entity == all[14] ? 7u : 0xDEADBEEF);
+            }
+        }
+    };
+
+    entities.addComponentToAll<Tag>(factory.makeMask<Value>(), factory.makeMask<Excluded>());
+    check(true);
+    uint32_t count = 0u;
+    entities.forEach([&count](const Tag&) {
+        ++count;
+    });
+    ASSERT_EQ(count, 2u * kCount);
+
+    entities.removeComponentFromAll<Tag>(factory.makeMask<Name>());
+    for (const auto entity : all) {
+        ASSERT_EQ(entities.hasComponent<Tag>(entity),
+                  !entities.hasComponent<Name>(entity) && !entities.hasComponent<Excluded>(entity));
+    }
+    entities.removeComponentFromAll<Tag>();
+    check(false);
+
+    entities.addComponentToAll<Tag>();
+    count = 0u;
+    entities.forEach([&count](const Tag& tag) {
+        ASSERT_EQ(tag.value, 0xDEADBEEF);
+        ++count;
+    });
+    ASSERT_EQ(count, all.size() + 1u);
+}
+
+TEST(EntityManager, create_group) {
+    struct Value {
+        uint32_t value = 0xDEADBEEF;
+    };
+
+    mustache::World world;
+    auto& entities = world.entities();
+    auto& archetype = entities.getArchetype<Value, ComponentWithCheck<6> >();
+    mustache::vector<mustache::Entity> destroyed;
+    for (uint32_t i = 0; i < 16; ++i) {
+        const auto entity = entities.create(archetype);
+        if (i % 2 == 0) {
+            destroyed.push_back(entity);
+        }
+    }
+    for (const auto entity : destroyed) {
+        entities.destroyNow(entity);
+    }
+
+    constexpr uint32_t kCount = 3000u;
+    const auto group = archetype.createGroup(kCount);
+    ASSERT_EQ(group.size(), kCount);
+    ASSERT_EQ(group.numFragmented(), destroyed.size());
+    ASSERT_EQ(archetype.size(), kCount + 8u);
+
+    std::set<mustache::Entity> unique;
+    for (const auto entity : group) {
+        ASSERT_TRUE(entities.isEntityValid(entity));
+        ASSERT_EQ(entities.getArchetypeOf(entity), &archetype);
+        ASSERT_EQ(entities.getComponent<Value>(entity)->value, 0xDEADBEEF);
+        ASSERT_TRUE(unique.insert(entity).second);
+    }
+    for (uint32_t i = group.numFragmented() + 1u; i < group.size(); ++i) {
+        ASSERT_EQ(group[i].id().toInt(), group[i - 1].id().toInt() + 1u);
+    }
+
+    // reused ids get the next version
+    for (const auto entity : destroyed) {
+        ASSERT_FALSE(entities.isEntityValid(entity));
+        ASSERT_EQ(unique.count(entity), 0u);
+    }
+
+    for (const auto entity : group) {
+        entities.destroyNow(entity);
+    }
+    ASSERT_EQ(archetype.size(), 8u);
+    ASSERT_EQ(entities.createGroup(archetype, 0u).size(), 0u);
+}
+
+TEST(EntityManager, batch_destroy) {
+    static uint32_t remove_calls = 0u;
+    struct Value {
+        uint32_t value = 0u;
+    };
+    struct WithHook {
+        static void beforeRemove() {
+            ++remove_calls;
+        }
+    };
+
+    mustache::World world;
+    auto& entities = world.entities();
+    constexpr uint32_t kCount = 3000u;
+    mustache::vector<mustache::Entity> all;
+    for (uint32_t i = 0; i < kCount; ++i) {
+        all.push_back(entities.begin().assign<Value>(i).assign<ComponentWithCheck<7> >().end());
+        all.push_back(entities.begin().assign<Value>(i).end());
+        all.push_back(entities.begin().assign<Value>(i).assign<WithHook>().end());
+    }
+    const auto should_destroy = [](uint32_t i) {
+        return i % 3 == 0 || i % 7 == 0 || i + 10 > kCount;
+    };
+    for (uint32_t i = 0; i < all.size(); ++i) {
+        if (should_destroy(i / 3)) {
+            entities.destroy(all[i]);
+            entities.destroy(all[i]); // marked once
+            ASSERT_TRUE(entities.isMarkedForDestroy(all[i]));
+        }
+    }
+    entities.update();
+
+    uint32_t hook_destroyed = 0u;
+    for (uint32_t i = 0; i < all.size(); ++i) {
+        const auto entity = all[i];
+        if (should_destroy(i / 3)) {
+            ASSERT_FALSE(entities.isEntityValid(entity));
+            ASSERT_FALSE(entities.isMarkedForDestroy(entity));
+            if (i % 3 == 2) {
+                ++hook_destroyed;
+            }
+        } else {
+            ASSERT_TRUE(entities.isEntityValid(entity));
+            ASSERT_EQ(entities.getComponent<Value>(entity)->value, i / 3);
+        }
+    }
+    ASSERT_EQ(remove_calls, hook_destroyed);
+    ASSERT_EQ(_counter_, created_components.size());
+
+    entities.destroyAll(mustache::ComponentFactory::instance().makeMask<Value>(),
+                        mustache::ComponentFactory::instance().makeMask<WithHook>());
+    for (uint32_t i = 0; i < all.size(); ++i) {
+        ASSERT_EQ(entities.isEntityValid(all[i]), i % 3 == 2 && !should_destroy(i / 3));
+    }
+    ASSERT_EQ(created_components.size(), 0u);
+
+    // archetypes are reusable after the whole content was dropped
+    const auto entity = entities.begin().assign<Value>(42u).assign<ComponentWithCheck<7> >().end();
+    ASSERT_EQ(entities.getComponent<Value>(entity)->value, 42u);
+    entities.destroyAll();
+    ASSERT_EQ(remove_calls, kCount);
+    ASSERT_FALSE(entities.isEntityValid(entity));
+}
+
+namespace {
+    uint32_t relocatable_moves_count = 0u;
+
+    // not trivially copyable, but a bitwise copy is a valid move
+    struct RelocatableVector {
+        RelocatableVector() = default;
+        explicit RelocatableVector(float value) noexcept:
+                x{value}, y{value * 2.0f}, z{value * 3.0f} {
+        }
+        RelocatableVector(const RelocatableVector&) = default;
+        RelocatableVector(RelocatableVector&& other) noexcept:
+                x{other.x}, y{other.y}, z{other.z} {
+            ++relocatable_moves_count;
+        }
+        RelocatableVector& operator=(const RelocatableVector&) = default;
+        RelocatableVector& operator=(RelocatableVector&& other) noexcept {
+            x = other.x;
+            y = other.y;
+            z = other.z;
+            ++relocatable_moves_count;
+            return *this;
+        }
+        float x = 0.0f;
+        float y = 0.0f;
+        float z = 0.0f;
+    };
+    struct RelocatableTag {
+        uint32_t value = 0u;
+    };
+}
+
+template<>
+struct mustache::IsTriviallyRelocatable<RelocatableVector> : std::true_type {};
+
+TEST(EntityManager, trivially_relocatable_component) {
+    static constexpr uint32_t kCount = 4096u;
+    auto& factory = mustache::ComponentFactory::instance();
+    ASSERT_TRUE(factory.componentInfo(factory.registerComponent<RelocatableVector>()).trivially_relocatable);
+    ASSERT_TRUE(factory.componentInfo(factory.registerComponent<RelocatableTag>()).trivially_relocatable);
+    ASSERT_FALSE(factory.componentInfo(factory.registerComponent<std::string>()).trivially_relocatable);
+
+    mustache::World world;
+    auto& entities = world.entities();
+    std::vector<mustache::Entity> created;
+    for (uint32_t i = 0; i < kCount; ++i) {
+        created.push_back(entities.begin().assign<RelocatableVector>(static_cast<float>(i)).end());
+    }
+    relocatable_moves_count = 0u;
+
+    // storage growth, archetype changes and removes do not call move functions
+    for (uint32_t i = 0; i < kCount; i += 2u) {
+        entities.assign<RelocatableTag>(created[i], i);
+    }
+    for (uint32_t i = 0; i < kCount; i += 3u) {
+        entities.destroyNow(created[i]);
+    }
+    ASSERT_EQ(relocatable_moves_count, 0u);
+
+    for (uint32_t i = 0; i < kCount; ++i) {
+        if (i % 3u == 0u) {
+            ASSERT_FALSE(entities.isEntityValid(created[i]));
+            continue;
+        }
+        const auto value = entities.getComponent<RelocatableVector>(created[i]);
+        ASSERT_NE(value, nullptr);
+        ASSERT_EQ(value->x, static_cast<float>(i));
+        ASSERT_EQ(value->z, static_cast<float>(i) * 3.0f);
+        ASSERT_EQ(entities.hasComponent<RelocatableTag>(created[i]), i % 2u == 0u);
+    }
+}
+
+TEST(EntityManager, huge_pages_storage) {
+    struct HugePagesComponent {
+        uint64_t value = 0u;
+        uint64_t padding[3] = {};
+    };
+    struct SmallComponent {
+        uint32_t value = 0u;
+    };
+    // 8MB of components
+    static constexpr uint32_t kCount = 1u << 18u;
+
+    mustache::WorldContext context;
+    context.memory_manager = std::make_shared<mustache::MemoryManager>();
+    context.storage_page_policy = mustache::PagePolicy::kHugePages;
+    {
+        mustache::World world{context};
+        auto& entities = world.entities();
+        auto& archetype = entities.getArchetype<HugePagesComponent>();
+        for (uint32_t i = 0; i < kCount; ++i) {
+            (void) entities.begin().assign<HugePagesComponent>(i).end();
+        }
+        (void) entities.begin().assign<SmallComponent>(1u).end();
+
+#ifdef __linux__
+        ASSERT_NE(archetype.storagePageType(), mustache::PageType::kHeap);
+#endif
+        ASSERT_EQ(entities.getArchetype<SmallComponent>().storagePageType(), mustache::PageType::kHeap);
+
+        uint64_t sum = 0u;
+        entities.forEach([&sum](const HugePagesComponent& component) {
+            sum += component.value;
+        });
+        ASSERT_EQ(sum, static_cast<uint64_t>(kCount) * (kCount - 1u) / 2u);
+        entities.clear();
+    }
+
+    // freed buffers stay in the pool until released
+    auto& memory_manager = *context.memory_manager;
+#ifdef __linux__
+    ASSERT_GT(memory_manager.hugePagesPoolSize(), 0u);
+#endif
+    memory_manager.releaseHugePagesPool();
+    ASSERT_EQ(memory_manager.hugePagesPoolSize(), 0u);
+}
+
+namespace {
+    struct SparseSelected {
+        uint32_t value = 0u;
+    };
+    struct SparseName {
+        SparseName() = default;
+        explicit SparseName(std::string str):
+                name{std::move(str)} {
+        }
+        std::string name;
+    };
+    struct SparseDensePosition {
+        uint32_t value = 0u;
+    };
+}
+
+template<>
+struct mustache::IsSparseComponent<SparseSelected> : std::true_type {};
+template<>
+struct mustache::IsSparseComponent<SparseName> : std::true_type {};
+
+TEST(EntityManager, sparse_component) {
+    static constexpr uint32_t kCount = 10000u;
+    mustache::World world;
+    auto& entities = world.entities();
+    auto& archetype = entities.getArchetype<SparseDensePosition>();
+    std::vector<mustache::Entity> created;
+    for (uint32_t i = 0; i < kCount; ++i) {
+        created.push_back(entities.begin().assign<SparseDensePosition>(i).end());
+    }
+    for (uint32_t i = 0; i < kCount; i += 3u) {
+        entities.assign<SparseSelected>(created[i], i);
+        entities.assign<SparseName>(created[i], std::to_string(i));
+    }
+    for (uint32_t i = 0; i < kCount; i += 6u) {
+        entities.removeComponent<SparseName>(created[i]);
+    }
+
+    // sparse components do not move entities between archetypes
+    ASSERT_EQ(archetype.size(), kCount);
+    for (uint32_t i = 0; i < kCount; ++i) {
+        ASSERT_EQ(entities.getArchetypeOf(created[i]), &archetype);
+        ASSERT_EQ(entities.hasComponent<SparseSelected>(created[i]), i % 3u == 0u);
+        ASSERT_EQ(entities.hasComponent<SparseName>(created[i]), i % 3u == 0u && i % 6u != 0u);
+        if (i % 3u == 0u) {
+            ASSERT_EQ(entities.getComponent<SparseSelected>(created[i])->value, i);
+        }
+        if (i % 3u == 0u && i % 6u != 0u) {
+            ASSERT_EQ(entities.getComponent<SparseName>(created[i])->name, std::to_string(i));
+        }
+    }
+
+    // required sparse component skips entities without it, optional one is nullptr for them
+    uint32_t selected_count = 0u;
+    uint32_t named_count = 0u;
+    entities.forEach([&selected_count](const SparseDensePosition& position, const SparseSelected& selected) {
+        ASSERT_EQ(position.value, selected.value);
+        ++selected_count;
+    });
+    entities.forEach([&named_count](const SparseDensePosition& position, const SparseName* name) {
+        if (name != nullptr) {
+            ASSERT_EQ(name->name, std::to_string(position.value));
+            ++named_count;
+        }
+    });
+    ASSERT_EQ(selected_count, (kCount + 2u) / 3u);
+    ASSERT_EQ(named_count, (kCount + 2u) / 3u - (kCount + 5u) / 6u);
+
+    // changes made while iterating are applied on unlock
+    entities.forEach([&entities](mustache::Entity entity, const SparseDensePosition& position) {
+        if (position.value % 3u == 0u) {
+            entities.removeComponent<SparseSelected>(entity);
+        } else if (position.value % 3u == 1u) {
+            entities.assign<SparseSelected>(entity, position.value * 2u);
+        }
+    }, mustache::JobRunMode::kParallel);
+    selected_count = 0u;
+    entities.forEach([&selected_count](const SparseDensePosition& position, SparseSelected& selected) {
+        ASSERT_EQ(position.value % 3u, 1u);
+        ASSERT_EQ(selected.value, position.value * 2u);
+        ++selected_count;
+    }, mustache::JobRunMode::kParallel);
+    ASSERT_EQ(selected_count, (kCount + 1u) / 3u);
+
+    // destroyed entities leave sparse storages
+    auto storage = entities.sparseStorage(mustache::ComponentFactory::instance().registerComponent<SparseSelected>());
+    ASSERT_NE(storage, nullptr);
+    ASSERT_EQ(storage->size(), selected_count);
+    for (uint32_t i = 1; i < kCount; i += 3u) {
+        entities.destroyNow(created[i]);
+    }
+    ASSERT_EQ(storage->size(), 0u);
+    const auto reused = entities.create<SparseDensePosition>();
+    ASSERT_FALSE(entities.hasComponent<SparseSelected>(reused));
+    ASSERT_EQ(entities.getComponent<SparseSelected>(reused), nullptr);
+}
+
+namespace {
+    struct SparseWithHook {
+        static uint32_t remove_calls;
+        static uint32_t wrong_state_calls;
+        uint32_t value = 0u;
+        static void beforeRemove(const SparseWithHook& self, mustache::Entity entity, mustache::World& world) {
+            ++remove_calls;
+            // the entity is still alive and keeps its dense components while the hook is called
+            auto& entities = world.entities();
+            const auto position = entities.isEntityValid(entity) ?
+                    entities.getComponent<SparseDensePosition>(entity) : nullptr;
+            if (position == nullptr || position->value != self.value) {
+                ++wrong_state_calls;
+            }
+        }
+    };
+    uint32_t SparseWithHook::remove_calls = 0u;
+    uint32_t SparseWithHook::wrong_state_calls = 0u;
+}
+
+template<>
+struct mustache::IsSparseComponent<SparseWithHook> : std::true_type {};
+
+TEST(EntityManager, sparse_component_destroy_hooks) {
+    static constexpr uint32_t kCount = 3000u;
+    SparseWithHook::remove_calls = 0u;
+    SparseWithHook::wrong_state_calls = 0u;
+    mustache::World world;
+    auto& entities = world.entities();
+    std::vector<mustache::Entity> created;
+    for (uint32_t i = 0; i < kCount; ++i) {
+        created.push_back(entities.begin().assign<SparseDensePosition>(i).end());
+        if (i % 3u == 0u) {
+            entities.assign<SparseWithHook>(created[i], i);
+        }
+        if (i % 2u == 0u) {
+            entities.assign<SparseSelected>(created[i], i);
+        }
+    }
+    const auto& factory = mustache::ComponentFactory::instance();
+    const auto hooked_storage = entities.sparseStorage(factory.registerComponent<SparseWithHook>());
+    const auto plain_storage = entities.sparseStorage(factory.registerComponent<SparseSelected>());
+    ASSERT_NE(hooked_storage, nullptr);
+    ASSERT_NE(plain_storage, nullptr);
+
+    // batched destroy, entities with sparse hooks are destroyed one by one
+    uint32_t hooked_destroyed = 0u;
+    for (uint32_t i = 0; i < kCount / 2u; ++i) {
+        entities.destroy(created[i]);
+        if (i % 3u == 0u) {
+            ++hooked_destroyed;
+        }
+    }
+    entities.update();
+    ASSERT_EQ(SparseWithHook::remove_calls, hooked_destroyed);
+    ASSERT_EQ(SparseWithHook::wrong_state_calls, 0u);
+    for (uint32_t i = 0; i < kCount; ++i) {
+        ASSERT_EQ(entities.isEntityValid(created[i]), i >= kCount / 2u);
+    }
+    ASSERT_EQ(hooked_storage->size(), (kCount + 2u) / 3u - hooked_destroyed);
+    ASSERT_EQ(plain_storage->size(), (kCount - kCount / 2u + 1u) / 2u);
+
+    entities.destroyAll(factory.makeMask<SparseDensePosition>(), mustache::ComponentIdMask::null());
+    ASSERT_EQ(SparseWithHook::remove_calls, (kCount + 2u) / 3u);
+    ASSERT_EQ(SparseWithHook::wrong_state_calls, 0u);
+    ASSERT_EQ(hooked_storage->size(), 0u);
+    ASSERT_EQ(plain_storage->size(), 0u);
+}
+
+namespace {
+    struct TagPosition {
+        uint32_t value = 0u;
+    };
+    struct TagEnemy {
+
+    };
+    struct TagFrozen {
+
+    };
+}
+
+TEST(EntityManager, tag_component) {
+    static constexpr uint32_t kCount = 1000u;
+    static_assert(mustache::isTagComponent<TagEnemy>());
+    static_assert(!mustache::isTagComponent<TagPosition>());
+    mustache::World world;
+    auto& entities = world.entities();
+    for (uint32_t i = 0; i < kCount; ++i) {
+        const auto entity = entities.create<TagPosition>();
+        entities.getComponent<TagPosition>(entity)->value = i;
+        if (i % 2u == 0u) {
+            entities.assign<TagEnemy>(entity);
+        }
+    }
+
+    // tags are in the archetype mask but have no column
+    auto& archetype = entities.getArchetype<TagPosition, TagEnemy>();
+    const auto enemy_id = mustache::ComponentFactory::instance().registerComponent<TagEnemy>();
+    ASSERT_TRUE(archetype.hasComponent(enemy_id));
+    ASSERT_TRUE(archetype.getComponentIndex(enemy_id).isNull());
+    ASSERT_EQ(archetype.size(), kCount / 2u);
+
+    const auto entity = *archetype.entityAt(mustache::ArchetypeEntityIndex::make(0u));
+    ASSERT_TRUE(entities.hasComponent<TagEnemy>(entity));
+    ASSERT_NE(entities.getComponent<TagEnemy>(entity), nullptr);
+    ASSERT_FALSE(entities.hasComponent<TagFrozen>(entity));
+    ASSERT_EQ(entities.getComponent<TagFrozen>(entity), nullptr);
+
+    uint32_t enemy_count = 0u;
+    uint32_t optional_count = 0u;
+    entities.forEach([&enemy_count](const TagPosition& position, const TagEnemy&) {
+        ASSERT_EQ(position.value % 2u, 0u);
+        ++enemy_count;
+    });
+    entities.forEach([&optional_count](const TagPosition& position, const TagEnemy* enemy) {
+        ASSERT_EQ(enemy != nullptr, position.value % 2u == 0u);
+        ++optional_count;
+    });
+    ASSERT_EQ(enemy_count, kCount / 2u);
+    ASSERT_EQ(optional_count, kCount);
+
+    // moving between archetypes keeps the data of other components
+    entities.removeComponent<TagEnemy>(entity);
+    ASSERT_FALSE(entities.hasComponent<TagEnemy>(entity));
+    ASSERT_EQ(entities.getComponent<TagPosition>(entity)->value, 0u);
+}
+
+namespace {
+    struct EnabledValue {
+        uint32_t value = 0u;
+    };
+    struct EnabledExtra {
+        uint32_t value = 0u;
+    };
+}
+
+TEST(EntityManager, disabled_entities) {
+    static constexpr uint32_t kCount = 10000u;
+    mustache::World world;
+    auto& entities = world.entities();
+    mustache::vector<mustache::Entity> created;
+    for (uint32_t i = 0; i < kCount; ++i) {
+        const auto entity = entities.create<EnabledValue>();
+        entities.getComponent<EnabledValue>(entity)->value = i;
+        created.push_back(entity);
+    }
+    auto& archetype = entities.getArchetype<EnabledValue>();
+
+    // every third entity is disabled, it stays in its archetype
+    for (uint32_t i = 0; i < kCount; i += 3u) {
+        entities.setEnabled(created[i], false);
+    }
+    ASSERT_EQ(archetype.size(), kCount);
+    ASSERT_EQ(archetype.disabledCount(), (kCount + 2u) / 3u);
+    ASSERT_FALSE(entities.isEnabled(created[0]));
+    ASSERT_TRUE(entities.isEnabled(created[1]));
+
+    const auto count_enabled = [&entities](mustache::JobRunMode mode) {
+        std::atomic<uint32_t> count{0u};
+        entities.forEach([&count](const EnabledValue& value) {
+            ASSERT_NE(value.value % 3u, 0u);
+            ++count;
+        }, mode);
+        return count.load();
+    };
+    const uint32_t expected = kCount - (kCount + 2u) / 3u;
+    ASSERT_EQ(count_enabled(mustache::JobRunMode::kCurrentThread), expected);
+    ASSERT_EQ(count_enabled(mustache::JobRunMode::kParallel), expected);
+
+    // the state follows entities that change archetype or fill a hole
+    entities.assign<EnabledExtra>(created[3]);
+    ASSERT_FALSE(entities.isEnabled(created[3]));
+    ASSERT_FALSE(entities.isEnabled(created[kCount - 1u]));
+    entities.destroyNow(created[0]);
+    ASSERT_TRUE(entities.isEnabled(created[kCount - 2u]));
+    ASSERT_EQ(archetype.disabledCount(), (kCount + 2u) / 3u - 2u);
+
+    // toggling is safe while iterating
+    entities.forEach([&entities, &created](const EnabledValue&) {
+        entities.setEnabled(created[3], true);
+    }, mustache::JobRunMode::kParallel);
+    ASSERT_TRUE(entities.isEnabled(created[3]));
+    entities.forEach([&entities](mustache::Entity entity, const EnabledValue&) {
+        entities.setEnabled(entity, false);
+    }, mustache::JobRunMode::kParallel);
+    ASSERT_EQ(archetype.disabledCount(), archetype.size());
+    ASSERT_EQ(count_enabled(mustache::JobRunMode::kCurrentThread), 0u);
+    ASSERT_EQ(count_enabled(mustache::JobRunMode::kParallel), 0u);
+}
+
+namespace {
+    struct HotPosition {
+        uint32_t value = 0u;
+    };
+    struct HotVelocity {
+        uint32_t value = 0u;
+    };
+    struct ColdDebugInfo {
+        std::array<char, 2048> text{};
+        uint32_t value = 0u;
+    };
+    struct ColdByFunction {
+        uint64_t value = 0u;
+    };
+}
+
+template<>
+struct mustache::IsColdComponent<ColdDebugInfo> : std::true_type {};
+
+TEST(EntityManager, cold_component) {
+    static constexpr uint32_t kCount = 5000u;
+    mustache::World world;
+    auto& entities = world.entities();
+    const auto& factory = mustache::ComponentFactory::instance();
+    const auto position_id = factory.registerComponent<HotPosition>();
+    const auto by_function_id = factory.registerComponent<ColdByFunction>();
+    entities.addColdComponentsFunction([position_id, by_function_id](const mustache::ComponentIdMask& mask) {
+        mustache::ComponentIdMask result;
+        result.set(by_function_id, mask.has(position_id));
+        return result;
+    });
+
+    mustache::vector<mustache::Entity> created;
+    for (uint32_t i = 0; i < kCount; ++i) {
+        const auto entity = entities.create<HotPosition, HotVelocity, ColdDebugInfo, ColdByFunction>();
+        entities.getComponent<HotPosition>(entity)->value = i;
+        entities.getComponent<HotVelocity>(entity)->value = 2u * i;
+        entities.getComponent<ColdDebugInfo>(entity)->value = 3u * i;
+        entities.getComponent<ColdByFunction>(entity)->value = 4u * i;
+        created.push_back(entity);
+    }
+    const auto& archetype = entities.getArchetype<HotPosition, HotVelocity, ColdDebugInfo, ColdByFunction>();
+    ASSERT_FALSE(archetype.isComponentCold(position_id));
+    ASSERT_FALSE(archetype.isComponentCold(factory.registerComponent<HotVelocity>()));
+    ASSERT_TRUE(archetype.isComponentCold(factory.registerComponent<ColdDebugInfo>()));
+    ASSERT_TRUE(archetype.isComponentCold(by_function_id));
+
+    // hot columns are adjacent, cold ones are in another buffer
+    const auto position = reinterpret_cast<std::byte*>(entities.getComponent<HotPosition>(created[0]));
+    const auto velocity = reinterpret_cast<std::byte*>(entities.getComponent<HotVelocity>(created[0]));
+    const auto column_size = static_cast<std::ptrdiff_t>(archetype.capacity() * sizeof(HotPosition));
+    ASSERT_LE(std::abs(velocity - position), column_size + static_cast<std::ptrdiff_t>(mustache::MemoryManager::cache_line_size));
+
+    for (uint32_t i = 0; i < kCount; i += 2u) {
+        entities.destroyNow(created[i]);
+    }
+    uint32_t count = 0u;
+    entities.forEach([&count](const HotPosition& position, const HotVelocity& velocity,
+            const ColdDebugInfo& info, const ColdByFunction& by_function) {
+        ASSERT_EQ(position.value % 2u, 1u);
+        ASSERT_EQ(velocity.value, 2u * position.value);
+        ASSERT_EQ(info.value, 3u * position.value);
+        ASSERT_EQ(by_function.value, 4u * position.value);
+        ++count;
+    });
+    ASSERT_EQ(count, kCount / 2u);
+}
+
+namespace {
+    struct CompactValue {
+        uint32_t value = 0u;
+    };
+    struct CompactName {
+        std::string name;
+    };
+}
+
+TEST(EntityManager, compact_memory) {
+    static constexpr uint32_t kCount = 10000u;
+    mustache::World world;
+    auto& entities = world.entities();
+    const auto create = [&entities](uint32_t value) {
+        const auto entity = entities.create<CompactValue, CompactName>();
+        entities.getComponent<CompactValue>(entity)->value = value;
+        entities.getComponent<CompactName>(entity)->name = std::to_string(value) + " name is long enough for heap";
+        return entity;
+    };
+    const auto check = [&entities](uint32_t expected_count) {
+        uint32_t count = 0u;
+        entities.forEach([&count](const CompactValue& value, const CompactName& name) {
+            ASSERT_EQ(name.name, std::to_string(value.value) + " name is long enough for heap");
+            ++count;
+        });
+        ASSERT_EQ(count, expected_count);
+    };
+
+    mustache::vector<mustache::Entity> created;
+    for (uint32_t i = 0; i < kCount; ++i) {
+        created.push_back(create(i));
+    }
+    const auto& archetype = entities.getArchetype<CompactValue, CompactName>();
+    const auto full_capacity = archetype.capacity();
+    // finishes the growth migration, the storage is used enough to keep its capacity
+    entities.shrinkToFit();
+    ASSERT_TRUE(archetype.isCompacted());
+    ASSERT_EQ(archetype.capacity(), full_capacity);
+    const auto full_size = archetype.allocatedSize();
+
+    for (uint32_t i = 0; i < kCount; ++i) {
+        if (i % 16u != 0u) {
+            entities.destroyNow(created[i]);
+        }
+    }
+    ASSERT_FALSE(archetype.isCompacted());
+    // removing entities does not release memory
+    ASSERT_EQ(archetype.capacity(), full_capacity);
+
+    // shrink is split into steps, insertions in the middle of it are fine
+    ASSERT_FALSE(entities.compactMemory(100u));
+    check(kCount / 16u);
+    for (uint32_t i = kCount; i < kCount + 10u; ++i) {
+        created.push_back(create(i));
+    }
+    uint32_t steps = 1u;
+    while (!entities.compactMemory(100u)) {
+        ++steps;
+    }
+    ASSERT_GT(steps, 2u);
+    ASSERT_TRUE(archetype.isCompacted());
+    ASSERT_LT(archetype.capacity(), full_capacity);
+    ASSERT_GE(archetype.capacity(), 2u * archetype.size());
+    ASSERT_LT(archetype.allocatedSize(), full_size);
+    check(kCount / 16u + 10u);
+
+    // empty archetype releases everything and is refilled
+    for (auto entity : created) {
+        if (entities.isEntityValid(entity)) {
+            entities.destroyNow(entity);
+        }
+    }
+    ASSERT_TRUE(entities.compactMemory(0u));
+    ASSERT_EQ(archetype.allocatedSize(), 0u);
+    created.clear();
+    for (uint32_t i = 0; i < kCount; ++i) {
+        created.push_back(create(i));
+    }
+    check(kCount);
+    for (auto entity : created) {
+        entities.destroyNow(entity);
+    }
+    entities.shrinkToFit();
+    ASSERT_EQ(archetype.allocatedSize(), 0u);
+}
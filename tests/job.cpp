@@ -1,9 +1,13 @@
 #include <mustache/ecs/entity_manager.hpp>
 #include <mustache/ecs/world.hpp>
 #include <mustache/ecs/job.hpp>
+#include <mustache/ecs/fused_job.hpp>
 #include <mustache/ecs/non_template_job.hpp>
 #include <gtest/gtest.h>
 #include <map>
+#include <atomic>
+#include <limits>
+#include <vector>
 
 namespace {
     struct Position {
@@ -20,6 +24,32 @@ namespace {
         uint32_t z = 0u;
     };
 
+    struct LaneValue {
+        float value = 0.0f;
+    };
+    struct LaneSpeed {
+        float value = 0.0f;
+    };
+
+    struct ReducedValue {
+        uint32_t value = 0u;
+    };
+
+    struct FilterA {};
+    struct FilterB {};
+    struct FilterC {};
+    struct FilterD {};
+
+    struct FusedPosition {
+        int x = 0;
+    };
+    struct FusedVelocity {
+        int value = 0;
+    };
+    struct FusedBounds {
+        int max = 0;
+    };
+
     struct Component0 {
 
     };
@@ -394,6 +424,321 @@ TEST(Job, iterate_multithread_4_archetypes_match_4_not) {
     }
 }
 
+TEST(Job, dynamic_schedule) {
+    struct Job0 : public mustache::PerEntityJob<Job0> {
+        std::vector<std::atomic<uint32_t> >* visited = nullptr;
+        void operator()(Position& position, mustache::JobInvocationIndex job_invocation_index) {
+            ++position.x;
+            (*visited)[job_invocation_index.entity_index.toInt()].fetch_add(1u, std::memory_order_relaxed);
+        }
+    };
+
+    mustache::WorldContext context;
+    context.dispatcher = std::make_shared<mustache::Dispatcher>(3u);
+    mustache::World world{context};
+    auto& entities = world.entities();
+    std::vector<mustache::Entity> created_entities;
+    for (uint32_t i = 0; i < kNumObjects * 16; ++i) {
+        created_entities.push_back(entities.create<Position>());
+        created_entities.push_back(entities.create<Position, Velocity>());
+        if (i % 3 == 0) {
+            created_entities.push_back(entities.create<Position, Orientation>());
+        }
+        (void) entities.create<Velocity>();
+    }
+
+    for (auto schedule : {mustache::JobSchedule::kDynamic, mustache::JobSchedule::kGuided}) {
+        std::vector<std::atomic<uint32_t> > visited(created_entities.size());
+        Job0 job;
+        job.visited = &visited;
+        job.setSchedule(schedule);
+        job.run(world, mustache::JobRunMode::kParallel);
+        for (const auto& value : visited) {
+            ASSERT_EQ(value.load(), 1u);
+        }
+    }
+    for (auto entity : created_entities) {
+        ASSERT_EQ(entities.getComponent<Position>(entity)->x, 2u);
+    }
+}
+
+TEST(Job, dynamic_schedule_task_hooks) {
+    constexpr uint32_t kMaxTasks = 64u;
+    struct TaskState {
+        uint32_t begin_count = 0u;
+        uint32_t end_count = 0u;
+        uint32_t end_size = 0u;
+        uint32_t processed = 0u;
+        uint32_t wrong_index_count = 0u;
+    };
+    struct Job0 : public mustache::PerEntityJob<Job0> {
+        std::vector<TaskState> tasks = std::vector<TaskState>(kMaxTasks);
+        void operator()(Position&, mustache::JobInvocationIndex job_invocation_index) {
+            auto& task = tasks[job_invocation_index.task_index.toInt()];
+            if (job_invocation_index.entity_index_in_task.toInt() != task.processed) {
+                ++task.wrong_index_count;
+            }
+            ++task.processed;
+        }
+        void onTaskBegin(mustache::World&, mustache::TaskSize, mustache::ParallelTaskId task_id) noexcept override {
+            ++tasks[task_id.toInt()].begin_count;
+        }
+        void onTaskEnd(mustache::World&, mustache::TaskSize size, mustache::ParallelTaskId task_id) noexcept override {
+            auto& task = tasks[task_id.toInt()];
+            ++task.end_count;
+            task.end_size = size.toInt();
+        }
+    };
+
+    mustache::WorldContext context;
+    context.dispatcher = std::make_shared<mustache::Dispatcher>(3u);
+    mustache::World world{context};
+    auto& entities = world.entities();
+    const uint32_t entity_count = kNumObjects * 16;
+    for (uint32_t i = 0; i < entity_count; ++i) {
+        (void) entities.create<Position>();
+        (void) entities.create<Position, Velocity>();
+    }
+
+    for (auto schedule : {mustache::JobSchedule::kDynamic, mustache::JobSchedule::kGuided}) {
+        Job0 job;
+        job.setSchedule(schedule);
+        job.run(world, mustache::JobRunMode::kParallel);
+        uint32_t processed = 0u;
+        uint32_t task_count = 0u;
+        for (const auto& task : job.tasks) {
+            if (task.begin_count == 0u) {
+                ASSERT_EQ(task.end_count, 0u);
+                continue;
+            }
+            ++task_count;
+            ASSERT_EQ(task.begin_count, 1u);
+            ASSERT_EQ(task.end_count, 1u);
+            ASSERT_EQ(task.end_size, task.processed);
+            ASSERT_EQ(task.wrong_index_count, 0u);
+            processed += task.processed;
+        }
+        ASSERT_GT(task_count, 0u);
+        ASSERT_EQ(processed, 2u * entity_count);
+    }
+}
+
+TEST(Job, for_each_lane) {
+    struct LaneJob : public mustache::PerEntityJob<LaneJob> {
+        std::atomic<uint32_t> processed{0u};
+        std::atomic<uint32_t> misaligned{0u};
+        void forEachLane(mustache::LaneMask<4> mask, LaneValue* values, const LaneSpeed* speeds) {
+            if (mask.isFull() && reinterpret_cast<uintptr_t>(values) % (mask.width * sizeof(LaneValue)) != 0u) {
+                misaligned.fetch_add(1u, std::memory_order_relaxed);
+            }
+            for (uint32_t i = 0; i < mask.width; ++i) {
+                if (mask.isActive(i)) {
+                    values[i].value += speeds[i].value;
+                }
+            }
+            processed.fetch_add(mask.count, std::memory_order_relaxed);
+        }
+    };
+    static_assert(mustache::JobInfo<LaneJob>::has_for_each_lane);
+
+    mustache::WorldContext context;
+    context.dispatcher = std::make_shared<mustache::Dispatcher>(3u);
+    mustache::World world{context};
+    auto& entities = world.entities();
+    std::vector<mustache::Entity> created_entities;
+    for (uint32_t i = 0; i < kNumObjects + 3u; ++i) {
+        auto entity = entities.create<LaneValue, LaneSpeed>();
+        entities.getComponent<LaneSpeed>(entity)->value = static_cast<float>(i % 7u);
+        created_entities.push_back(entity);
+    }
+
+    LaneJob job;
+    for (auto mode : {mustache::JobRunMode::kCurrentThread, mustache::JobRunMode::kParallel}) {
+        job.processed = 0u;
+        job.run(world, mode);
+        ASSERT_EQ(job.processed.load(), created_entities.size());
+    }
+    ASSERT_EQ(job.misaligned.load(), 0u);
+    for (uint32_t i = 0; i < created_entities.size(); ++i) {
+        ASSERT_EQ(entities.getComponent<const LaneValue>(created_entities[i])->value, 2.0f * static_cast<float>(i % 7u));
+    }
+}
+
+TEST(Job, reduction) {
+    struct Min {
+        uint32_t operator()(uint32_t a, uint32_t b) const noexcept {
+            return std::min(a, b);
+        }
+    };
+    struct ReduceJob : public mustache::PerEntityJob<ReduceJob> {
+        mustache::JobReduction<uint64_t> sum{*this};
+        mustache::JobReduction<uint32_t, Min> min{*this, std::numeric_limits<uint32_t>::max()};
+        void operator()(const ReducedValue& value, mustache::JobInvocationIndex invocation_index) {
+            sum.local(invocation_index) += value.value;
+            auto& local_min = min.local(invocation_index);
+            local_min = std::min(local_min, value.value);
+        }
+    };
+
+    mustache::WorldContext context;
+    context.dispatcher = std::make_shared<mustache::Dispatcher>(3u);
+    mustache::World world{context};
+    auto& entities = world.entities();
+    uint64_t expected_sum = 0u;
+    for (uint32_t i = 0; i < kNumObjects * 8; ++i) {
+        const uint32_t value = (i * 7919u) % 100003u + 5u;
+        auto entity = i % 2 ? entities.create<ReducedValue>() : entities.create<ReducedValue, Velocity>();
+        entities.getComponent<ReducedValue>(entity)->value = value;
+        expected_sum += value;
+    }
+
+    ReduceJob job;
+    for (auto schedule : {mustache::JobSchedule::kStatic, mustache::JobSchedule::kDynamic}) {
+        job.setSchedule(schedule);
+        for (auto mode : {mustache::JobRunMode::kCurrentThread, mustache::JobRunMode::kParallel}) {
+            job.run(world, mode);
+            ASSERT_EQ(job.sum.result(), expected_sum);
+            ASSERT_EQ(job.min.result(), 5u);
+        }
+    }
+}
+
+TEST(Job, without_and_any_of) {
+    struct FilterJob : public mustache::PerEntityJob<FilterJob> {
+        uint32_t count = 0u;
+        void operator()(const FilterA&, mustache::Without<FilterB>, mustache::AnyOf<FilterC, FilterD>) {
+            ++count;
+        }
+    };
+    using Info = mustache::JobInfo<FilterJob>::FunctionInfo;
+    static_assert(Info::components_count == 1);
+
+    mustache::World world;
+    auto& entities = world.entities();
+    for (uint32_t i = 0; i < kNumObjects; ++i) {
+        (void) entities.create<FilterA>();
+        (void) entities.create<FilterA, FilterB>();
+        (void) entities.create<FilterA, FilterC>();
+        (void) entities.create<FilterA, FilterD>();
+        (void) entities.create<FilterA, FilterB, FilterC>();
+    }
+
+    FilterJob job;
+    for (auto mode : {mustache::JobRunMode::kCurrentThread, mustache::JobRunMode::kParallel}) {
+        job.count = 0u;
+        job.run(world, mode);
+        ASSERT_EQ(job.count, 2u * kNumObjects);
+
+        std::atomic<uint32_t> count{0u};
+        entities.forEach([&count](const FilterA&, mustache::Without<FilterB>) {
+            ++count;
+        }, mode);
+        ASSERT_EQ(count.load(), 3u * kNumObjects);
+    }
+
+    uint32_t non_template_count = 0u;
+    mustache::NonTemplateJob non_template_job;
+    const auto& factory = mustache::ComponentFactory::instance();
+    non_template_job.component_requests = {{factory.registerComponent<FilterA>(), true, true}};
+    non_template_job.exclude_mask.set(factory.registerComponent<FilterB>(), true);
+    non_template_job.any_mask.set(factory.registerComponent<FilterC>(), true);
+    non_template_job.callback = [&non_template_count](const mustache::NonTemplateJob::ForEachArrayArgs& args) {
+        non_template_count += args.count.toInt();
+    };
+    non_template_job.run(world);
+    ASSERT_EQ(non_template_count, kNumObjects);
+}
+
+TEST(Job, fused) {
+    struct Integrate : public mustache::PerEntityJob<Integrate> {
+        void operator()(FusedPosition& position, const FusedVelocity& velocity) {
+            position.x += velocity.value;
+        }
+    };
+    struct Clamp : public mustache::PerEntityJob<Clamp> {
+        void operator()(FusedPosition& position) {
+            position.x = std::min(position.x, 100);
+        }
+    };
+    struct Bounds : public mustache::PerEntityJob<Bounds> {
+        void operator()(const FusedPosition& position, FusedBounds& bounds) {
+            bounds.max = std::max(bounds.max, position.x);
+        }
+    };
+    using Fused = mustache::FusedJob<Integrate, Clamp, Bounds>;
+
+    struct Snapshot {
+        int position = 0;
+        int bounds = 0;
+        bool position_updated = false;
+        bool velocity_updated = false;
+        bool bounds_updated = false;
+    };
+    const auto run = [](bool fused) {
+        mustache::World world;
+        auto& entities = world.entities();
+        std::vector<mustache::Entity> created_entities;
+        for (int i = 0; i < static_cast<int>(kNumObjects); ++i) {
+            created_entities.push_back(entities.create<FusedPosition>());
+            created_entities.push_back(entities.create<FusedPosition, FusedVelocity>());
+            created_entities.push_back(entities.create<FusedPosition, FusedVelocity, FusedBounds>());
+            created_entities.push_back(entities.create<FusedVelocity>());
+            created_entities.push_back(entities.create<FusedVelocity, FusedBounds>());
+        }
+        for (size_t i = 0; i < created_entities.size(); ++i) {
+            if (auto velocity = entities.getComponent<FusedVelocity>(created_entities[i])) {
+                velocity->value = static_cast<int>(i % 150u);
+            }
+        }
+        world.update();
+        const auto version_before = world.version();
+        Fused fused_job;
+        Integrate integrate;
+        Clamp clamp;
+        Bounds bounds;
+        for (uint32_t i = 0; i < 2u; ++i) {
+            if (fused) {
+                fused_job.run(world, i == 0 ? mustache::JobRunMode::kCurrentThread : mustache::JobRunMode::kParallel);
+            } else {
+                integrate.run(world);
+                clamp.run(world);
+                bounds.run(world);
+            }
+        }
+        std::vector<Snapshot> result;
+        for (auto entity : created_entities) {
+            Snapshot snapshot;
+            if (auto position = entities.getComponent<const FusedPosition>(entity)) {
+                snapshot.position = position->x;
+                snapshot.position_updated =
+                        entities.getWorldVersionOfLastComponentUpdate<FusedPosition>(entity) > version_before;
+            }
+            if (entities.hasComponent<FusedVelocity>(entity)) {
+                snapshot.velocity_updated =
+                        entities.getWorldVersionOfLastComponentUpdate<FusedVelocity>(entity) > version_before;
+            }
+            if (auto bounds_component = entities.getComponent<const FusedBounds>(entity)) {
+                snapshot.bounds = bounds_component->max;
+                snapshot.bounds_updated =
+                        entities.getWorldVersionOfLastComponentUpdate<FusedBounds>(entity) > version_before;
+            }
+            result.push_back(snapshot);
+        }
+        return result;
+    };
+
+    const auto separate = run(false);
+    const auto fused = run(true);
+    ASSERT_EQ(separate.size(), fused.size());
+    for (size_t i = 0; i < fused.size(); ++i) {
+        ASSERT_EQ(fused[i].position, separate[i].position);
+        ASSERT_EQ(fused[i].bounds, separate[i].bounds);
+        ASSERT_EQ(fused[i].position_updated, separate[i].position_updated);
+        ASSERT_EQ(fused[i].velocity_updated, separate[i].velocity_updated);
+        ASSERT_EQ(fused[i].bounds_updated, separate[i].bounds_updated);
+    }
+}
+
 TEST(Job, iterate_and_check_value) {
     static_data.reset();
 
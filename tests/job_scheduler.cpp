@@ -0,0 +1,204 @@
+#include <mustache/ecs/world.hpp>
+#include <mustache/ecs/job.hpp>
+#include <mustache/ecs/fused_job.hpp>
+#include <mustache/ecs/job_scheduler.hpp>
+#include <mustache/ecs/non_template_job.hpp>
+#include <gtest/gtest.h>
+
+#include <atomic>
+
+namespace {
+    struct ScheduledPosition {
+        uint32_t value = 0u;
+    };
+    struct ScheduledVelocity {
+        uint32_t value = 0u;
+    };
+    struct ScheduledHealth {
+        uint32_t value = 0u;
+    };
+    struct ScheduledMana {
+        uint32_t value = 0u;
+    };
+
+    enum : uint32_t {
+        kNumObjects = 4096,
+        kNumIteration = 16,
+    };
+
+    struct MoveJob : public mustache::PerEntityJob<MoveJob> {
+        void operator()(ScheduledPosition& position, const ScheduledVelocity& velocity) const {
+            position.value += velocity.value;
+        }
+    };
+    struct AccelerateJob : public mustache::PerEntityJob<AccelerateJob> {
+        void operator()(ScheduledVelocity& velocity) const {
+            ++velocity.value;
+        }
+    };
+    struct HealJob : public mustache::PerEntityJob<HealJob> {
+        void operator()(ScheduledHealth& health) const {
+            health.value += 2u;
+        }
+    };
+    struct RegenerateManaJob : public mustache::PerEntityJob<RegenerateManaJob> {
+        void operator()(ScheduledMana& mana, const ScheduledHealth& health) const {
+            mana.value += health.value;
+        }
+    };
+    struct ReadVelocityJob : public mustache::PerEntityJob<ReadVelocityJob> {
+        void operator()(const ScheduledVelocity&) const {
+        }
+    };
+    struct ReadOptionalHealthJob : public mustache::PerEntityJob<ReadOptionalHealthJob> {
+        void operator()(const ScheduledPosition&, const ScheduledHealth*) const {
+        }
+    };
+}
+
+TEST(JobScheduler, dependencies_from_component_access) {
+    MoveJob move;
+    AccelerateJob accelerate;
+    HealJob heal;
+    RegenerateManaJob regenerate;
+    ReadVelocityJob read_velocity;
+
+    mustache::JobScheduler scheduler;
+    scheduler.addJob(move);
+    scheduler.addJob(read_velocity);
+    scheduler.addJob(heal);
+    scheduler.addJob(accelerate);
+    scheduler.addJob(regenerate);
+    ASSERT_EQ(scheduler.jobCount(), 5u);
+
+    ASSERT_FALSE(scheduler.dependsOn(1, 0)); // both only read ScheduledVelocity
+    ASSERT_FALSE(scheduler.dependsOn(2, 0));
+    ASSERT_FALSE(scheduler.dependsOn(2, 1));
+    ASSERT_TRUE(scheduler.dependsOn(3, 0)); // write after read
+    ASSERT_TRUE(scheduler.dependsOn(3, 1));
+    ASSERT_FALSE(scheduler.dependsOn(3, 2));
+    ASSERT_TRUE(scheduler.dependsOn(4, 2)); // read after write
+    ASSERT_FALSE(scheduler.dependsOn(4, 3));
+}
+
+TEST(JobScheduler, optional_component_access) {
+    const auto health_id = mustache::ComponentFactory::instance().registerComponent<ScheduledHealth>();
+    ReadOptionalHealthJob read_health;
+    ASSERT_TRUE(read_health.readMask().has(health_id));
+    ASSERT_FALSE(read_health.writeMask().has(health_id));
+    mustache::FusedJob<ReadOptionalHealthJob> fused;
+    ASSERT_TRUE(fused.readMask().has(health_id));
+
+    HealJob heal;
+    ReadOptionalHealthJob read_after_heal;
+    mustache::JobScheduler scheduler;
+    scheduler.addJob(read_health);
+    scheduler.addJob(heal);
+    scheduler.addJob(read_after_heal);
+    ASSERT_TRUE(scheduler.dependsOn(1, 0)); // write after optional read
+    ASSERT_TRUE(scheduler.dependsOn(2, 1)); // optional read after write
+}
+
+TEST(JobScheduler, explicit_dependency) {
+    MoveJob move;
+    HealJob heal;
+    mustache::JobScheduler scheduler;
+    scheduler.addJob(move);
+    scheduler.addJob(heal);
+    ASSERT_FALSE(scheduler.dependsOn(1, 0));
+    scheduler.addDependency(move, heal);
+    ASSERT_TRUE(scheduler.dependsOn(1, 0));
+    scheduler.addDependency(heal, move);
+    ASSERT_THROW((void) scheduler.dependsOn(1, 0), std::runtime_error);
+}
+
+TEST(JobScheduler, non_template_job_access) {
+    auto& factory = mustache::ComponentFactory::instance();
+    mustache::NonTemplateJob write_position;
+    write_position.component_requests = {
+            {factory.registerComponent<ScheduledPosition>(), false, true},
+            {factory.registerComponent<ScheduledVelocity>(), true, true},
+    };
+    mustache::NonTemplateJob read_velocity;
+    read_velocity.component_requests = {
+            {factory.registerComponent<ScheduledVelocity>(), true, true},
+    };
+    AccelerateJob accelerate;
+    mustache::JobScheduler scheduler;
+    scheduler.addJob(write_position);
+    scheduler.addJob(read_velocity);
+    scheduler.addJob(accelerate);
+    ASSERT_FALSE(scheduler.dependsOn(1, 0));
+    ASSERT_TRUE(scheduler.dependsOn(2, 0));
+    ASSERT_TRUE(scheduler.dependsOn(2, 1));
+}
+
+TEST(JobScheduler, run) {
+    for (auto mode : {mustache::JobRunMode::kCurrentThread, mustache::JobRunMode::kParallel}) {
+        mustache::WorldContext context;
+        context.dispatcher = std::make_shared<mustache::Dispatcher>(3u);
+        mustache::World world{context};
+        auto& entities = world.entities();
+        std::vector<mustache::Entity> created;
+        for (uint32_t i = 0; i < kNumObjects; ++i) {
+            created.push_back(entities.begin()
+                    .assign<ScheduledPosition>(0u)
+                    .assign<ScheduledVelocity>(i)
+                    .assign<ScheduledHealth>(1u)
+                    .assign<ScheduledMana>(0u)
+                    .end());
+        }
+        MoveJob move;
+        AccelerateJob accelerate;
+        HealJob heal;
+        RegenerateManaJob regenerate;
+        mustache::JobScheduler scheduler;
+        scheduler.addJob(move, mode);
+        scheduler.addJob(heal, mode);
+        scheduler.addJob(accelerate, mode);
+        scheduler.addJob(regenerate, mode);
+        for (uint32_t i = 0; i < kNumIteration; ++i) {
+            scheduler.run(world);
+        }
+        for (uint32_t i = 0; i < kNumObjects; ++i) {
+            const auto entity = created[i];
+            // velocity is read by MoveJob before AccelerateJob increments it
+            const uint32_t expected_position = kNumIteration * i + kNumIteration * (kNumIteration - 1) / 2;
+            ASSERT_EQ(entities.getComponent<ScheduledPosition>(entity)->value, expected_position);
+            ASSERT_EQ(entities.getComponent<ScheduledVelocity>(entity)->value, i + kNumIteration);
+            ASSERT_EQ(entities.getComponent<ScheduledHealth>(entity)->value, 1u + 2u * kNumIteration);
+            // sum of (1 + 2 * k) for k = 1..N
+            ASSERT_EQ(entities.getComponent<ScheduledMana>(entity)->value, kNumIteration + kNumIteration * (kNumIteration + 1));
+        }
+    }
+}
+
+TEST(JobScheduler, change_filter_sees_later_writer) {
+    static constexpr uint32_t kCount = 100u;
+    mustache::World world;
+    auto& entities = world.entities();
+    for (uint32_t i = 0; i < kCount; ++i) {
+        (void) entities.create<ScheduledHealth>();
+    }
+    struct ChangedHealthJob : public mustache::PerEntityJob<ChangedHealthJob> {
+        std::atomic<uint32_t> changed{0u};
+        void operator()(const ScheduledHealth&) {
+            ++changed;
+        }
+        mustache::ComponentIdMask checkMask() const noexcept override {
+            return mustache::ComponentFactory::instance().makeMask<ScheduledHealth>();
+        }
+    };
+    ChangedHealthJob changed_health;
+    HealJob heal;
+    mustache::JobScheduler scheduler;
+    scheduler.addJob(changed_health);
+    scheduler.addJob(heal);
+    ASSERT_TRUE(scheduler.dependsOn(1, 0));
+    for (uint32_t i = 0; i < 3u; ++i) {
+        changed_health.changed = 0u;
+        scheduler.run(world);
+        // the writer runs after the reader, its writes are seen in the next run
+        ASSERT_EQ(changed_health.changed.load(), kCount);
+    }
+}
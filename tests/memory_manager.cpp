@@ -0,0 +1,81 @@
+#include <mustache/utils/memory_manager.hpp>
+#include <mustache/utils/container_vector.hpp>
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace mustache;
+
+TEST(MemoryManager, pool_allocator) {
+    MemoryManager memory_manager;
+    {
+        mustache::vector<uint64_t, Allocator<uint64_t> > values{memory_manager};
+        for (uint64_t i = 0; i < 1024u; ++i) {
+            values.push_back(i);
+        }
+        for (uint64_t i = 0; i < 1024u; ++i) {
+            ASSERT_EQ(values[i], i);
+        }
+    }
+    const auto statistics = memory_manager.statistics();
+    ASSERT_GT(statistics.allocations, 0u);
+    ASSERT_GT(statistics.pool_allocations, 0u);
+    ASSERT_LT(statistics.pool_allocations, statistics.allocations); // 8KB of values is allocated on heap
+    ASSERT_EQ(statistics.allocations, statistics.deallocations);
+
+    // blocks are aligned to size class
+    for (size_t align = 8; align <= MemoryManager::max_pool_block_size; align *= 2) {
+        void* ptr = memory_manager.allocatePooled(align / 2u, align);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr) % align, 0u);
+        memory_manager.deallocatePooled(ptr, align / 2u, align);
+    }
+}
+
+TEST(MemoryManager, pool_allocator_threads) {
+    static constexpr uint32_t kThreadCount = 4u;
+    static constexpr uint32_t kBlockCount = 4096u;
+    MemoryManager memory_manager;
+    std::vector<std::vector<uint32_t*> > blocks(kThreadCount);
+    std::vector<std::thread> threads;
+    for (uint32_t thread = 0; thread < kThreadCount; ++thread) {
+        threads.emplace_back([&memory_manager, &blocks, thread] {
+            for (uint32_t i = 0; i < kBlockCount; ++i) {
+                auto block = static_cast<uint32_t*>(memory_manager.allocatePooled(sizeof(uint32_t) * 4u));
+                block[0] = thread;
+                block[3] = i;
+                blocks[thread].push_back(block);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (uint32_t thread = 0; thread < kThreadCount; ++thread) {
+        for (uint32_t i = 0; i < kBlockCount; ++i) {
+            ASSERT_EQ(blocks[thread][i][0], thread);
+            ASSERT_EQ(blocks[thread][i][3], i);
+            // blocks of exited threads are freed by other thread
+            memory_manager.deallocatePooled(blocks[thread][i], sizeof(uint32_t) * 4u);
+        }
+    }
+    ASSERT_EQ(memory_manager.statistics().pool_allocations, kThreadCount * kBlockCount);
+}
+
+TEST(MemoryManager, frame_arena) {
+    MemoryManager memory_manager;
+    for (uint32_t frame = 0; frame < 3u; ++frame) {
+        mustache::vector<uint32_t, Allocator<uint32_t> > values{memory_manager.allocator<uint32_t>(AllocationMode::kFrame)};
+        for (uint32_t i = 0; i < 100000u; ++i) {
+            values.push_back(i);
+        }
+        ASSERT_EQ(values[99999u], 99999u);
+        auto ptr = memory_manager.allocateFrame(3u, 64u);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr) % 64u, 0u);
+        ASSERT_GT(memory_manager.statistics().frame_bytes, 100000u * sizeof(uint32_t));
+        values = {};
+        memory_manager.resetFrame();
+        ASSERT_EQ(memory_manager.statistics().frame_bytes, 0u);
+    }
+    ASSERT_EQ(memory_manager.statistics().allocations, 0u);
+}
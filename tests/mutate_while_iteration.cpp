@@ -2,6 +2,10 @@
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 namespace {
     constexpr uint32_t N = 1024 * 1024;
 
@@ -324,3 +328,201 @@ TEST(EntityManager, lock_unlock) {
     ASSERT_EQ(0, count);
     ASSERT_FALSE(error);
 }
+
+TEST(EntityManager, create_while_iteration) {
+    struct Source {
+        uint32_t value = 0u;
+    };
+    struct Spawned {
+        uint32_t value = 0u;
+    };
+    static constexpr uint32_t kCount = 4096u;
+
+    mustache::World world;
+    auto& entities = world.entities();
+    for (uint32_t i = 0; i < kCount; ++i) {
+        (void) entities.begin().assign<Source>(i).end();
+    }
+    entities.forEach([&entities](const Source& source) {
+        const auto entity = entities.create();
+        entities.assign<Spawned>(entity, source.value);
+        if (source.value % 7u == 0u) {
+            entities.assign<Component2>(entity).value = Component2::str(source.value);
+        }
+        if (source.value % 5u == 0u) {
+            // assigned and removed while locked, must not be in the final archetype
+            entities.assign<Component1>(entity);
+            entities.removeComponent<Component1>(entity);
+        }
+    }, mustache::JobRunMode::kParallel);
+
+    std::vector<uint32_t> found(kCount, 0u);
+    entities.forEach([&found](const Spawned& spawned, const Component2* str, const Component1* removed) {
+        ASSERT_LT(spawned.value, kCount);
+        ++found[spawned.value];
+        ASSERT_EQ(removed, nullptr);
+        ASSERT_EQ(str != nullptr, spawned.value % 7u == 0u);
+        if (str != nullptr) {
+            ASSERT_EQ(str->value, Component2::str(spawned.value));
+        }
+    });
+    for (uint32_t i = 0; i < kCount; ++i) {
+        ASSERT_EQ(found[i], 1u);
+    }
+
+    // locations of entities inserted in bulk point to their archetypes
+    entities.forEachArchetype([&entities](mustache::Archetype& archetype) {
+        for (const auto entity : archetype.entities()) {
+            ASSERT_TRUE(entities.isEntityValid(entity));
+            ASSERT_EQ(entities.getArchetypeOf(entity), &archetype);
+        }
+    });
+}
+
+TEST(EntityManager, coalesce_commands_while_locked) {
+    struct Coalesced {
+        uint32_t value = 0u;
+    };
+    struct CoalescedTag {
+        uint32_t value = 0u;
+    };
+
+    mustache::World world;
+    auto& entities = world.entities();
+    const auto moved = entities.begin().assign<Coalesced>(1u).end();
+    const auto destroyed = entities.begin().assign<Coalesced>(2u).end();
+    const auto archetypes_count = entities.getArchetypesCount();
+
+    entities.lock();
+    entities.assign<Component2>(moved).value = Component2::str(1u);
+    entities.assign<CoalescedTag>(moved);
+    entities.assign<Component2>(moved).value = Component2::str(2u);
+    entities.assign<Coalesced>(moved, 3u);
+    entities.removeComponent<CoalescedTag>(moved);
+
+    entities.assign<Component2>(destroyed);
+    entities.destroyNow(destroyed);
+
+    const auto created = entities.create();
+    entities.assign<Coalesced>(created, 4u);
+    entities.assign<Component2>(created).value = Component2::str(3u);
+    entities.assign<Coalesced>(created, 5u);
+    entities.unlock();
+
+    // every entity moved once, {Coalesced, CoalescedTag} and {Coalesced, CoalescedTag, Component2} are not created
+    ASSERT_EQ(entities.getArchetypesCount(), archetypes_count + 1u);
+    ASSERT_FALSE(entities.isEntityValid(destroyed));
+    ASSERT_FALSE(entities.hasComponent<CoalescedTag>(moved));
+    ASSERT_EQ(entities.getComponent<Coalesced>(moved)->value, 3u);
+    ASSERT_EQ(entities.getComponent<Component2>(moved)->value, Component2::str(2u));
+    ASSERT_EQ(entities.getComponent<Coalesced>(created)->value, 5u);
+    ASSERT_EQ(entities.getComponent<Component2>(created)->value, Component2::str(3u));
+    ASSERT_EQ(entities.getArchetypeOf(moved), entities.getArchetypeOf(created));
+}
+
+namespace {
+    struct WorldConstructed {
+        static std::atomic<uint32_t> off_thread_count;
+        static std::thread::id main_thread;
+
+        explicit WorldConstructed(mustache::World& world):
+                archetypes_count{world.entities().getArchetypesCount()} {
+            if (std::this_thread::get_id() != main_thread) {
+                ++off_thread_count;
+            }
+            // gives workers time to pick tasks if the constructor was called in parallel
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+        }
+        size_t archetypes_count;
+    };
+    std::atomic<uint32_t> WorldConstructed::off_thread_count{0u};
+    std::thread::id WorldConstructed::main_thread;
+}
+
+TEST(EntityManager, create_world_constructed_while_iteration) {
+    static constexpr uint32_t kCount = 4096u;
+    mustache::WorldContext context;
+    context.dispatcher = std::make_shared<mustache::Dispatcher>(3u);
+    mustache::World world{context};
+    auto& entities = world.entities();
+    for (uint32_t i = 0; i < kCount; ++i) {
+        (void) entities.create<Component0>();
+    }
+    WorldConstructed::main_thread = std::this_thread::get_id();
+    WorldConstructed::off_thread_count = 0u;
+    entities.forEach([&entities](const Component0&) {
+        (void) entities.create<WorldConstructed>();
+    }, mustache::JobRunMode::kParallel);
+
+    // constructors which take World& may change the world, they are called on the thread which unlocks it
+    const auto& factory = mustache::ComponentFactory::instance();
+    ASSERT_TRUE(factory.componentInfo(factory.registerComponent<WorldConstructed>()).world_constructor);
+    ASSERT_FALSE(factory.componentInfo(factory.registerComponent<Component0>()).world_constructor);
+    uint32_t count = 0u;
+    entities.forEach([&count](const WorldConstructed& component) {
+        ASSERT_GT(component.archetypes_count, 0u);
+        ++count;
+    });
+    ASSERT_EQ(count, kCount);
+    ASSERT_EQ(WorldConstructed::off_thread_count.load(), 0u);
+}
+
+namespace {
+    struct HookCounters {
+        uint32_t after_assign = 0u;
+        uint32_t before_remove = 0u;
+        int32_t alive = 0;
+    };
+    HookCounters hook_counters;
+
+    struct Reassigned {
+        static void afterAssign() {
+            ++hook_counters.after_assign;
+        }
+        static void beforeRemove() {
+            ++hook_counters.before_remove;
+        }
+        Reassigned() {
+            ++hook_counters.alive;
+        }
+        explicit Reassigned(uint32_t v):
+                value{v} {
+            ++hook_counters.alive;
+        }
+        Reassigned(Reassigned&& other) noexcept:
+                value{other.value} {
+            ++hook_counters.alive;
+        }
+        Reassigned& operator=(Reassigned&&) = default;
+        ~Reassigned() {
+            --hook_counters.alive;
+        }
+        uint32_t value = 0u;
+    };
+}
+
+TEST(EntityManager, coalesce_remove_assign_hooks) {
+    mustache::World world;
+    auto& entities = world.entities();
+    const auto unlocked = entities.begin().assign<Reassigned>(1u).end();
+    const auto locked = entities.begin().assign<Reassigned>(1u).end();
+
+    hook_counters = {};
+    entities.removeComponent<Reassigned>(unlocked);
+    entities.assign<Reassigned>(unlocked, 2u);
+    const auto expected = hook_counters;
+    ASSERT_EQ(expected.before_remove, 1u);
+    ASSERT_EQ(expected.after_assign, 1u);
+
+    // coalesced commands skip the extra archetype moves, but report the same hooks
+    hook_counters = {};
+    entities.lock();
+    entities.removeComponent<Reassigned>(locked);
+    entities.assign<Reassigned>(locked, 3u);
+    entities.unlock();
+    ASSERT_EQ(hook_counters.before_remove, expected.before_remove);
+    ASSERT_EQ(hook_counters.after_assign, expected.after_assign);
+    ASSERT_EQ(hook_counters.alive, 0);
+    ASSERT_EQ(entities.getComponent<Reassigned>(unlocked)->value, 2u);
+    ASSERT_EQ(entities.getComponent<Reassigned>(locked)->value, 3u);
+}
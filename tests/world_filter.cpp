@@ -107,3 +107,77 @@ TEST(WorldFilter, chunk_version) {
     }
 
 }
+
+TEST(WorldFilter, archetype_cache_sees_new_archetypes) {
+    struct Job : mustache::PerEntityJob<Job> {
+        uint32_t count = 0u;
+        void operator() (const Component<5, 4>&) {
+            ++count;
+        }
+    };
+    Job job;
+    for (uint32_t world_index = 0; world_index < 2; ++world_index) {
+        mustache::World world{mustache::WorldId::make(0)};
+        auto& entities = world.entities();
+        (void) entities.create<Component<5, 4> >();
+        (void) entities.create<Component<6, 4> >();
+        job.count = 0u;
+        job.run(world);
+        ASSERT_EQ(job.count, 1u);
+
+        (void) entities.create<Component<5, 4>, Component<6, 4> >();
+        (void) entities.create<Component<5, 4>, Component<7, 4> >();
+        (void) entities.create<Component<7, 4> >();
+        job.count = 0u;
+        job.run(world);
+        ASSERT_EQ(job.count, 3u);
+    }
+}
+
+TEST(WorldFilter, chunk_group_version) {
+    constexpr uint32_t kNumObjects = 100000u;
+    using Item = Component<8, 4>;
+
+    struct Job : mustache::PerEntityJob<Job> {
+        uint32_t count = 0u;
+        void operator() (const Item&) {
+            ++count;
+        }
+
+        mustache::ComponentIdMask checkMask() const noexcept {
+            return mustache::ComponentFactory::instance().makeMask<Item>();
+        }
+    };
+    mustache::World world{mustache::WorldId::make(0)};
+    auto& entities = world.entities();
+    world.dispatcher().setSingleThreadMode(true);
+
+    std::vector<mustache::Entity> items;
+    items.reserve(kNumObjects);
+    for (uint32_t i = 0; i < kNumObjects; ++i) {
+        items.push_back(entities.create<Item>());
+    }
+    const uint32_t chunk_capacity = entities.getArchetypeOf(items.front())->chunkCapacity().toInt();
+
+    Job job;
+    job.run(world);
+    ASSERT_EQ(job.count, kNumObjects);
+    world.update();
+
+    job.count = 0u;
+    job.run(world);
+    ASSERT_EQ(job.count, 0u);
+    world.update();
+
+    // first entity of a chunk far from the archetype begin
+    const uint32_t changed_index = chunk_capacity * (kNumObjects / chunk_capacity / 2u);
+    entities.getComponent<Item>(items[changed_index])->data[0] = std::byte{1};
+    job.count = 0u;
+    job.run(world);
+    ASSERT_EQ(job.count, chunk_capacity);
+    world.update();
+
+    job.count = 0u;
+    job.run(world);
+    ASSERT_EQ(job.count, 0u);
+}